@@ -0,0 +1,101 @@
+// Counts the calls to the global allocator made by elaborate(), the parallel
+// explorer, and to_state_graph() with and without elaborate_config::recycle,
+// which covers the simulator pool and the scratch memory of enabled(). The
+// graph is a set of independent *[x+; x-] cycles that are all marked, so it
+// has two to the number of cycles reachable states.
+//
+// make bench && ./build/bench/allocation
+
+#include <common/standard.h>
+#include <common/timer.h>
+#include <hse/graph.h>
+#include <hse/elaborator.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+std::atomic<size_t> allocations(0);
+
+void *operator new(size_t size) {
+	allocations++;
+	void *result = malloc(size == 0 ? 1 : size);
+	if (result == nullptr) {
+		throw std::bad_alloc();
+	}
+	return result;
+}
+
+void operator delete(void *ptr) noexcept {
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+	free(ptr);
+}
+
+hse::graph generate(int loops) {
+	hse::graph g;
+	vector<petri::token> tokens;
+	boolean::cube encoding;
+	for (int i = 0; i < loops; i++) {
+		int x = g.create(hse::net("x" + ::to_string(i), 0));
+		encoding &= boolean::cube(x, 0);
+
+		petri::iterator p0 = g.create(hse::place());
+		petri::iterator t0 = g.create(hse::transition(1, 1, boolean::cover(x, 1)));
+		petri::iterator p1 = g.create(hse::place());
+		petri::iterator t1 = g.create(hse::transition(1, 1, boolean::cover(x, 0)));
+		g.connect(p0, t0);
+		g.connect(t0, p1);
+		g.connect(p1, t1);
+		g.connect(t1, p0);
+
+		tokens.push_back(petri::token(p0.index));
+	}
+
+	g.reset.push_back(hse::state(tokens, boolean::cover(encoding)));
+	g.update_arc_index();
+	return g;
+}
+
+void report(const char *name, size_t without, size_t with, double states) {
+	printf("%s: %zu allocations without recycling, %zu with (%.1f vs %.1f per state, %.0f%% fewer)\n",
+		name, without, with, (double)without/states, (double)with/states,
+		100.0*(1.0 - (double)with/(double)without));
+}
+
+int main(int argc, char **argv) {
+	int loops = argc > 1 ? atoi(argv[1]) : 12;
+	double states = (double)(1 << loops);
+
+	size_t counts[3][2];
+	for (int recycle = 0; recycle < 2; recycle++) {
+		hse::elaborate_config config;
+		config.recycle = recycle != 0;
+
+		hse::graph g = generate(loops);
+		size_t start = allocations;
+		hse::elaborate(g, config);
+		counts[0][recycle] = allocations - start;
+
+		hse::elaborate_config parallel = config;
+		parallel.threads = 4;
+		hse::graph p = generate(loops);
+		start = allocations;
+		hse::elaborate(p, parallel);
+		counts[1][recycle] = allocations - start;
+
+		hse::graph h = generate(loops);
+		start = allocations;
+		hse::graph s = hse::to_state_graph(h, config);
+		counts[2][recycle] = allocations - start;
+	}
+
+	report("elaborate", counts[0][0], counts[0][1], states);
+	report("elaborate, 4 threads", counts[1][0], counts[1][1], states);
+	report("to_state_graph", counts[2][0], counts[2][1], states);
+	return 0;
+}
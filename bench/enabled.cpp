@@ -0,0 +1,68 @@
+// Measures the cost of simulator::enabled() as the graph grows while the
+// number of tokens stays fixed. The graph is a set of independent loops, each
+// one toggling its own net, and only a handful of them are marked. With the
+// arc index, the time per step should stay flat as the number of loops grows.
+//
+// make bench && ./build/bench/enabled
+
+#include <common/standard.h>
+#include <common/timer.h>
+#include <hse/graph.h>
+#include <hse/simulator.h>
+
+#include <cstdlib>
+
+using namespace std;
+
+// Build a graph of independent *[x+; x-] cycles with a token in the first
+// few of them.
+hse::graph generate(int loops, int marked) {
+	hse::graph g;
+	vector<petri::token> tokens;
+	boolean::cube encoding;
+	for (int i = 0; i < loops; i++) {
+		int x = g.create(hse::net("x" + ::to_string(i), 0));
+		encoding &= boolean::cube(x, 0);
+
+		petri::iterator p0 = g.create(hse::place());
+		petri::iterator t0 = g.create(hse::transition(1, 1, boolean::cover(x, 1)));
+		petri::iterator p1 = g.create(hse::place());
+		petri::iterator t1 = g.create(hse::transition(1, 1, boolean::cover(x, 0)));
+		g.connect(p0, t0);
+		g.connect(t0, p1);
+		g.connect(p1, t1);
+		g.connect(t1, p0);
+
+		if (i < marked) {
+			tokens.push_back(petri::token(p0.index));
+		}
+	}
+
+	g.reset.push_back(hse::state(tokens, boolean::cover(encoding)));
+	g.update_arc_index();
+	return g;
+}
+
+int main(int argc, char **argv) {
+	int steps = argc > 1 ? atoi(argv[1]) : 100000;
+	int marked = 4;
+
+	for (int loops = 16; loops <= 16384; loops *= 4) {
+		hse::graph g = generate(loops, marked);
+		hse::simulator sim(&g, g.reset[0]);
+
+		Timer tmr;
+		int fired = 0;
+		for (int i = 0; i < steps; i++) {
+			if (sim.enabled() == 0) {
+				break;
+			}
+			sim.fire(i%(int)sim.ready.size());
+			fired++;
+		}
+		double seconds = tmr.since();
+		printf("%6d loops, %d tokens, %d arcs: %.2f us/step\n", loops, marked, (int)g.arcs[petri::place::type].size(), seconds*1e6/(double)fired);
+	}
+
+	return 0;
+}
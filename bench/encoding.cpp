@@ -0,0 +1,77 @@
+// Compares the steps per second of a simulation that memoizes its guard
+// checks with and without the packed diff of the encodings as the number of
+// nets grows. The graph is a set of independent *[x+; x-] cycles that are
+// all marked, so every step changes one net and most guard checks stay
+// valid.
+//
+// The packed diff only finds the nets that changed between two calls
+// to enabled() so that the guard memo can forget the checks that read them.
+// This measures random_walks() and simulate_timed(), which memoize their
+// guards. It says nothing about elaborate(), whose guard checks and
+// assignments go through boolean::cube either way.
+//
+// make bench && ./build/bench/encoding
+
+#include <common/standard.h>
+#include <common/timer.h>
+#include <hse/graph.h>
+#include <hse/simulator.h>
+
+#include <cstdlib>
+
+using namespace std;
+
+hse::graph generate(int loops) {
+	hse::graph g;
+	vector<petri::token> tokens;
+	boolean::cube encoding;
+	for (int i = 0; i < loops; i++) {
+		int x = g.create(hse::net("x" + ::to_string(i), 0));
+		encoding &= boolean::cube(x, 0);
+
+		petri::iterator p0 = g.create(hse::place());
+		petri::iterator t0 = g.create(hse::transition(1, 1, boolean::cover(x, 1)));
+		petri::iterator p1 = g.create(hse::place());
+		petri::iterator t1 = g.create(hse::transition(1, 1, boolean::cover(x, 0)));
+		g.connect(p0, t0);
+		g.connect(t0, p1);
+		g.connect(p1, t1);
+		g.connect(t1, p0);
+
+		tokens.push_back(petri::token(p0.index));
+	}
+
+	g.reset.push_back(hse::state(tokens, boolean::cover(encoding)));
+	g.update_arc_index();
+	return g;
+}
+
+double run(hse::graph &g, bool packed_diff, int steps) {
+	hse::simulator sim(&g, g.reset[0]);
+	sim.memoize_guards = true;
+	sim.packed_diff = packed_diff;
+
+	Timer tmr;
+	int fired = 0;
+	for (int i = 0; i < steps; i++) {
+		if (sim.enabled() == 0) {
+			break;
+		}
+		sim.fire((i*7)%(int)sim.ready.size());
+		fired++;
+	}
+	return (double)fired/tmr.since();
+}
+
+int main(int argc, char **argv) {
+	int steps = argc > 1 ? atoi(argv[1]) : 100000;
+
+	for (int nets = 16; nets <= 256; nets *= 2) {
+		hse::graph g = generate(nets);
+		double generic = run(g, false, steps);
+		double packed = run(g, true, steps);
+		printf("%4d nets: generic %.0f steps/s, packed diff %.0f steps/s (%.2fx)\n", nets, generic, packed, packed/generic);
+	}
+
+	return 0;
+}
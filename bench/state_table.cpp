@@ -0,0 +1,122 @@
+// Compares the memory footprint and insert throughput of the state_table
+// against the std::unordered_set<hse::state> it replaced in elaborate() and
+// to_state_graph().
+//
+// make bench && ./build/bench/state_table
+
+#include <common/standard.h>
+#include <common/timer.h>
+#include <hse/state.h>
+#include <hse/state_table.h>
+
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <unordered_set>
+
+// Count the live heap bytes so that we can measure the real cost of each
+// container rather than guessing at its overhead.
+size_t live_bytes = 0;
+
+void *operator new(size_t size) {
+	size_t *ptr = (size_t*)malloc(size + sizeof(max_align_t));
+	if (ptr == nullptr) {
+		throw std::bad_alloc();
+	}
+	*ptr = size;
+	live_bytes += size;
+	return (char*)ptr + sizeof(max_align_t);
+}
+
+void operator delete(void *ptr) noexcept {
+	if (ptr != nullptr) {
+		size_t *base = (size_t*)((char*)ptr - sizeof(max_align_t));
+		live_bytes -= *base;
+		free(base);
+	}
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+	operator delete(ptr);
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete[](void *ptr) noexcept {
+	operator delete(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+	operator delete(ptr);
+}
+
+using namespace std;
+
+// Generate states that look like the ones found during elaboration: a handful
+// of tokens out of a few hundred places, and a single fully specified cube.
+// About a fifth of them are revisits.
+vector<hse::state> generate(int count, int places, int nets) {
+	mt19937 rng(0);
+	vector<hse::state> result;
+	result.reserve(count);
+	for (int i = 0; i < count; i++) {
+		if (i > 0 and rng()%5 == 0) {
+			result.push_back(result[rng()%result.size()]);
+			continue;
+		}
+
+		vector<petri::token> tokens;
+		int k = 2 + rng()%6;
+		for (int j = 0; j < k; j++) {
+			tokens.push_back(petri::token(rng()%places));
+		}
+		sort(tokens.begin(), tokens.end());
+		tokens.erase(unique(tokens.begin(), tokens.end()), tokens.end());
+
+		boolean::cube encoding;
+		for (int j = 0; j < nets; j++) {
+			encoding &= boolean::cube(j, rng()%2);
+		}
+
+		result.push_back(hse::state(tokens, boolean::cover(encoding)));
+	}
+	return result;
+}
+
+int main(int argc, char **argv) {
+	int count = argc > 1 ? atoi(argv[1]) : 1000000;
+	vector<hse::state> states = generate(count, 300, 64);
+
+	size_t unique_states = 0;
+	{
+		size_t before = live_bytes;
+		Timer tmr;
+		unordered_set<hse::state> table;
+		for (auto s = states.begin(); s != states.end(); s++) {
+			table.insert(*s);
+		}
+		double seconds = tmr.since();
+		unique_states = table.size();
+		printf("unordered_set<state>: %zu states, %.1f bytes/state, %.0f inserts/sec\n", table.size(), (double)(live_bytes - before)/(double)table.size(), (double)states.size()/seconds);
+	}
+
+	{
+		size_t before = live_bytes;
+		Timer tmr;
+		hse::state_table table;
+		for (auto s = states.begin(); s != states.end(); s++) {
+			table.insert(*s);
+		}
+		double seconds = tmr.since();
+		printf("state_table:          %zu states, %.1f bytes/state, %.0f inserts/sec, max probe %d\n", table.size(), (double)(live_bytes - before)/(double)table.size(), (double)states.size()/seconds, table.max_probe);
+
+		if (table.size() != unique_states) {
+			printf("error: state counts differ\n");
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,71 @@
+// Measures how random_walks() scales with the number of threads. The graph
+// is a set of independent *[x+; x-] cycles that are all marked, so every
+// walk takes a different path and keeps making new histories. The walks per
+// second should grow close to linearly up to the number of cores.
+//
+// make bench && ./build/bench/walks
+
+#include <common/standard.h>
+#include <common/timer.h>
+#include <hse/graph.h>
+#include <hse/walker.h>
+
+#include <cstdlib>
+#include <thread>
+
+using namespace std;
+
+hse::graph generate(int loops) {
+	hse::graph g;
+	vector<petri::token> tokens;
+	boolean::cube encoding;
+	for (int i = 0; i < loops; i++) {
+		int x = g.create(hse::net("x" + ::to_string(i), 0));
+		encoding &= boolean::cube(x, 0);
+
+		petri::iterator p0 = g.create(hse::place());
+		petri::iterator t0 = g.create(hse::transition(1, 1, boolean::cover(x, 1)));
+		petri::iterator p1 = g.create(hse::place());
+		petri::iterator t1 = g.create(hse::transition(1, 1, boolean::cover(x, 0)));
+		g.connect(p0, t0);
+		g.connect(t0, p1);
+		g.connect(p1, t1);
+		g.connect(t1, p0);
+
+		tokens.push_back(petri::token(p0.index));
+	}
+
+	g.reset.push_back(hse::state(tokens, boolean::cover(encoding)));
+	g.update_arc_index();
+	return g;
+}
+
+int main(int argc, char **argv) {
+	size_t walks = argc > 1 ? (size_t)atoll(argv[1]) : 20000;
+	int loops = argc > 2 ? atoi(argv[2]) : 16;
+
+	int cores = max(1, (int)std::thread::hardware_concurrency());
+	vector<int> counts = {1, 2, 4};
+	if (cores > 4) {
+		counts.push_back(cores);
+	}
+
+	hse::graph g = generate(loops);
+	double base = 0.0;
+	for (auto n = counts.begin(); n != counts.end(); n++) {
+		hse::walk_config config;
+		config.walks = walks;
+		config.steps = 200;
+		config.threads = *n;
+
+		Timer tmr;
+		hse::walk_stats stats = hse::random_walks(g, config);
+		double rate = (double)stats.walks/tmr.since();
+		if (n == counts.begin()) {
+			base = rate;
+		}
+		printf("%3d threads: %.0f walks/s (%.2fx), %zu firings\n", *n, rate, rate/base, stats.steps);
+	}
+
+	return 0;
+}
@@ -0,0 +1,290 @@
+#include "bdd.h"
+
+#include <climits>
+#include <cmath>
+
+namespace hse
+{
+
+// The computed table has this many entries, it must be a power of two.
+const int bdd_cache_size = 1<<18;
+
+enum {
+	BDD_AND = 0,
+	BDD_OR = 1,
+	BDD_NOT = 2,
+	BDD_EXISTS = 3
+};
+
+uint64_t bdd_hash(int var, int lo, int hi)
+{
+	uint64_t result = (uint64_t)(uint32_t)var * 0x9E3779B97F4A7C15ull;
+	result ^= (uint64_t)(uint32_t)lo * 0xC2B2AE3D27D4EB4Full;
+	result ^= (uint64_t)(uint32_t)hi * 0x165667B19E3779F9ull;
+	return result ^ (result >> 29);
+}
+
+bdd_manager::bdd_manager()
+{
+	vars = 0;
+	nodes.push_back(bdd_node{INT_MAX, 0, 0});
+	nodes.push_back(bdd_node{INT_MAX, 1, 1});
+	unique.resize(1024, -1);
+	cache.resize(bdd_cache_size, cache_entry{-1, 0, 0, 0});
+}
+
+bdd_manager::bdd_manager(int vars)
+{
+	this->vars = vars;
+	nodes.push_back(bdd_node{INT_MAX, 0, 0});
+	nodes.push_back(bdd_node{INT_MAX, 1, 1});
+	unique.resize(1024, -1);
+	cache.resize(bdd_cache_size, cache_entry{-1, 0, 0, 0});
+}
+
+bdd_manager::~bdd_manager()
+{
+}
+
+int bdd_manager::var(int a) const
+{
+	return nodes[a].var;
+}
+
+void bdd_manager::grow()
+{
+	unique.assign(unique.size()*2, -1);
+	size_t mask = unique.size()-1;
+	for (int i = 2; i < (int)nodes.size(); i++) {
+		size_t loc = bdd_hash(nodes[i].var, nodes[i].lo, nodes[i].hi) & mask;
+		while (unique[loc] >= 0) {
+			loc = (loc+1) & mask;
+		}
+		unique[loc] = i;
+	}
+}
+
+int bdd_manager::make(int var, int lo, int hi)
+{
+	if (lo == hi) {
+		return lo;
+	}
+
+	size_t mask = unique.size()-1;
+	size_t loc = bdd_hash(var, lo, hi) & mask;
+	while (unique[loc] >= 0) {
+		const bdd_node &n = nodes[unique[loc]];
+		if (n.var == var and n.lo == lo and n.hi == hi) {
+			return unique[loc];
+		}
+		loc = (loc+1) & mask;
+	}
+
+	int result = (int)nodes.size();
+	nodes.push_back(bdd_node{var, lo, hi});
+	unique[loc] = result;
+	if (nodes.size()*2 > unique.size()) {
+		grow();
+	}
+	return result;
+}
+
+int bdd_manager::literal(int var, bool value)
+{
+	return value ? make(var, zero, one) : make(var, one, zero);
+}
+
+int bdd_manager::support(const vector<int> &vars)
+{
+	vector<int> sorted = vars;
+	sort(sorted.begin(), sorted.end());
+	int result = one;
+	for (int i = (int)sorted.size()-1; i >= 0; i--) {
+		result = make(sorted[i], zero, result);
+	}
+	return result;
+}
+
+bool bdd_manager::lookup(int op, int a, int b, int *result) const
+{
+	const cache_entry &e = cache[bdd_hash(op, a, b) & (cache.size()-1)];
+	if (e.op == op and e.a == a and e.b == b) {
+		*result = e.result;
+		return true;
+	}
+	return false;
+}
+
+void bdd_manager::store(int op, int a, int b, int result)
+{
+	cache[bdd_hash(op, a, b) & (cache.size()-1)] = cache_entry{op, a, b, result};
+}
+
+int bdd_manager::apply_and(int a, int b)
+{
+	if (a == zero or b == zero) {
+		return zero;
+	} else if (a == one or a == b) {
+		return b;
+	} else if (b == one) {
+		return a;
+	}
+
+	if (a > b) {
+		swap(a, b);
+	}
+
+	int result;
+	if (lookup(BDD_AND, a, b, &result)) {
+		return result;
+	}
+
+	int v = min(var(a), var(b));
+	int a0 = var(a) == v ? nodes[a].lo : a;
+	int a1 = var(a) == v ? nodes[a].hi : a;
+	int b0 = var(b) == v ? nodes[b].lo : b;
+	int b1 = var(b) == v ? nodes[b].hi : b;
+	int lo = apply_and(a0, b0);
+	int hi = apply_and(a1, b1);
+	result = make(v, lo, hi);
+	store(BDD_AND, a, b, result);
+	return result;
+}
+
+int bdd_manager::apply_or(int a, int b)
+{
+	if (a == one or b == one) {
+		return one;
+	} else if (a == zero or a == b) {
+		return b;
+	} else if (b == zero) {
+		return a;
+	}
+
+	if (a > b) {
+		swap(a, b);
+	}
+
+	int result;
+	if (lookup(BDD_OR, a, b, &result)) {
+		return result;
+	}
+
+	int v = min(var(a), var(b));
+	int a0 = var(a) == v ? nodes[a].lo : a;
+	int a1 = var(a) == v ? nodes[a].hi : a;
+	int b0 = var(b) == v ? nodes[b].lo : b;
+	int b1 = var(b) == v ? nodes[b].hi : b;
+	int lo = apply_or(a0, b0);
+	int hi = apply_or(a1, b1);
+	result = make(v, lo, hi);
+	store(BDD_OR, a, b, result);
+	return result;
+}
+
+int bdd_manager::negate(int a)
+{
+	if (a == zero) {
+		return one;
+	} else if (a == one) {
+		return zero;
+	}
+
+	int result;
+	if (lookup(BDD_NOT, a, 0, &result)) {
+		return result;
+	}
+
+	int lo = negate(nodes[a].lo);
+	int hi = negate(nodes[a].hi);
+	result = make(var(a), lo, hi);
+	store(BDD_NOT, a, 0, result);
+	return result;
+}
+
+int bdd_manager::exists(int a, int vars)
+{
+	if (a == zero or a == one) {
+		return a;
+	}
+
+	// Skip quantified variables that a doesn't depend on
+	while (vars != one and var(vars) < var(a)) {
+		vars = nodes[vars].hi;
+	}
+	if (vars == one) {
+		return a;
+	}
+
+	int result;
+	if (lookup(BDD_EXISTS, a, vars, &result)) {
+		return result;
+	}
+
+	if (var(vars) == var(a)) {
+		int rest = nodes[vars].hi;
+		int lo = exists(nodes[a].lo, rest);
+		if (lo == one) {
+			result = one;
+		} else {
+			result = apply_or(lo, exists(nodes[a].hi, rest));
+		}
+	} else {
+		int lo = exists(nodes[a].lo, vars);
+		int hi = exists(nodes[a].hi, vars);
+		result = make(var(a), lo, hi);
+	}
+
+	store(BDD_EXISTS, a, vars, result);
+	return result;
+}
+
+double bdd_manager::count(int a, vector<double> &memo)
+{
+	// memo holds the fraction of all assignments that satisfy each node
+	if (a == zero) {
+		return 0.0;
+	} else if (a == one) {
+		return 1.0;
+	} else if (memo[a] >= 0.0) {
+		return memo[a];
+	}
+
+	memo[a] = (count(nodes[a].lo, memo) + count(nodes[a].hi, memo))/2.0;
+	return memo[a];
+}
+
+double bdd_manager::count(int a)
+{
+	vector<double> memo(nodes.size(), -1.0);
+	return count(a, memo)*std::pow(2.0, (double)vars);
+}
+
+bool bdd_manager::paths(int a, vector<pair<int, bool> > &path, std::function<bool(const vector<pair<int, bool> > &)> &visit)
+{
+	if (a == zero) {
+		return true;
+	} else if (a == one) {
+		return visit(path);
+	}
+
+	path.push_back(pair<int, bool>(var(a), false));
+	bool more = paths(nodes[a].lo, path, visit);
+	path.back().second = true;
+	more = more and paths(nodes[a].hi, path, visit);
+	path.pop_back();
+	return more;
+}
+
+void bdd_manager::paths(int a, std::function<bool(const vector<pair<int, bool> > &)> visit)
+{
+	vector<pair<int, bool> > path;
+	paths(a, path, visit);
+}
+
+int bdd_manager::size() const
+{
+	return (int)nodes.size();
+}
+
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <common/standard.h>
+#include <functional>
+
+namespace hse
+{
+
+// A small reduced ordered binary decision diagram package for the symbolic
+// elaborator. Nodes are stored in a single table owned by the manager and are
+// referred to by their index in that table. Index 0 is the constant false and
+// index 1 is the constant true. Variables are ordered by index with the
+// smallest index closest to the root.
+//
+// There are no complement edges and no garbage collection. A manager is
+// expected to live for a single elaboration and is thrown away afterwards.
+struct bdd_node
+{
+	int var;
+	int lo;
+	int hi;
+};
+
+struct bdd_manager
+{
+	bdd_manager();
+	bdd_manager(int vars);
+	~bdd_manager();
+
+	enum {
+		zero = 0,
+		one = 1
+	};
+
+	int vars;
+	vector<bdd_node> nodes;
+
+	// The unique table maps (var, lo, hi) to the index of its node so that
+	// every function has exactly one representation. It uses open addressing
+	// and stores node indices, -1 marks an empty bucket.
+	vector<int> unique;
+
+	// The computed table is a direct mapped cache of recent operations.
+	struct cache_entry
+	{
+		int op;
+		int a;
+		int b;
+		int result;
+	};
+	vector<cache_entry> cache;
+
+	int make(int var, int lo, int hi);
+	int literal(int var, bool value);
+
+	// A cube of positive literals used to name a set of variables for
+	// quantification.
+	int support(const vector<int> &vars);
+
+	int apply_and(int a, int b);
+	int apply_or(int a, int b);
+	int negate(int a);
+
+	// Existentially quantify the variables in the positive cube vars out of a.
+	int exists(int a, int vars);
+
+	// The number of satisfying assignments over all of the variables.
+	double count(int a);
+
+	// Call visit with each path from the root to the constant true. Each
+	// path is a list of variables and the value each one takes. Variables
+	// not on the path are don't-cares. visit returns false to stop early.
+	void paths(int a, std::function<bool(const vector<pair<int, bool> > &)> visit);
+
+	int size() const;
+
+	// Used internally
+	int var(int a) const;
+	bool lookup(int op, int a, int b, int *result) const;
+	void store(int op, int a, int b, int result);
+	void grow();
+	double count(int a, vector<double> &memo);
+	bool paths(int a, vector<pair<int, bool> > &path, std::function<bool(const vector<pair<int, bool> > &)> &visit);
+};
+
+}
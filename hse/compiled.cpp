@@ -0,0 +1,129 @@
+#include "compiled.h"
+
+#include <mutex>
+
+namespace hse
+{
+
+// Serializes building the snapshot of a graph between simulators that run on
+// different threads.
+std::mutex compile_lock;
+
+compiled_transition::compiled_transition()
+{
+	valid = false;
+}
+
+compiled_transition::~compiled_transition()
+{
+}
+
+compiled_graph::compiled_graph()
+{
+	source = nullptr;
+	revision = 0;
+	nets = 0;
+}
+
+compiled_graph::compiled_graph(const graph &g)
+{
+	source = &g;
+	revision = g.revision;
+	nets = g.netCount();
+	ghost_nets = g.ghost_nets;
+
+	const vector<petri::arc> &in = g.arcs[petri::place::type];
+	arc_from.reserve(in.size());
+	arc_to.reserve(in.size());
+	for (auto a = in.begin(); a != in.end(); a++) {
+		arc_from.push_back(a->from.index);
+		arc_to.push_back(a->to.index);
+	}
+
+	// This is the same counting sort as graph::update_arc_index(), done here
+	// so that the snapshot never depends on the index stored in the graph
+	// being up to date.
+	place_offset.assign(g.places.size()+1, 0);
+	transition_offset.assign(g.transitions.size()+1, 0);
+	for (int i = 0; i < (int)in.size(); i++) {
+		place_offset[in[i].from.index+1]++;
+		transition_offset[in[i].to.index+1]++;
+	}
+	for (int i = 1; i < (int)place_offset.size(); i++) {
+		place_offset[i] += place_offset[i-1];
+	}
+	for (int i = 1; i < (int)transition_offset.size(); i++) {
+		transition_offset[i] += transition_offset[i-1];
+	}
+
+	place_arcs.resize(in.size());
+	transition_arcs.resize(in.size());
+	vector<int> place_fill(place_offset.begin(), place_offset.end()-1);
+	vector<int> transition_fill(transition_offset.begin(), transition_offset.end()-1);
+	for (int i = 0; i < (int)in.size(); i++) {
+		place_arcs[place_fill[in[i].from.index]++] = i;
+		transition_arcs[transition_fill[in[i].to.index]++] = i;
+	}
+
+	arbiter.resize(g.places.size(), false);
+	for (int i = 0; i < (int)g.places.size(); i++) {
+		arbiter[i] = g.places.is_valid(i) and g.places[i].arbiter;
+	}
+
+	output_offset.push_back(0);
+	transitions.resize(g.transitions.size());
+	for (int i = 0; i < (int)g.transitions.size(); i++) {
+		if (g.transitions.is_valid(i)) {
+			const transition &t = g.transitions[i];
+			compiled_transition &c = transitions[i];
+			c.valid = true;
+			c.guard = t.guard;
+			c.assume = t.assume;
+			c.local_action = t.local_action;
+			c.remote_action = t.remote_action;
+			c.ghost = t.ghost;
+			if (t.local_action.is_tautology()) {
+				c.propagated = t.guard;
+			} else {
+				c.propagated = boolean::weakest_guard(t.guard, g.exclusion(i));
+			}
+			c.remote_nets = t.remote_action.vars();
+			sort(c.remote_nets.begin(), c.remote_nets.end());
+			c.remote_nets.erase(unique(c.remote_nets.begin(), c.remote_nets.end()), c.remote_nets.end());
+
+			c.interned_guard = interned_cover(c.guard);
+			c.interned_assume = interned_cover(c.assume);
+			c.interned_local_action = interned_cover(c.local_action);
+			c.interned_propagated = interned_cover(c.propagated);
+
+			vector<int> output = g.next(petri::transition::type, i);
+			output_places.insert(output_places.end(), output.begin(), output.end());
+		}
+		output_offset.push_back((int)output_places.size());
+	}
+}
+
+compiled_graph::~compiled_graph()
+{
+}
+
+bool compiled_graph::matches(const graph &g) const
+{
+	return source == &g
+		and revision == g.revision
+		and nets == g.netCount()
+		and (int)arc_from.size() == (int)g.arcs[petri::place::type].size()
+		and (int)arbiter.size() == (int)g.places.size()
+		and (int)transitions.size() == (int)g.transitions.size();
+}
+
+std::shared_ptr<const compiled_graph> compile(graph &g)
+{
+	std::lock_guard<std::mutex> guard(compile_lock);
+	if (g.compiled == nullptr or not g.compiled->matches(g)) {
+		g.compiled = std::make_shared<const compiled_graph>(g);
+	}
+	return g.compiled;
+}
+
+}
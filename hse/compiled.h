@@ -0,0 +1,91 @@
+#pragma once
+
+#include <common/standard.h>
+#include <boolean/cover.h>
+#include "graph.h"
+#include "state.h"
+
+#include <memory>
+
+namespace hse
+{
+
+// Everything the simulator reads about a transition, copied out of the
+// graph.
+struct compiled_transition
+{
+	compiled_transition();
+	~compiled_transition();
+
+	bool valid;
+
+	boolean::cover guard;
+	boolean::cover assume;
+	boolean::cover local_action;
+	boolean::cover remote_action;
+	boolean::cover ghost;
+
+	// The guard that a vacuous firing of this transition passes on to the
+	// tokens at its output places, see the discussion in simulator::enabled().
+	// This is the guard itself for a skip and otherwise the weakest guard that
+	// still excludes the other branches of the selection.
+	boolean::cover propagated;
+
+	// The nets assigned by the remote action, sorted.
+	vector<int> remote_nets;
+
+	// The covers that enabled() combines with the covers carried by tokens,
+	// interned once here so that the simulator never hashes them.
+	interned_cover interned_guard;
+	interned_cover interned_assume;
+	interned_cover interned_local_action;
+	interned_cover interned_propagated;
+};
+
+// An immutable snapshot of a graph laid out for the simulator. It is built
+// once by compile() and shared by every simulator running on that graph, so
+// that enabled() and fire() never have to search the graph or recompute
+// anything that only depends on its structure. Nothing in it changes after
+// it is built, so any number of threads may read it at once.
+struct compiled_graph
+{
+	compiled_graph();
+	compiled_graph(const graph &g);
+	~compiled_graph();
+
+	// The graph this was built from and its revision at the time.
+	const graph *source;
+	uint64_t revision;
+	int nets;
+	vector<int> ghost_nets;
+
+	// The endpoints of each arc in graph::arcs[place::type], along with an
+	// index of those arcs laid out like graph::place_offset. The index is
+	// built from the arcs themselves, not copied from the graph.
+	vector<int> arc_from;
+	vector<int> arc_to;
+	vector<int> place_offset;
+	vector<int> place_arcs;
+	vector<int> transition_offset;
+	vector<int> transition_arcs;
+
+	// The output places of transition i are output_places[output_offset[i]]
+	// through output_places[output_offset[i+1]-1] in the order returned by
+	// graph::next().
+	vector<int> output_offset;
+	vector<int> output_places;
+
+	vector<bool> arbiter;
+	vector<compiled_transition> transitions;
+
+	// Whether this is still a faithful copy of g, see graph::revision.
+	bool matches(const graph &g) const;
+};
+
+// Returns the snapshot of g, building a new one if g changed since the last
+// call. The snapshot is cached in graph::compiled, which is cleared by
+// graph::modified(). This may be called from several threads at once, and
+// it never writes to g other than to cache the snapshot.
+std::shared_ptr<const compiled_graph> compile(graph &g);
+
+}
@@ -0,0 +1,164 @@
+#include "diagnostic.h"
+#include "graph.h"
+
+#include <common/message.h>
+#include <climits>
+
+namespace hse
+{
+
+diagnostic::diagnostic()
+{
+	kind = INSTABILITY;
+}
+
+diagnostic::diagnostic(const instability &err)
+{
+	kind = INSTABILITY;
+	terms.push_back(term_index(err.index, -1));
+	vector<term_index> history = err.history.to_vector();
+	terms.insert(terms.end(), history.begin(), history.end());
+}
+
+diagnostic::diagnostic(const interference &err)
+{
+	kind = INTERFERENCE;
+	terms.push_back(err.first);
+	terms.push_back(err.second);
+}
+
+diagnostic::diagnostic(const mutex &err, vector<int> places)
+{
+	kind = MUTEX;
+	terms.push_back(term_index(err.first.index, -1));
+	terms.push_back(term_index(err.second.index, -1));
+	this->places = places;
+}
+
+diagnostic::diagnostic(const deadlock &err)
+{
+	kind = DEADLOCK;
+	for (auto i = err.tokens.begin(); i != err.tokens.end(); i++) {
+		places.push_back(i->index);
+	}
+	encoding = err.encodings;
+}
+
+diagnostic::diagnostic(string message, int kind)
+{
+	this->kind = kind;
+	this->message = message;
+}
+
+diagnostic::~diagnostic()
+{
+}
+
+string diagnostic::to_string(const graph &g) const
+{
+	if (not message.empty()) {
+		return message;
+	} else if (kind == INSTABILITY) {
+		instability err(enabled_transition(terms[0].index));
+		for (int i = 1; i < (int)terms.size(); i++) {
+			err.history.push_back(terms[i]);
+		}
+		return err.to_string(g);
+	} else if (kind == INTERFERENCE) {
+		return interference(terms[0], terms[1]).to_string(g);
+	} else if (kind == MUTEX) {
+		string result = mutex(enabled_transition(terms[0].index), enabled_transition(terms[1].index)).to_string(g);
+		result += " at places {";
+		for (int i = 0; i < (int)places.size(); i++) {
+			if (i != 0) {
+				result += " ";
+			}
+			result += "P" + ::to_string(places[i]);
+		}
+		return result + "}";
+	}
+
+	vector<petri::token> tokens;
+	for (auto i = places.begin(); i != places.end(); i++) {
+		tokens.push_back(petri::token(*i));
+	}
+	return deadlock(state(tokens, encoding)).to_string(g);
+}
+
+void diagnostic::print(const graph &g) const
+{
+	if (kind == UNSUPPORTED) {
+		warning("", to_string(g), __FILE__, __LINE__);
+	} else {
+		error("", to_string(g), __FILE__, __LINE__);
+	}
+}
+
+diagnostic_sink::diagnostic_sink(int mode, int limit)
+{
+	this->mode = mode;
+	this->limit = limit;
+	clear();
+}
+
+diagnostic_sink::~diagnostic_sink()
+{
+}
+
+void diagnostic_sink::report(const graph &g, diagnostic d)
+{
+	if (mode == SILENT) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (found[d.kind]++ >= (size_t)limit) {
+		return;
+	}
+
+	if (mode == IMMEDIATE) {
+		d.print(g);
+	} else {
+		records.push_back(d);
+	}
+}
+
+void diagnostic_sink::flush(const graph &g)
+{
+	static const char *names[diagnostic::KINDS] = {
+		"unstable rules",
+		"interfering assignments",
+		"non-exclusive guards",
+		"deadlocks",
+		"unsupported options"
+	};
+
+	std::lock_guard<std::mutex> guard(lock);
+	for (auto d = records.begin(); d != records.end(); d++) {
+		d->print(g);
+	}
+	records.clear();
+
+	for (int k = 0; k < diagnostic::KINDS; k++) {
+		if (found[k] > (size_t)limit) {
+			error("", "found " + ::to_string(found[k]) + " " + names[k] + ", only the first " + ::to_string(limit) + " were reported", __FILE__, __LINE__);
+		}
+		found[k] = 0;
+	}
+}
+
+void diagnostic_sink::clear()
+{
+	records.clear();
+	for (int k = 0; k < diagnostic::KINDS; k++) {
+		found[k] = 0;
+	}
+}
+
+diagnostic_sink &immediate_diagnostics()
+{
+	static diagnostic_sink sink(diagnostic_sink::IMMEDIATE, INT_MAX);
+	return sink;
+}
+
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <common/standard.h>
+#include <boolean/cover.h>
+#include "state.h"
+#include "simulator.h"
+
+#include <mutex>
+
+namespace hse
+{
+
+// A problem found during simulation or exploration, recorded without
+// formatting it. Formatting a message goes through emit_expression() and
+// emit_composition() for every guard and action involved, which is far more
+// expensive than finding the problem in the first place.
+struct diagnostic
+{
+	diagnostic();
+	diagnostic(const instability &err);
+	diagnostic(const interference &err);
+	diagnostic(const mutex &err, vector<int> places);
+	diagnostic(const deadlock &err);
+	diagnostic(string message, int kind = UNSUPPORTED);
+	~diagnostic();
+
+	enum {
+		INSTABILITY = 0,
+		INTERFERENCE = 1,
+		MUTEX = 2,
+		DEADLOCK = 3,
+		UNSUPPORTED = 4,
+		KINDS = 5
+	};
+
+	int kind;
+
+	// For an instability, the unstable transition with a term of -1 followed
+	// by the terms that fired since it was enabled. For interference, the two
+	// interfering terms. For a mutex error, the two transitions with a term of
+	// -1.
+	vector<term_index> terms;
+
+	// The places of the tokens involved. This is the shared input places for a
+	// mutex error and the marking for a deadlock.
+	vector<int> places;
+
+	// The encoding of a deadlocked state.
+	boolean::cover encoding;
+
+	// A diagnostic with a message is printed as is. This says why an option
+	// or a construct in the design was not supported by the explorer and
+	// what it did instead, which is printed as a warning, or summarizes
+	// diagnostics that weren't listed one by one.
+	string message;
+
+	string to_string(const graph &g) const;
+
+	// Print this as an error, or as a warning if it is unsupported.
+	void print(const graph &g) const;
+};
+
+// Collects the diagnostics from a simulator or an exploration. In silent
+// mode, everything is dropped. In deferred mode, the diagnostics are kept
+// until flush() formats and prints them. In immediate mode, each one is
+// printed as it is reported. Only the first limit diagnostics of each kind
+// are kept or printed, the rest are counted and summarized by flush(). It is
+// safe to share a sink between threads.
+struct diagnostic_sink
+{
+	diagnostic_sink(int mode = DEFERRED, int limit = 100);
+	~diagnostic_sink();
+
+	enum {
+		SILENT = 0,
+		DEFERRED = 1,
+		IMMEDIATE = 2
+	};
+
+	int mode;
+	int limit;
+
+	std::mutex lock;
+	vector<diagnostic> records;
+
+	// The number of diagnostics of each kind that have been reported.
+	size_t found[diagnostic::KINDS];
+
+	void report(const graph &g, diagnostic d);
+	void flush(const graph &g);
+	void clear();
+};
+
+// The sink used by simulators that haven't been given one. It prints every
+// diagnostic as it is found.
+diagnostic_sink &immediate_diagnostics();
+
+}
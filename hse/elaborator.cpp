@@ -6,14 +6,24 @@
  */
 
 #include "elaborator.h"
+#include "state_store.h"
+#include "state_table.h"
+#include "symbolic.h"
+#include "diagnostic.h"
+#include "serialize.h"
+#include "compiled.h"
+#include "monitor.h"
 #include <common/text.h>
 #include <common/standard.h>
 #include <common/timer.h>
 #include <interpret_boolean/export.h>
 
-#include <unordered_set>
 #include <set>
 #include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 
 #include "expression.h"
 
@@ -22,6 +32,472 @@ using namespace std;
 namespace hse
 {
 
+// The number of simulations popped between sweeps of the pending simulations
+// for dominated states.
+const size_t subsumption_sweep = 4096;
+
+elaborate_config::elaborate_config()
+{
+	annotate_ghosts = false;
+	record_predicates = true;
+	report_progress = false;
+	threads = 1;
+	visited_budget = 0;
+	frontier_budget = 0;
+	reduce = false;
+	subsume = false;
+	recycle = true;
+	engine = EXPLICIT;
+	progress_interval = 1.0;
+	checkpoint_interval = 600.0;
+	diagnostics = nullptr;
+}
+
+elaborate_config::elaborate_config(bool annotate_ghosts, bool record_predicates, bool report_progress)
+{
+	this->annotate_ghosts = annotate_ghosts;
+	this->record_predicates = record_predicates;
+	this->report_progress = report_progress;
+	threads = 1;
+	visited_budget = 0;
+	frontier_budget = 0;
+	reduce = false;
+	subsume = false;
+	recycle = true;
+	engine = EXPLICIT;
+	progress_interval = 1.0;
+	checkpoint_interval = 600.0;
+	diagnostics = nullptr;
+}
+
+elaborate_config::~elaborate_config()
+{
+}
+
+elaborate_stats::elaborate_stats()
+{
+	elapsed = 0.0;
+	done = false;
+	states = 0;
+	revisits = 0;
+	checked = 0;
+	pruned = 0;
+	frontier = 0;
+	peak_frontier = 0;
+	load = 0.0;
+	bytes = 0;
+	enabled_seconds = 0.0;
+	fire_seconds = 0.0;
+	hash_seconds = 0.0;
+}
+
+elaborate_stats::~elaborate_stats()
+{
+}
+
+double elaborate_stats::states_per_second() const
+{
+	return elapsed > 0.0 ? (double)states/elapsed : 0.0;
+}
+
+double elaborate_stats::revisit_ratio() const
+{
+	return states+revisits > 0 ? (double)revisits/(double)(states+revisits) : 0.0;
+}
+
+double elaborate_stats::bytes_per_state() const
+{
+	return states > 0 ? (double)bytes/(double)states : 0.0;
+}
+
+string elaborate_stats::to_json() const
+{
+	char buffer[512];
+	snprintf(buffer, sizeof(buffer),
+		"{\"elapsed\":%.6f,\"done\":%s,\"states\":%zu,\"revisits\":%zu,\"checked\":%zu,\"pruned\":%zu,\"frontier\":%zu,\"peak_frontier\":%zu,"
+		"\"load\":%.4f,\"bytes\":%zu,\"states_per_second\":%.1f,\"revisit_ratio\":%.4f,\"bytes_per_state\":%.1f,"
+		"\"enabled_seconds\":%.6f,\"fire_seconds\":%.6f,\"hash_seconds\":%.6f}",
+		elapsed, done ? "true" : "false", states, revisits, checked, pruned, frontier, peak_frontier,
+		load, bytes, states_per_second(), revisit_ratio(), bytes_per_state(),
+		enabled_seconds, fire_seconds, hash_seconds);
+	return string(buffer);
+}
+
+// Record the state encodings of this simulation into the predicate and
+// effective predicate accumulators of the places marked by its tokens.
+// predicate and effective are indexed by place. If cached isn't null, the
+// unmasked encodings are kept there as well.
+void record_state(const graph &g, const simulator &sim, vector<boolean::cover> &predicate, vector<boolean::cover> &effective, cached_state *cached = nullptr)
+{
+	// The effective predicate represents the state encodings that don't have
+	// duplicates in later states. For each non-vacuous transition that is
+	// enabled, we need to record the current state into the predicate of the
+	// places that would be the marking to fire that non-vacuous transition.
+	// Any token that belongs to at least one such marking should record the
+	// current state.
+	//
+	// How do we determine that for each token?
+	// 
+	// First attempt:
+	// A token saves the state to the predicate of its place if (it is not an
+	// input to a vacuous transition, not an output of a non-vacuous
+	// transition, and there is an enabled non-vacuous transition that does not
+	// prevent the sequence of vacuous transitions that lead to this token) or
+	// it's an input to a non-vacuous transition.
+
+	//vector<set<int> > en_in(sim.tokens.size(), set<int>());
+	
+	// record whether this is an output of a non-vacuous 
+	vector<bool> en_in(sim.tokens.size(), false);
+	vector<set<int> > en_out(sim.tokens.size(), set<int>());
+
+	// record whether there is an enabled non-vacuous that does not prevent the
+	// sequence of vacuous transitions that lead to this token.
+	//vector<bool> is_live(sim.tokens.size(), false);
+
+	/*bool change = true;
+	while (change) {
+		change = false;
+		for (int i = 0; i < (int)sim.loaded.size(); i++) {
+			set<int> total_in;
+			for (int j = 0; j < (int)sim.loaded[i].tokens.size(); j++) {
+				total_in.insert(en_in[sim.loaded[i].tokens[j]].begin(), en_in[sim.loaded[i].tokens[j]].end());
+			}
+			total_in.insert(sim.loaded[i].index);
+
+			for (int j = 0; j < (int)sim.loaded[i].output_marking.size(); j++) {
+				set<int> old_in = en_in[sim.loaded[i].output_marking[j]];
+				en_in[sim.loaded[i].output_marking[j]].insert(total_in.begin(), total_in.end());
+				change = change or (en_in[sim.loaded[i].output_marking[j]] != old_in);
+			}
+		}
+	}*/
+
+	for (int i = 0; i < (int)sim.loaded.size(); i++)
+		for (int j = 0; j < (int)sim.loaded[i].tokens.size(); j++)
+			en_out[sim.loaded[i].tokens[j]].insert(i);
+
+	for (int i = 0; i < (int)sim.loaded.size(); i++)
+		for (int j = 0; j < (int)sim.loaded[i].output_marking.size(); j++)
+			if (not sim.loaded[i].vacuous)
+				en_in[sim.loaded[i].output_marking[j]] = true;
+
+	for (int i = 0; i < (int)sim.tokens.size(); i++) {
+		bool isOutput = en_out[i].empty() and en_in[i];
+
+		// TODO(edward.bingham) This is not properly saving the state when there is
+		// another vacuous transition that skips around a non-vacuous transition
+		// through a choice. For vacuous transitions out of a conditional split
+		// on which we are firing a transition down another branch, we need to
+		// undo all of the other tokens.
+		bool isVacuous = false;
+		for (set<int>::iterator j = en_out[i].begin(); j != en_out[i].end() and not isVacuous; j++) {
+			isVacuous = sim.loaded[*j].vacuous;
+		}
+	
+		if (not isVacuous and not isOutput) {
+			//boolean::cover en = 1;
+			boolean::cover dis = 1;
+			//for (set<int>::iterator j = en_in[i].begin(); j != en_in[i].end(); j++)
+			//	en &= g.transitions[*j].local_action;
+			// Not guard because then we'd be in the hidden place in the transition
+			// and not action because then we would have passed this transtion entirely
+			// whether or not the current encoding passes the guard
+			for (set<int>::iterator j = en_out[i].begin(); j != en_out[i].end(); j++)
+				dis &= ~g.transitions[sim.loaded[*j].index].guard;
+
+			// Given the current encoding - sim.encoding
+			// 1. Ignore unstable signals - xoutnulls()
+			// 2. Mask out variables that this process has no visibility for - flipped_mask()
+			// 3. OR this into the predicate for that place
+			int p = sim.tokens[i].index;
+			for (auto c = sim.encoding.cubes.begin(); c != sim.encoding.cubes.end(); c++) {
+				predicate[p] |= (c->xoutnulls()).flipped_mask(g.places[p].mask);
+				// Same thing as above, but we exclude any state encoding that passes an outgoing guard - & dis
+				effective[p] |= (c->xoutnulls() & dis).flipped_mask(g.places[p].mask);
+			}
+
+			if (cached != nullptr) {
+				cached->places.push_back(p);
+				cached->predicate.push_back(boolean::cover());
+				cached->effective.push_back(boolean::cover());
+				for (auto c = sim.encoding.cubes.begin(); c != sim.encoding.cubes.end(); c++) {
+					cached->predicate.back() |= c->xoutnulls();
+					cached->effective.back() |= c->xoutnulls() & dis;
+				}
+			}
+		}
+	}
+}
+
+// Clean up the recorded state with Espresso. This will help when rendering
+// the state information to the user and when synthesizing production rules
+// for the final circuit. The cubes are sorted and deduplicated first so that
+// the result doesn't depend on the order in which the states were visited,
+// which differs between the serial, parallel, and incremental explorers.
+// Espresso's result depends on the order of its input, so this changed the
+// exact covers recorded by the serial explorer compared to running espresso
+// on the cubes in visit order. They still cover the same states.
+void save_predicates(graph &g, vector<boolean::cover> &predicate, vector<boolean::cover> &effective)
+{
+	for (int i = 0; i < (int)g.places.size(); i++) {
+		if (not g.places.is_valid(i)) continue;
+
+		sort(predicate[i].cubes.begin(), predicate[i].cubes.end());
+		predicate[i].cubes.erase(unique(predicate[i].cubes.begin(), predicate[i].cubes.end()), predicate[i].cubes.end());
+		sort(effective[i].cubes.begin(), effective[i].cubes.end());
+		effective[i].cubes.erase(unique(effective[i].cubes.begin(), effective[i].cubes.end()), effective[i].cubes.end());
+
+		g.places[i].effective = effective[i];
+		g.places[i].effective.espresso();
+		sort(g.places[i].effective.cubes.begin(), g.places[i].effective.cubes.end());
+		g.places[i].predicate = predicate[i];
+		g.places[i].predicate.espresso();
+	}
+}
+
+// Returns true if this is the first time we've seen this deadlock.
+bool record_deadlock(vector<deadlock> &deadlocks, const deadlock &d)
+{
+	vector<deadlock>::iterator dloc = lower_bound(deadlocks.begin(), deadlocks.end(), d);
+	if (dloc == deadlocks.end() || *dloc != d) {
+		deadlocks.insert(dloc, d);
+		return true;
+	}
+	return false;
+}
+
+bool is_invisible(const graph &g, const vector<int> &vars, int place)
+{
+	for (auto v = vars.begin(); v != vars.end(); v++) {
+		if (not boolean::cube(*v, 0).flipped_mask(g.places[place].mask).is_tautology()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool is_independent(const vector<int> &reads0, const vector<int> &writes0, const vector<int> &reads1, const vector<int> &writes1)
+{
+	return vector_intersection_size(writes0, reads1) == 0
+		and vector_intersection_size(writes1, reads0) == 0
+		and vector_intersection_size(writes0, writes1) == 0;
+}
+
+// Partial order reduction lets the elaborator fire a single enabled
+// transition t from a state instead of all of them, skipping the states in
+// which the other concurrent transitions fire first. This is only safe for
+// the place predicates if every skipped state looks the same as a state we
+// do visit from the point of view of every place it marks. Suppose u fires
+// concurrently with t. The skipped state s.u marks t's input places and the
+// places marked by u. The visited state s.u.t marks u's places with t's
+// writes applied, and s marks t's input places without u's writes. So we
+// require that:
+//
+// 1. t is the only transition out of each of its input places and none of
+//    them are arbiters, so firing t can't disable another transition.
+// 2. t and every transition u that may fire concurrently with it don't
+//    read or write each other's variables. This means that firing one
+//    doesn't change whether the other is enabled or stable, and they can't
+//    interfere.
+// 3. u's writes are invisible at t's input places.
+// 4. t's writes are invisible at every place that may be marked
+//    concurrently with t.
+// 5. t's action has a single term.
+//
+// Transitions that satisfy these conditions are marked reducible. At run
+// time, the elaborator additionally requires that no loaded transition is
+// vacuous and that the reducible transition is stable. It also falls back
+// to a full expansion if the transition leads to a state we've already
+// seen, otherwise a cycle could postpone the other transitions forever.
+vector<bool> find_reducible(graph &g)
+{
+	vector<vector<int> > reads(g.transitions.size());
+	vector<vector<int> > writes(g.transitions.size());
+	for (int t = 0; t < (int)g.transitions.size(); t++) {
+		if (not g.transitions.is_valid(t)) continue;
+
+		reads[t] = g.transitions[t].guard.vars();
+		vector<int> assumed = g.transitions[t].assume.vars();
+		reads[t].insert(reads[t].end(), assumed.begin(), assumed.end());
+		sort(reads[t].begin(), reads[t].end());
+		reads[t].erase(unique(reads[t].begin(), reads[t].end()), reads[t].end());
+
+		writes[t] = g.transitions[t].local_action.vars();
+		vector<int> remote = g.transitions[t].remote_action.vars();
+		writes[t].insert(writes[t].end(), remote.begin(), remote.end());
+		sort(writes[t].begin(), writes[t].end());
+		writes[t].erase(unique(writes[t].begin(), writes[t].end()), writes[t].end());
+	}
+
+	vector<bool> result(g.transitions.size(), false);
+	for (int t = 0; t < (int)g.transitions.size(); t++) {
+		if (not g.transitions.is_valid(t)
+			or g.transitions[t].local_action.cubes.size() != 1) continue;
+
+		petri::iterator curr(transition::type, t);
+		vector<int> input = g.prev(transition::type, t);
+
+		bool reducible = true;
+		for (int i = 0; i < (int)input.size() and reducible; i++) {
+			reducible = g.next(place::type, input[i]).size() == 1 and not g.places[input[i]].arbiter;
+		}
+
+		for (int u = 0; u < (int)g.transitions.size() and reducible; u++) {
+			if (u == t or not g.transitions.is_valid(u)
+				or not g.is(parallel, curr, petri::iterator(transition::type, u))) continue;
+
+			reducible = is_independent(reads[t], writes[t], reads[u], writes[u]);
+			for (int i = 0; i < (int)input.size() and reducible; i++) {
+				reducible = is_invisible(g, writes[u], input[i]);
+			}
+		}
+
+		for (int p = 0; p < (int)g.places.size() and reducible; p++) {
+			if (not g.places.is_valid(p)
+				or not g.is(parallel, curr, petri::iterator(place::type, p))) continue;
+
+			reducible = is_invisible(g, writes[t], p);
+		}
+
+		result[t] = reducible;
+	}
+
+	return result;
+}
+
+// Pick an enabled transition to fire alone from this state, returning its
+// index in sim.ready or -1 if the state must be fully expanded.
+int choose_ample(const simulator &sim, const vector<bool> &reducible)
+{
+	if (reducible.empty()) {
+		return -1;
+	}
+
+	for (int i = 0; i < (int)sim.loaded.size(); i++) {
+		if (sim.loaded[i].vacuous) {
+			return -1;
+		}
+	}
+
+	for (int i = 0; i < (int)sim.ready.size(); i++) {
+		const enabled_transition &t = sim.loaded[sim.ready[i].first];
+		if (reducible[t.index] and t.stable) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Identifies a checkpoint file and the version of its format.
+const string checkpoint_magic = "hse elaborate checkpoint";
+const uint64_t checkpoint_version = 2;
+
+void write_checkpoint_record(FILE *fptr, const byte_writer &writer)
+{
+	write_record(fptr, string((const char*)writer.data.data(), writer.data.size()));
+}
+
+// Save everything the serial explorer needs to pick up where it left off: the
+// visited states, the pending simulations, the deadlocks found so far, and the
+// predicates recorded so far. The checkpoint is written to a temporary file
+// and then renamed over the old one so that getting killed part way through
+// leaves the last checkpoint intact.
+bool save_checkpoint(string path, const graph &g, state_store &states, simulation_stack &simulations, const vector<deadlock> &deadlocks, const vector<boolean::cover> &predicate, const vector<boolean::cover> &effective)
+{
+	string temp = path + ".tmp";
+	FILE *fptr = fopen(temp.c_str(), "wb");
+	if (fptr == nullptr) {
+		error("", "unable to open '" + temp + "' to write a checkpoint", __FILE__, __LINE__);
+		return false;
+	}
+
+	write_record(fptr, checkpoint_magic);
+
+	byte_writer writer;
+	writer.write_uint(checkpoint_version);
+	writer.write_uint(g.places.size());
+	writer.write_uint(g.transitions.size());
+	writer.write_uint(g.netCount());
+	write_checkpoint_record(fptr, writer);
+
+	for (int i = 0; i < (int)g.places.size(); i++) {
+		writer.clear();
+		writer.write(predicate[i]);
+		writer.write(effective[i]);
+		write_checkpoint_record(fptr, writer);
+	}
+
+	writer.clear();
+	writer.write_uint(deadlocks.size());
+	for (auto d = deadlocks.begin(); d != deadlocks.end(); d++) {
+		writer.write(*d);
+	}
+	write_checkpoint_record(fptr, writer);
+
+	states.save(fptr);
+	simulations.save(fptr);
+
+	bool ok = not ferror(fptr);
+	ok = (fclose(fptr) == 0) and ok;
+	if (not ok or std::rename(temp.c_str(), path.c_str()) != 0) {
+		error("", "unable to write checkpoint '" + path + "'", __FILE__, __LINE__);
+		std::remove(temp.c_str());
+		return false;
+	}
+	return true;
+}
+
+// Load a checkpoint written by save_checkpoint(). Returns false if the file
+// is missing, damaged, or was written for a different graph.
+bool load_checkpoint(string path, const graph &g, state_store &states, simulation_stack &simulations, vector<deadlock> &deadlocks, vector<boolean::cover> &predicate, vector<boolean::cover> &effective)
+{
+	FILE *fptr = fopen(path.c_str(), "rb");
+	if (fptr == nullptr) {
+		error("", "unable to open checkpoint '" + path + "'", __FILE__, __LINE__);
+		return false;
+	}
+
+	string record;
+	bool ok = read_record(fptr, record) and record == checkpoint_magic
+		and read_record(fptr, record);
+	if (ok) {
+		byte_reader header((const uint8_t*)record.data(), record.size());
+		ok = header.read_uint() == checkpoint_version
+			and header.read_uint() == (uint64_t)g.places.size()
+			and header.read_uint() == (uint64_t)g.transitions.size()
+			and header.read_uint() == (uint64_t)g.netCount();
+	}
+
+	for (int i = 0; i < (int)g.places.size() and ok; i++) {
+		ok = read_record(fptr, record);
+		if (ok) {
+			byte_reader reader((const uint8_t*)record.data(), record.size());
+			reader.read(predicate[i]);
+			reader.read(effective[i]);
+		}
+	}
+
+	ok = ok and read_record(fptr, record);
+	if (ok) {
+		byte_reader reader((const uint8_t*)record.data(), record.size());
+		size_t count = reader.read_uint();
+		for (size_t i = 0; i < count; i++) {
+			deadlock d;
+			reader.read(d);
+			deadlocks.push_back(d);
+		}
+	}
+
+	ok = ok and states.load(fptr) and simulations.load(fptr);
+	fclose(fptr);
+
+	if (not ok) {
+		error("", "checkpoint '" + path + "' is damaged or doesn't match this graph", __FILE__, __LINE__);
+	}
+	return ok;
+}
+
 // Do an exhaustive simulation of all of the states in the state space. Record
 // the state encodings observed during that simulation into the places in the
 // HSE graph.
@@ -32,289 +508,1227 @@ namespace hse
 // go as far as possible around that cycle and every successive simulation will
 // branch off and recombine. This also keeps the amount of memory required as
 // low as possible as it fully explores branches before finding new ones.
-void elaborate(graph &g, bool annotate_ghosts, bool record_predicates, bool report_progress)
+//
+// If config.subsume is set, then states that are covered by an already
+// recorded state are dropped as well, both when they are first found and
+// during periodic sweeps of the pending simulations. See subsumption_index.
+size_t elaborate_serial(graph &g, const elaborate_config &config, const vector<bool> &reducible, subsumption_index &dominance, elaborate_monitor &monitor, string resume, vector<boolean::cover> &predicate, vector<boolean::cover> &effective, bool *resumed)
 {
-	if (report_progress) {
-		printf("  %s...", g.name.c_str());
-		fflush(stdout);
-	}
-	Timer tmr;
-
-	// Initialize all predicates and effective predicates to false.
-	for (int i = 0; i < (int)g.places.size(); i++) {
-		if (not g.places.is_valid(i)) continue;
-
-		g.places[i].predicate = boolean::cover();
-		g.places[i].effective = boolean::cover();
-	}
-
-	// TODO(edward.bingham) we run out of memory and the computer crashes at
-	// around 2 mil states or a simulation stack of 1 mil. This should be tested
-	// on other deployments, then we may need to implement active disc caching.
-	// Another thing we could try is to occationally review the set of pending
-	// simulations, and remove any that are covered by already recorded states.
-	// This sacrifices computation speed for memory footprint. While the set
-	// insert operations are not the bottleneck, it will also speed those up.
+	// Once we get into the millions of states, neither the visited states nor
+	// the pending simulations fit in memory anymore. Both of these structures
+	// spill to disk once they outgrow their memory budget.
 	
 	// used to trim the simulation tree by identifying revisited simulation states.
-	unordered_set<state> states;
+	state_store states(config.visited_budget, config.spill_directory);
+
+	// Returns true if the state of this simulation still needs to be explored.
+	auto admit = [&](simulator &sim) {
+		monitor.lap(nullptr);
+		state s = sim.get_state();
+		bool result = states.insert(s) and (not config.subsume or dominance.insert(s));
+		monitor.lap(&monitor.stats.hash_seconds);
+		monitor.visit(result);
+		return result;
+	};
 
 	// the set of currently running simulations
-	deque<simulator> simulations;
+	simulation_stack simulations(&g, config.frontier_budget, config.spill_directory);
+	simulations.pool.recycle = config.recycle;
+
+	// every simulation in this exploration reports its errors here
+	std::shared_ptr<error_registry> errors = std::make_shared<error_registry>();
 
 	// all error states found are stored here.
 	vector<deadlock> deadlocks;
 
-	// initialize the list of current simulations with reset
-	for (int i = 0; i < (int)g.reset.size(); i++) {
-		simulator sim(&g, g.reset[i], annotate_ghosts);
-		sim.enabled();
+	if (not resume.empty()) {
+		// pick up where a previous run left off
+		*resumed = load_checkpoint(resume, g, states, simulations, deadlocks, predicate, effective);
+		if (not *resumed) {
+			return 0;
+		}
 
-		if (states.insert(sim.get_state()).second) {
-			simulations.push_back(sim);
+		// The deadlocks found before the checkpoint went to a sink that is
+		// gone now, so report them again along with the new ones.
+		for (auto d = deadlocks.begin(); d != deadlocks.end(); d++) {
+			config.diagnostics->report(g, diagnostic(*d));
+		}
+	} else {
+		// initialize the list of current simulations with reset
+		for (int i = 0; i < (int)g.reset.size(); i++) {
+			simulator sim(&g, g.reset[i], config.annotate_ghosts);
+			sim.errors = errors;
+			sim.diagnostics = config.diagnostics;
+			sim.enabled();
+
+			if (admit(sim)) {
+				simulations.push_back(sim);
+			}
 		}
 	}
 
+	Timer since_checkpoint;
+	size_t steps = 0;
+
+	// records the changes made by each firing so that we can take them back
+	undo_log log;
+
 	// this is a depth-first search of all states reachable from reset.
 	//int count = 0;
+	size_t popped = 0;
+	simulator sim;
 	while (simulations.size() > 0) {
 		//count++;
+		if (not config.checkpoint_path.empty() and (++steps & 0xFF) == 0
+			and since_checkpoint.since() >= config.checkpoint_interval) {
+			save_checkpoint(config.checkpoint_path, g, states, simulations, deadlocks, predicate, effective);
+			since_checkpoint.reset();
+		}
+
+		// Every so often, drop the pending simulations that have been dominated
+		// by a state recorded after they were pushed.
+		if (config.subsume and ++popped%subsumption_sweep == 0) {
+			dominance.pruned += simulations.erase_if([&](simulator &pending) {
+				return not dominance.contains(pending.get_state());
+			});
+			if (simulations.empty()) {
+				break;
+			}
+		}
+
 		// grab the simulation at the top of the stack
-		simulator sim = simulations.back();
-		simulations.pop_back();
-		//simulations.back().merge_errors(sim);
+		simulations.pop_back(sim);
+		// simulations that were spilled to disk or loaded from a checkpoint
+		// don't carry the registry with them
+		sim.errors = errors;
+		sim.diagnostics = config.diagnostics;
+		monitor.stats.checked = dominance.checked;
+		monitor.stats.pruned = dominance.pruned;
+		monitor.step(states.size(), simulations.size(), states.hot, states.hot.bytes());
+
+		// If we can, fire a single transition that stands in for all of the
+		// others. If its successor is one we've already seen, then we have to
+		// fall back to firing everything.
+		int ample = choose_ample(sim, reducible);
+		bool expand = true;
+		if (ample >= 0) {
+			monitor.lap(nullptr);
+			sim.fire(ample, &log);
+			monitor.lap(&monitor.stats.fire_seconds);
+			sim.enabled(false, &log);
+			monitor.lap(&monitor.stats.enabled_seconds);
+			if (admit(sim)) {
+				simulations.push_back(sim);
+				expand = false;
+			}
+			sim.rollback(log);
+		}
 
-		// Create a new simulation for each enabled transition in the current
-		// simulation and push it to the end of the stack as long as we haven't
-		// seen that state before
-		for (int i = 0; i < (int)sim.ready.size(); i++) {
-			simulations.push_back(sim);
+		// Try each enabled transition in the current simulation in place, and
+		// push a copy to the end of the stack as long as we haven't seen the
+		// resulting state before.
+		for (int i = 0; i < (int)sim.ready.size() and expand; i++) {
+			if (i == ample) continue;
 
 			// fire the enabled transition
-			simulations.back().fire(i);
+			monitor.lap(nullptr);
+			sim.fire(i, &log);
+			monitor.lap(&monitor.stats.fire_seconds);
 
 			// compute the new enabled transitions
-			simulations.back().enabled();
+			sim.enabled(false, &log);
+			monitor.lap(&monitor.stats.enabled_seconds);
 
-			if (!states.insert(simulations.back().get_state()).second) {
-				simulations.pop_back();
+			if (admit(sim)) {
+				simulations.push_back(sim);
 			}
+
+			sim.rollback(log);
 		}
 
 		// If there aren't any enabled transitions, then record a deadlock state.
 		if (sim.ready.size() == 0) {
 			deadlock d = sim.get_state();
-			vector<deadlock>::iterator dloc = lower_bound(deadlocks.begin(), deadlocks.end(), d);
-			if (dloc == deadlocks.end() || *dloc != d) {
-				error("", d.to_string(g), __FILE__, __LINE__);
-				deadlocks.insert(dloc, d);
+			if (record_deadlock(deadlocks, d)) {
+				config.diagnostics->report(g, diagnostic(d));
+			}
+		}
+
+		if (config.record_predicates) {
+			record_state(g, sim, predicate, effective);
+		}
+	}
+
+	// A final checkpoint lets a later run pick up the finished results.
+	if (not config.checkpoint_path.empty()) {
+		save_checkpoint(config.checkpoint_path, g, states, simulations, deadlocks, predicate, effective);
+	}
+
+	return states.size();
+}
+
+// The visited set of the parallel explorer. States are distributed over a
+// fixed number of independently locked shards by their hash so that workers
+// rarely wait on each other.
+struct visited_shard
+{
+	std::mutex lock;
+	state_store states;
+};
+
+struct visited_set
+{
+	visited_set(int count, size_t budget, string directory) : shards(count) {
+		// A budget of 0 means no budget, so a small budget mustn't round down
+		// to it.
+		size_t share = budget == 0 ? 0 : max(budget/(size_t)count, (size_t)1);
+		for (auto i = shards.begin(); i != shards.end(); i++) {
+			i->states.budget = share;
+			i->states.directory = directory;
+		}
+	}
+	~visited_set() {}
+
+	vector<visited_shard> shards;
+
+	// Returns true if this state has not been visited before.
+	bool insert(const state &s) {
+		visited_shard &shard = shards[std::hash<state>()(s)%shards.size()];
+		std::lock_guard<std::mutex> guard(shard.lock);
+		return shard.states.insert(s);
+	}
+
+	size_t size() {
+		size_t result = 0;
+		for (auto i = shards.begin(); i != shards.end(); i++) {
+			result += i->states.size();
+		}
+		return result;
+	}
+
+	// The same as size() while the workers are still running, along with the
+	// load and the bytes used by the hot tables of all of the shards.
+	size_t sample(double *load, size_t *bytes) {
+		size_t result = 0;
+		size_t used = 0;
+		size_t slots = 0;
+		*bytes = 0;
+		for (auto i = shards.begin(); i != shards.end(); i++) {
+			std::lock_guard<std::mutex> guard(i->lock);
+			result += i->states.size();
+			used += i->states.hot.size();
+			slots += i->states.hot.slots.size();
+			*bytes += i->states.hot.bytes();
+		}
+		*load = slots == 0 ? 0.0 : (double)used/(double)slots;
+		return result;
+	}
+};
+
+// Each worker in the parallel explorer owns a depth first stack of pending
+// simulations. The owner pushes and pops from the back of its stack while
+// idle workers steal from the front, which holds the oldest and usually
+// largest unexplored branches. Predicates and deadlocks are accumulated per
+// worker and merged once the exploration is complete.
+//
+// The pending simulations belong to the pool of the worker whose stack they
+// are on, and the pool is guarded by the same lock as the stack. A thief
+// copies the simulation out and hands it back to the victim's pool before
+// letting go of the victim's lock. The same lock guards the revisits and
+// timings that the worker publishes to stats for the monitor.
+struct elaborate_worker
+{
+	elaborate_worker() {}
+	~elaborate_worker() {
+		for (auto i = simulations.begin(); i != simulations.end(); i++) {
+			pool.release(*i);
+		}
+	}
+
+	std::mutex lock;
+	simulator_pool pool;
+	deque<simulator*> simulations;
+
+	vector<boolean::cover> predicate;
+	vector<boolean::cover> effective;
+	vector<deadlock> deadlocks;
+
+	elaborate_stats stats;
+};
+
+// Counts the work in flight in the parallel explorer so that idle workers
+// can sleep until there is something to steal or the exploration is over.
+struct elaborate_progress
+{
+	elaborate_progress() {
+		pending = 0;
+		queued = 0;
+		sleeping = 0;
+	}
+	~elaborate_progress() {}
+
+	// Every simulation that is either waiting on a stack or being expanded by
+	// a worker. If it hits zero, then nobody can produce any more work.
+	std::atomic<int64_t> pending;
+
+	// The simulations waiting on a stack and the workers waiting for one.
+	std::atomic<int64_t> queued;
+	std::atomic<int> sleeping;
+
+	std::mutex lock;
+	std::condition_variable wake;
+
+	// Wakes the thread that started the workers, which waits on this between
+	// progress reports.
+	std::condition_variable done;
+
+	// Called after a simulation is pushed onto a stack. A sleeping worker
+	// bumps sleeping before it checks queued, and we bump queued before we
+	// check sleeping, so one of us sees the other. Taking the lock makes sure
+	// the worker is actually waiting before we notify it.
+	void pushed() {
+		queued++;
+		if (sleeping.load() > 0) {
+			std::lock_guard<std::mutex> guard(lock);
+			wake.notify_one();
+		}
+	}
+
+	// Called when a worker is done expanding a simulation.
+	void finished() {
+		if (--pending == 0) {
+			std::lock_guard<std::mutex> guard(lock);
+			wake.notify_all();
+			done.notify_all();
+		}
+	}
+
+	void wait() {
+		std::unique_lock<std::mutex> guard(lock);
+		sleeping++;
+		wake.wait(guard, [this]() {
+			return queued.load() > 0 or pending.load() == 0;
+		});
+		sleeping--;
+	}
+
+	// Returns true once the exploration is over, or false if seconds pass
+	// before it is.
+	bool wait_done(double seconds) {
+		std::unique_lock<std::mutex> guard(lock);
+		return done.wait_for(guard, std::chrono::duration<double>(seconds), [this]() {
+			return pending.load() == 0;
+		});
+	}
+};
+
+void elaborate_thread(graph &g, const elaborate_config &config, const vector<bool> &reducible, vector<elaborate_worker> &workers, int id, visited_set &states, elaborate_progress &progress, bool timed, std::shared_ptr<history_arena> arena)
+{
+	history_scope histories(arena);
+	scratch_scope scratch(config.recycle);
+
+	elaborate_worker &self = workers[id];
+	undo_log log;
+
+	// The statistics are gathered here and published to self.stats every so
+	// often so that the lock isn't taken for every successor, see
+	// elaborate_monitor.
+	elaborate_stats stats;
+	size_t steps = 0;
+	Timer timer;
+	double mark = 0.0;
+	auto lap = [&](double *section) {
+		if (timed) {
+			double now = timer.since();
+			if (section != nullptr) {
+				*section += now - mark;
+			}
+			mark = now;
+		}
+	};
+	auto publish = [&]() {
+		std::lock_guard<std::mutex> guard(self.lock);
+		self.stats = stats;
+	};
+	auto insert = [&](simulator &sim) {
+		lap(nullptr);
+		bool result = states.insert(sim.get_state());
+		lap(&stats.hash_seconds);
+		if (not result) {
+			stats.revisits++;
+		}
+		return result;
+	};
+
+	// This holds the simulation being expanded for the whole exploration so
+	// that its storage is reused from one state to the next.
+	simulator sim;
+	while (true) {
+		bool found = false;
+		{
+			std::lock_guard<std::mutex> guard(self.lock);
+			if (not self.simulations.empty()) {
+				sim = *self.simulations.back();
+				self.pool.release(self.simulations.back());
+				self.simulations.pop_back();
+				progress.queued--;
+				found = true;
+			}
+		}
+
+		for (int k = 1; k < (int)workers.size() and not found; k++) {
+			elaborate_worker &victim = workers[(id+k)%(int)workers.size()];
+			std::lock_guard<std::mutex> guard(victim.lock);
+			if (not victim.simulations.empty()) {
+				sim = *victim.simulations.front();
+				victim.pool.release(victim.simulations.front());
+				victim.simulations.pop_front();
+				progress.queued--;
+				found = true;
 			}
 		}
 
-		if (not record_predicates) {
+		if (not found) {
+			if (progress.pending.load() == 0) {
+				publish();
+				return;
+			}
+			progress.wait();
 			continue;
 		}
 
-		// The effective predicate represents the state encodings that don't have
-		// duplicates in later states. For each non-vacuous transition that is
-		// enabled, we need to record the current state into the predicate of the
-		// places that would be the marking to fire that non-vacuous transition.
-		// Any token that belongs to at least one such marking should record the
-		// current state.
-		//
-		// How do we determine that for each token?
-		// 
-		// First attempt:
-		// A token saves the state to the predicate of its place if (it is not an
-		// input to a vacuous transition, not an output of a non-vacuous
-		// transition, and there is an enabled non-vacuous transition that does not
-		// prevent the sequence of vacuous transitions that lead to this token) or
-		// it's an input to a non-vacuous transition.
-
-		//vector<set<int> > en_in(sim.tokens.size(), set<int>());
-		
-		// record whether this is an output of a non-vacuous 
-		vector<bool> en_in(sim.tokens.size(), false);
-		vector<set<int> > en_out(sim.tokens.size(), set<int>());
-
-		// record whether there is an enabled non-vacuous that does not prevent the
-		// sequence of vacuous transitions that lead to this token.
-		//vector<bool> is_live(sim.tokens.size(), false);
-
-		/*bool change = true;
-		while (change) {
-			change = false;
-			for (int i = 0; i < (int)sim.loaded.size(); i++) {
-				set<int> total_in;
-				for (int j = 0; j < (int)sim.loaded[i].tokens.size(); j++) {
-					total_in.insert(en_in[sim.loaded[i].tokens[j]].begin(), en_in[sim.loaded[i].tokens[j]].end());
+		int ample = choose_ample(sim, reducible);
+		bool expand = true;
+		if (ample >= 0) {
+			lap(nullptr);
+			sim.fire(ample, &log);
+			lap(&stats.fire_seconds);
+			sim.enabled(false, &log);
+			lap(&stats.enabled_seconds);
+			if (insert(sim)) {
+				progress.pending++;
+				{
+					std::lock_guard<std::mutex> guard(self.lock);
+					self.simulations.push_back(self.pool.acquire(sim));
 				}
-				total_in.insert(sim.loaded[i].index);
+				progress.pushed();
+				expand = false;
+			}
+			sim.rollback(log);
+		}
+
+		for (int i = 0; i < (int)sim.ready.size() and expand; i++) {
+			if (i == ample) continue;
 
-				for (int j = 0; j < (int)sim.loaded[i].output_marking.size(); j++) {
-					set<int> old_in = en_in[sim.loaded[i].output_marking[j]];
-					en_in[sim.loaded[i].output_marking[j]].insert(total_in.begin(), total_in.end());
-					change = change or (en_in[sim.loaded[i].output_marking[j]] != old_in);
+			lap(nullptr);
+			sim.fire(i, &log);
+			lap(&stats.fire_seconds);
+			sim.enabled(false, &log);
+			lap(&stats.enabled_seconds);
+
+			if (insert(sim)) {
+				progress.pending++;
+				{
+					std::lock_guard<std::mutex> guard(self.lock);
+					self.simulations.push_back(self.pool.acquire(sim));
 				}
+				progress.pushed();
 			}
-		}*/
 
-		for (int i = 0; i < (int)sim.loaded.size(); i++)
-			for (int j = 0; j < (int)sim.loaded[i].tokens.size(); j++)
-				en_out[sim.loaded[i].tokens[j]].insert(i);
+			sim.rollback(log);
+		}
 
-		for (int i = 0; i < (int)sim.loaded.size(); i++)
-			for (int j = 0; j < (int)sim.loaded[i].output_marking.size(); j++)
-				if (not sim.loaded[i].vacuous)
-					en_in[sim.loaded[i].output_marking[j]] = true;
+		if (sim.ready.size() == 0) {
+			record_deadlock(self.deadlocks, sim.get_state());
+		}
 
-		for (int i = 0; i < (int)sim.tokens.size(); i++) {
-			bool isOutput = en_out[i].empty() and en_in[i];
+		if (config.record_predicates) {
+			record_state(g, sim, self.predicate, self.effective);
+		}
 
-			// TODO(edward.bingham) This is not properly saving the state when there is
-			// another vacuous transition that skips around a non-vacuous transition
-			// through a choice. For vacuous transitions out of a conditional split
-			// on which we are firing a transition down another branch, we need to
-			// undo all of the other tokens.
-			bool isVacuous = false;
-			for (set<int>::iterator j = en_out[i].begin(); j != en_out[i].end() and not isVacuous; j++) {
-				isVacuous = sim.loaded[*j].vacuous;
+		if ((++steps & 0xFF) == 0) {
+			publish();
+		}
+
+		progress.finished();
+	}
+}
+
+// Sum up the statistics that the workers have published so far.
+void gather_stats(elaborate_stats &stats, vector<elaborate_worker> &workers)
+{
+	stats.revisits = 0;
+	stats.enabled_seconds = 0.0;
+	stats.fire_seconds = 0.0;
+	stats.hash_seconds = 0.0;
+	for (auto i = workers.begin(); i != workers.end(); i++) {
+		std::lock_guard<std::mutex> guard(i->lock);
+		stats.revisits += i->stats.revisits;
+		stats.enabled_seconds += i->stats.enabled_seconds;
+		stats.fire_seconds += i->stats.fire_seconds;
+		stats.hash_seconds += i->stats.hash_seconds;
+	}
+}
+
+// This is the same exploration as elaborate_serial() spread over multiple
+// worker threads. The set of visited states, and therefore the recorded
+// predicates and deadlocks, are the same as the serial explorer's so long as
+// the successors of a simulation depend only on its state. This holds for any
+// design without instabilities or interference.
+size_t elaborate_parallel(graph &g, const elaborate_config &config, const vector<bool> &reducible, int threads, elaborate_monitor &monitor, vector<boolean::cover> &predicate, vector<boolean::cover> &effective)
+{
+	visited_set states(threads*16, config.visited_budget, config.spill_directory);
+	vector<elaborate_worker> workers(threads);
+	for (int i = 0; i < threads; i++) {
+		workers[i].pool.recycle = config.recycle;
+		workers[i].predicate.resize(g.places.size());
+		workers[i].effective.resize(g.places.size());
+	}
+
+	elaborate_progress progress;
+
+	// deal the reset states out to the workers, all of them share one registry
+	std::shared_ptr<error_registry> errors = std::make_shared<error_registry>();
+	for (int i = 0; i < (int)g.reset.size(); i++) {
+		simulator sim(&g, g.reset[i], config.annotate_ghosts);
+		sim.errors = errors;
+		sim.diagnostics = config.diagnostics;
+		sim.enabled();
+
+		if (states.insert(sim.get_state())) {
+			progress.pending++;
+			progress.queued++;
+			workers[i%threads].simulations.push_back(workers[i%threads].pool.acquire(sim));
+		}
+	}
+
+	vector<std::thread> pool;
+	for (int i = 0; i < threads; i++) {
+		pool.push_back(std::thread(elaborate_thread, std::ref(g), std::cref(config), std::cref(reducible), std::ref(workers), i, std::ref(states), std::ref(progress), monitor.timed, history_scope::current()));
+	}
+
+	// The workers publish their statistics as they go, and this thread
+	// gathers them up every progress_interval seconds.
+	if (monitor.active()) {
+		double interval = max(config.progress_interval, 0.01);
+		while (not progress.wait_done(interval)) {
+			if (not monitor.due()) {
+				continue;
 			}
-	
-			if (not isVacuous and not isOutput) {
-				//boolean::cover en = 1;
-				boolean::cover dis = 1;
-				//for (set<int>::iterator j = en_in[i].begin(); j != en_in[i].end(); j++)
-				//	en &= g.transitions[*j].local_action;
-				// Not guard because then we'd be in the hidden place in the transition
-				// and not action because then we would have passed this transtion entirely
-				// whether or not the current encoding passes the guard
-				for (set<int>::iterator j = en_out[i].begin(); j != en_out[i].end(); j++)
-					dis &= ~g.transitions[sim.loaded[*j].index].guard;
-
-				// Given the current encoding - sim.encoding
-				// 1. Ignore unstable signals - xoutnulls()
-				// 2. Mask out variables that this process has no visibility for - flipped_mask()
-				// 3. OR this into the predicate for that place
-				for (auto c = sim.encoding.cubes.begin(); c != sim.encoding.cubes.end(); c++) {
-					g.places[sim.tokens[i].index].predicate |= (c->xoutnulls()).flipped_mask(g.places[sim.tokens[i].index].mask);
-					// Same thing as above, but we exclude any state encoding that passes an outgoing guard - & dis
-					g.places[sim.tokens[i].index].effective |= (c->xoutnulls() & dis).flipped_mask(g.places[sim.tokens[i].index].mask);
-				}
+
+			gather_stats(monitor.stats, workers);
+			double load = 0.0;
+			size_t bytes = 0;
+			size_t count = states.sample(&load, &bytes);
+			monitor.report(count, (size_t)max(progress.queued.load(), (int64_t)0), load, bytes);
+		}
+	}
+
+	for (int i = 0; i < threads; i++) {
+		pool[i].join();
+	}
+	gather_stats(monitor.stats, workers);
+
+	vector<deadlock> deadlocks;
+	for (int i = 0; i < threads; i++) {
+		for (int j = 0; j < (int)g.places.size(); j++) {
+			predicate[j] |= workers[i].predicate[j];
+			effective[j] |= workers[i].effective[j];
+		}
+
+		for (auto d = workers[i].deadlocks.begin(); d != workers[i].deadlocks.end(); d++) {
+			record_deadlock(deadlocks, *d);
+		}
+	}
+
+	for (auto d = deadlocks.begin(); d != deadlocks.end(); d++) {
+		config.diagnostics->report(g, diagnostic(*d));
+	}
+
+	return states.size();
+}
+
+cached_state::cached_state()
+{
+	offset = 0;
+	deadlock = false;
+}
+
+cached_state::~cached_state()
+{
+}
+
+elaborate_cache::elaborate_cache()
+{
+	nets = 0;
+}
+
+elaborate_cache::~elaborate_cache()
+{
+}
+
+int elaborate_cache::insert(const state &s, bool *inserted)
+{
+	bool is_new = false;
+	int slot = states.insert(s, (int)nodes.size(), &is_new);
+	if (is_new) {
+		nodes.push_back(cached_state());
+		nodes.back().offset = states.slots[slot].offset;
+	}
+	if (inserted != nullptr) {
+		*inserted = is_new;
+	}
+	return states.value(slot);
+}
+
+void elaborate_cache::snapshot(const graph &g)
+{
+	nets = g.netCount();
+
+	place_valid.assign(g.places.size(), false);
+	place_prev.assign(g.places.size(), vector<int>());
+	place_next.assign(g.places.size(), vector<int>());
+	for (int i = 0; i < (int)g.places.size(); i++) {
+		if (not g.places.is_valid(i)) continue;
+
+		place_valid[i] = true;
+		place_prev[i] = g.prev(place::type, i);
+		place_next[i] = g.next(place::type, i);
+		sort(place_prev[i].begin(), place_prev[i].end());
+		sort(place_next[i].begin(), place_next[i].end());
+	}
+
+	transition_valid.assign(g.transitions.size(), false);
+	transition_prev.assign(g.transitions.size(), vector<int>());
+	transition_next.assign(g.transitions.size(), vector<int>());
+	assume.assign(g.transitions.size(), boolean::cover());
+	guard.assign(g.transitions.size(), boolean::cover());
+	local_action.assign(g.transitions.size(), boolean::cover());
+	remote_action.assign(g.transitions.size(), boolean::cover());
+	for (int i = 0; i < (int)g.transitions.size(); i++) {
+		if (not g.transitions.is_valid(i)) continue;
+
+		transition_valid[i] = true;
+		transition_prev[i] = g.prev(transition::type, i);
+		transition_next[i] = g.next(transition::type, i);
+		sort(transition_prev[i].begin(), transition_prev[i].end());
+		sort(transition_next[i].begin(), transition_next[i].end());
+		assume[i] = g.transitions[i].assume;
+		guard[i] = g.transitions[i].guard;
+		local_action[i] = g.transitions[i].local_action;
+		remote_action[i] = g.transitions[i].remote_action;
+	}
+}
+
+// Returns whether the structure around each place has changed since the
+// snapshot. A place is affected if it was added or removed, if its arcs
+// changed, or if any transition next to it before or after the change was
+// added, removed, rewired, or had its guard or actions changed.
+vector<bool> elaborate_cache::affected(const graph &g) const
+{
+	int places = max((int)g.places.size(), (int)place_valid.size());
+	int transitions = max((int)g.transitions.size(), (int)transition_valid.size());
+
+	vector<bool> changed(transitions, false);
+	for (int i = 0; i < transitions; i++) {
+		bool was = i < (int)transition_valid.size() and transition_valid[i];
+		bool is = i < (int)g.transitions.size() and g.transitions.is_valid(i);
+		if (was != is) {
+			changed[i] = true;
+		} else if (is) {
+			vector<int> prev = g.prev(transition::type, i);
+			vector<int> next = g.next(transition::type, i);
+			sort(prev.begin(), prev.end());
+			sort(next.begin(), next.end());
+			changed[i] = prev != transition_prev[i]
+				or next != transition_next[i]
+				or g.transitions[i].assume != assume[i]
+				or g.transitions[i].guard != guard[i]
+				or g.transitions[i].local_action != local_action[i]
+				or g.transitions[i].remote_action != remote_action[i];
+		}
+	}
+
+	vector<bool> result(places, false);
+	for (int i = 0; i < places; i++) {
+		bool was = i < (int)place_valid.size() and place_valid[i];
+		bool is = i < (int)g.places.size() and g.places.is_valid(i);
+		if (was != is) {
+			result[i] = true;
+			continue;
+		} else if (not is) {
+			continue;
+		}
+
+		vector<int> prev = g.prev(place::type, i);
+		vector<int> next = g.next(place::type, i);
+		sort(prev.begin(), prev.end());
+		sort(next.begin(), next.end());
+		result[i] = prev != place_prev[i] or next != place_next[i];
+		for (auto t = next.begin(); t != next.end() and not result[i]; t++) {
+			result[i] = changed[*t];
+		}
+		for (auto t = prev.begin(); t != prev.end() and not result[i]; t++) {
+			result[i] = changed[*t];
+		}
+	}
+
+	return result;
+}
+
+// Returns whether each node can be reused, which is to say that neither it nor
+// anything reachable from it has a token in an affected place.
+vector<bool> elaborate_cache::reusable(const graph &g)
+{
+	vector<bool> result(nodes.size(), true);
+	if (nodes.empty()) {
+		return result;
+	}
+
+	vector<bool> changed = affected(g);
+	vector<vector<int> > prev(nodes.size());
+	vector<int> stack;
+	for (int i = 0; i < (int)nodes.size(); i++) {
+		for (auto j = nodes[i].next.begin(); j != nodes[i].next.end(); j++) {
+			prev[*j].push_back(i);
+		}
+
+		state s = states.at(nodes[i].offset);
+		for (auto t = s.tokens.begin(); t != s.tokens.end() and result[i]; t++) {
+			if (t->index >= (int)changed.size() or changed[t->index]) {
+				result[i] = false;
+				stack.push_back(i);
 			}
 		}
 	}
 
-	if (not record_predicates) {
-		return;
+	while (not stack.empty()) {
+		int i = stack.back();
+		stack.pop_back();
+		for (auto j = prev[i].begin(); j != prev[i].end(); j++) {
+			if (result[*j]) {
+				result[*j] = false;
+				stack.push_back(*j);
+			}
+		}
+	}
+
+	return result;
+}
+
+void elaborate_cache::clear()
+{
+	states.clear();
+	nodes.clear();
+	nets = 0;
+	place_valid.clear();
+	place_prev.clear();
+	place_next.clear();
+	transition_valid.clear();
+	transition_prev.clear();
+	transition_next.clear();
+	assume.clear();
+	guard.clear();
+	local_action.clear();
+	remote_action.clear();
+}
+
+// Find the node in the previous elaboration that s corresponds to. The values
+// of the nets that didn't exist back then are returned in extra.
+int find_cached(const graph &g, elaborate_cache &cache, state s, boolean::cube *extra)
+{
+	if (cache.nodes.empty() or s.encodings.cubes.size() != 1) {
+		return -1;
+	}
+
+	*extra = boolean::cube();
+	vector<int> hidden;
+	for (int v = cache.nets; v < g.netCount(); v++) {
+		int value = s.encodings.cubes[0].get(v);
+		if (value == 0 or value == 1) {
+			*extra &= boolean::cube(v, value);
+		} else if (value < 0) {
+			return -1;
+		}
+		hidden.push_back(v);
+	}
+	s.encodings.hide(hidden);
+
+	int slot = cache.states.find(s);
+	return slot >= 0 ? cache.states.value(slot) : -1;
+}
+
+// Copy everything reachable from node from in the previous elaboration into
+// node id of result. None of these states can reach a change to the graph, so
+// each one has the same successors and records the same encodings as before
+// along with the values of the new nets in extra.
+void reuse_closure(const graph &g, const elaborate_config &config, elaborate_cache &cache, int from, const boolean::cube &extra, elaborate_cache &result, int id, vector<deadlock> &deadlocks, vector<boolean::cover> &predicate, vector<boolean::cover> &effective)
+{
+	vector<pair<int, int> > stack(1, pair<int, int>(from, id));
+	while (not stack.empty()) {
+		int o = stack.back().first;
+		int n = stack.back().second;
+		stack.pop_back();
+
+		const cached_state &prev = cache.nodes[o];
+		for (int k = 0; k < (int)prev.places.size(); k++) {
+			int p = prev.places[k];
+			boolean::cover enc = prev.predicate[k] & extra;
+			boolean::cover eff = prev.effective[k] & extra;
+			predicate[p] |= enc.flipped_mask(g.places[p].mask);
+			effective[p] |= eff.flipped_mask(g.places[p].mask);
+
+			result.nodes[n].places.push_back(p);
+			result.nodes[n].predicate.push_back(enc);
+			result.nodes[n].effective.push_back(eff);
+		}
+
+		if (prev.deadlock) {
+			result.nodes[n].deadlock = true;
+			deadlock d(result.states.at(result.nodes[n].offset));
+			if (record_deadlock(deadlocks, d)) {
+				config.diagnostics->report(g, diagnostic(d));
+			}
+		}
+
+		for (auto j = prev.next.begin(); j != prev.next.end(); j++) {
+			state s = cache.states.at(cache.nodes[*j].offset);
+			s.encodings &= extra;
+
+			bool inserted = false;
+			int next = result.insert(s, &inserted);
+			result.nodes[n].next.push_back(next);
+			if (inserted) {
+				stack.push_back(pair<int, int>(*j, next));
+			}
+		}
+	}
+}
+
+// The depth first search from elaborate_serial(), except that it records the
+// reachable state graph into the cache as it goes. Any state that matches a
+// reusable state from the previous elaboration is copied over along with
+// everything reachable from it instead of being simulated.
+size_t elaborate_incremental(graph &g, const elaborate_config &config, elaborate_cache &cache, elaborate_monitor &monitor, vector<boolean::cover> &predicate, vector<boolean::cover> &effective)
+{
+	vector<bool> reusable = cache.reusable(g);
+
+	elaborate_cache result;
+	vector<deadlock> deadlocks;
+
+	// the currently running simulations along with their nodes in result
+	simulation_stack simulations(&g, 0, "");
+	simulations.pool.recycle = config.recycle;
+	vector<int> ids;
+
+	std::shared_ptr<error_registry> errors = std::make_shared<error_registry>();
+	for (int i = 0; i < (int)g.reset.size(); i++) {
+		simulator sim(&g, g.reset[i], config.annotate_ghosts);
+		sim.errors = errors;
+		sim.diagnostics = config.diagnostics;
+		sim.enabled();
+
+		bool inserted = false;
+		int id = result.insert(sim.get_state(), &inserted);
+		if (inserted) {
+			simulations.push_back(sim);
+			ids.push_back(id);
+		}
 	}
 
-	// Clean up the recorded state with Espresso. This will help when rendering
-	// the state information to the user and when synthesizing production rules
-	// for the final circuit.
+	undo_log log;
+	simulator sim;
+	while (not simulations.empty()) {
+		simulations.pop_back(sim);
+		int id = ids.back();
+		ids.pop_back();
+		monitor.step(result.nodes.size(), simulations.size(), result.states, result.states.bytes());
+
+		boolean::cube extra;
+		int from = find_cached(g, cache, sim.get_state(), &extra);
+		if (from >= 0 and reusable[from]) {
+			reuse_closure(g, config, cache, from, extra, result, id, deadlocks, predicate, effective);
+			continue;
+		}
+
+		for (int i = 0; i < (int)sim.ready.size(); i++) {
+			monitor.lap(nullptr);
+			sim.fire(i, &log);
+			monitor.lap(&monitor.stats.fire_seconds);
+			sim.enabled(false, &log);
+			monitor.lap(&monitor.stats.enabled_seconds);
+
+			bool inserted = false;
+			int next = result.insert(sim.get_state(), &inserted);
+			monitor.lap(&monitor.stats.hash_seconds);
+			monitor.visit(inserted);
+			result.nodes[id].next.push_back(next);
+			if (inserted) {
+				simulations.push_back(sim);
+				ids.push_back(next);
+			}
+
+			sim.rollback(log);
+		}
+
+		if (sim.ready.size() == 0) {
+			result.nodes[id].deadlock = true;
+			deadlock d = sim.get_state();
+			if (record_deadlock(deadlocks, d)) {
+				config.diagnostics->report(g, diagnostic(d));
+			}
+		}
+
+		record_state(g, sim, predicate, effective, &result.nodes[id]);
+	}
+
+	size_t count = result.nodes.size();
+	cache.states = std::move(result.states);
+	cache.nodes.swap(result.nodes);
+	cache.snapshot(g);
+	return count;
+}
+
+// Report the options that an explorer can't honor through the diagnostics of
+// config, followed by what it does instead. Returns false if there are none.
+bool report_unsupported(const graph &g, const elaborate_config &config, const vector<string> &options, string instead)
+{
+	if (options.empty()) {
+		return false;
+	}
+
+	string names;
+	for (int i = 0; i < (int)options.size(); i++) {
+		names += (i == 0 ? "" : ", ") + options[i];
+	}
+	config.diagnostics->report(g, diagnostic(names + " not supported " + instead));
+	return true;
+}
+
+// Elaborate g from reset or, if resume isn't empty, from the checkpoint at
+// that path. Returns false if the checkpoint couldn't be loaded.
+bool elaborate_from(graph &g, const elaborate_config &config, string resume)
+{
+	// The histories and the scratch memory of the simulators are released
+	// when we're done.
+	history_scope histories;
+	scratch_scope scratch(config.recycle);
+
+	// Build the snapshot the simulators share before any of the worker
+	// threads start, see compile().
+	compile(g);
+
+	if (config.report_progress) {
+		printf("  %s...", g.name.c_str());
+		fflush(stdout);
+	}
+	Timer tmr;
+
+	// Initialize all predicates and effective predicates to false.
 	for (int i = 0; i < (int)g.places.size(); i++) {
 		if (not g.places.is_valid(i)) continue;
 
-		g.places[i].effective.espresso();
-		sort(g.places[i].effective.cubes.begin(), g.places[i].effective.cubes.end());
-		g.places[i].predicate.espresso();
+		g.places[i].predicate = boolean::cover();
+		g.places[i].effective = boolean::cover();
+	}
+
+	// Hold on to the diagnostics until the exploration is done, unless the
+	// caller gave us somewhere else to send them.
+	diagnostic_sink deferred;
+	elaborate_config inner = config;
+	if (inner.diagnostics == nullptr) {
+		inner.diagnostics = &deferred;
+	}
+
+	int threads = config.threads;
+	if (threads <= 0) {
+		threads = max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	// The subsumption index, the spilled frontier, and checkpoints only exist
+	// in the serial explorer, so fall back to it rather than quietly drop
+	// them. The symbolic engine has no use for the index since it never
+	// visits a state twice.
+	if (config.subsume and config.engine == elaborate_config::SYMBOLIC) {
+		report_unsupported(g, inner, {"subsume"}, "by the symbolic engine, ignoring it");
+	} else if (threads > 1 and not resume.empty()) {
+		report_unsupported(g, inner, {"threads"}, "when resuming from a checkpoint, using the serial explorer");
+	} else if (threads > 1 and config.engine != elaborate_config::SYMBOLIC) {
+		vector<string> unsupported;
+		if (config.subsume) {
+			unsupported.push_back("subsume");
+		}
+		if (config.frontier_budget > 0) {
+			unsupported.push_back("frontier_budget");
+		}
+		if (not config.checkpoint_path.empty()) {
+			unsupported.push_back("checkpoint_path");
+		}
+
+		if (report_unsupported(g, inner, unsupported, "with " + ::to_string(threads) + " threads, using the serial explorer")) {
+			threads = 1;
+		}
+	}
+
+	vector<bool> reducible;
+	if (config.reduce) {
+		reducible = find_reducible(g);
+	}
+
+	subsumption_index dominance;
+	elaborate_monitor monitor(config, config.report_progress);
+	vector<boolean::cover> predicate(g.places.size());
+	vector<boolean::cover> effective(g.places.size());
+	size_t explored = 0;
+	bool resumed = true;
+	if (not resume.empty()) {
+		explored = elaborate_serial(g, inner, reducible, dominance, monitor, resume, predicate, effective, &resumed);
+	} else if (config.engine == elaborate_config::SYMBOLIC) {
+		bool supported = true;
+		explored = elaborate_symbolic(g, inner, monitor, predicate, effective, &supported);
+		if (not supported) {
+			explored = elaborate_serial(g, inner, reducible, dominance, monitor, resume, predicate, effective, &resumed);
+		}
+	} else if (threads > 1) {
+		explored = elaborate_parallel(g, inner, reducible, threads, monitor, predicate, effective);
+	} else {
+		explored = elaborate_serial(g, inner, reducible, dominance, monitor, resume, predicate, effective, &resumed);
+	}
+	monitor.stats.checked = dominance.checked;
+	monitor.stats.pruned = dominance.pruned;
+	monitor.finish(explored);
+	deferred.flush(g);
+
+	if (not resumed) {
+		return false;
 	}
 
-	if (report_progress) {
-		printf("[%sEXPLORED %lu MARKINGS%s]\t%gs\n", KGRN, states.size(), KNRM, tmr.since());
+	if (not config.record_predicates) {
+		return true;
 	}
+
+	save_predicates(g, predicate, effective);
+
+	if (config.report_progress) {
+		if (config.subsume and dominance.checked > 0) {
+			printf("[%sEXPLORED %lu MARKINGS%s, %.1f%% PRUNED]\t%gs\n", KGRN, explored, KNRM, 100.0*(double)dominance.pruned/(double)dominance.checked, tmr.since());
+		} else {
+			printf("[%sEXPLORED %lu MARKINGS%s]\t%gs\n", KGRN, explored, KNRM, tmr.since());
+		}
+	}
+	return true;
+}
+
+void elaborate(graph &g, const elaborate_config &config)
+{
+	elaborate_from(g, config, "");
+}
+
+bool resume_elaborate(graph &g, string path, const elaborate_config &config)
+{
+	return elaborate_from(g, config, path);
 }
 
+void elaborate(graph &g, const elaborate_config &config, elaborate_cache &cache)
+{
+	history_scope histories;
+	scratch_scope scratch(config.recycle);
+
+	if (config.report_progress) {
+		printf("  %s...", g.name.c_str());
+		fflush(stdout);
+	}
+	Timer tmr;
+
+	for (int i = 0; i < (int)g.places.size(); i++) {
+		if (not g.places.is_valid(i)) continue;
+
+		g.places[i].predicate = boolean::cover();
+		g.places[i].effective = boolean::cover();
+	}
+
+	vector<boolean::cover> predicate(g.places.size());
+	vector<boolean::cover> effective(g.places.size());
+	diagnostic_sink deferred;
+	elaborate_config inner = config;
+	if (inner.diagnostics == nullptr) {
+		inner.diagnostics = &deferred;
+	}
+
+	// The incremental explorer is a plain serial search over the cached
+	// state graph.
+	vector<string> unsupported;
+	if (config.threads != 1) {
+		unsupported.push_back("threads");
+	}
+	if (config.engine != elaborate_config::EXPLICIT) {
+		unsupported.push_back("engine");
+	}
+	if (config.reduce) {
+		unsupported.push_back("reduce");
+	}
+	if (config.subsume) {
+		unsupported.push_back("subsume");
+	}
+	if (config.visited_budget > 0 or config.frontier_budget > 0) {
+		unsupported.push_back("memory budgets");
+	}
+	if (not config.checkpoint_path.empty()) {
+		unsupported.push_back("checkpoint_path");
+	}
+	report_unsupported(g, inner, unsupported, "by the incremental explorer, ignoring them");
+
+	elaborate_monitor monitor(config, config.report_progress);
+	size_t explored = elaborate_incremental(g, inner, cache, monitor, predicate, effective);
+	monitor.finish(explored);
+	deferred.flush(g);
+
+	if (not config.record_predicates) {
+		return;
+	}
+
+	save_predicates(g, predicate, effective);
+
+	if (config.report_progress) {
+		printf("[%sEXPLORED %lu MARKINGS%s]\t%gs\n", KGRN, explored, KNRM, tmr.since());
+	}
+}
+
+void elaborate(graph &g, bool annotate_ghosts, bool record_predicates, bool report_progress)
+{
+	elaborate(g, elaborate_config(annotate_ghosts, record_predicates, report_progress));
+}
+
+// A pending simulation in to_state_graph(), exec belongs to a simulator_pool.
 struct simulation {
-	simulation() {}
-	simulation(simulator exec, petri::iterator node) {
+	simulation() {
+		exec = nullptr;
+	}
+	simulation(simulator *exec, petri::iterator node) {
 		this->exec = exec;
 		this->node = node;
 	}
 	~simulation() {}
 
-	simulator exec;
+	simulator *exec;
 	petri::iterator node;
 };
 
 // This converts a given graph to the fully expanded state space through simulation. It systematically
 // simulates all possible transition orderings and determines all of the resulting state information.
-graph to_state_graph(graph &g, bool report_progress) {
+graph to_state_graph(graph &g, const elaborate_config &options) {
+	history_scope histories;
+	scratch_scope scratch(options.recycle);
+
+	// Hold on to the diagnostics until the exploration is done, unless the
+	// caller gave us somewhere else to send them.
+	diagnostic_sink deferred;
+	elaborate_config config = options;
+	if (config.diagnostics == nullptr) {
+		config.diagnostics = &deferred;
+	}
+
+	elaborate_monitor monitor(config, config.report_progress);
 	graph result;
-	hashmap<state, petri::iterator, 10000> states;
+	// maps the key of each state to the index of its place in the state graph
+	state_table states;
+	simulator_pool pool;
+	pool.recycle = config.recycle;
 	vector<simulation> simulations;
 	vector<deadlock> deadlocks;
+	undo_log log;
 
+	std::shared_ptr<error_registry> errors = std::make_shared<error_registry>();
 	for (int i = 0; i < (int)g.reset.size(); i++) {
 		simulator sim(&g, g.reset[i]);
+		sim.errors = errors;
+		sim.diagnostics = config.diagnostics;
 		sim.enabled();
 
-		map<state, petri::iterator>::iterator loc;
-		if (states.insert(sim.get_key(), petri::iterator(), &loc)) {
-			loc->second = result.create(place(loc->first.encodings));
+		state key = sim.get_key();
+		bool inserted = false;
+		int loc = states.insert(key, 0, &inserted);
+		if (inserted) {
+			petri::iterator node = result.create(place(key.encodings));
+			states.value(loc) = node.index;
 
 			// Set up the initial state which is determined by the reset behavior
-			result.reset.push_back(state(vector<petri::token>(1, petri::token(loc->second.index)), g.reset[i].encodings));
+			result.reset.push_back(state(vector<petri::token>(1, petri::token(node.index)), g.reset[i].encodings));
 
 			// Set up the first simulation that starts at the reset state
-			simulations.push_back(simulation(sim, loc->second));
+			simulations.push_back(simulation(pool.acquire(sim), node));
 		}
 	}
 
-	int count = 0;
+	simulation top;
+	simulator exec;
 	while (simulations.size() > 0) {
-		simulation sim = simulations.back();
+		top = simulations.back();
 		simulations.pop_back();
+		exec = *top.exec;
+		pool.release(top.exec);
 		if (simulations.size() > 0)
-			simulations.back().exec.merge_errors(sim.exec);
-
-		if (report_progress)
-			progress("", ::to_string(count) + " " + ::to_string(simulations.size()) + " " + ::to_string(states.max_bucket_size()) + "/" + ::to_string(states.count) + " " + ::to_string(sim.exec.ready.size()), __FILE__, __LINE__);
-
-		simulations.reserve(simulations.size() + sim.exec.ready.size());
-		for (int i = 0; i < (int)sim.exec.ready.size(); i++) {
-			simulations.push_back(sim);
-			int index = simulations.back().exec.loaded[simulations.back().exec.ready[i].first].index;
-			int term = simulations.back().exec.ready[i].second;
-
-			simulations.back().exec.fire(i);
-			simulations.back().exec.enabled();
-
-			map<state, petri::iterator>::iterator loc;
-			if (states.insert(simulations.back().exec.get_key(), petri::iterator(), &loc)) {
-				loc->second = result.create(place(loc->first.encodings));
-				petri::iterator trans = result.create(g.transitions[index].subdivide(term));
-				result.connect(simulations.back().node, trans);
-				result.connect(trans, loc->second);
-				simulations.back().node = loc->second;
+			simulations.back().exec->merge_errors(exec);
+
+		monitor.step(states.size(), simulations.size(), states, states.bytes());
+
+		simulations.reserve(simulations.size() + exec.ready.size());
+		for (int i = 0; i < (int)exec.ready.size(); i++) {
+			int index = exec.loaded[exec.ready[i].first].index;
+			int term = exec.ready[i].second;
+
+			monitor.lap(nullptr);
+			exec.fire(i, &log);
+			monitor.lap(&monitor.stats.fire_seconds);
+			exec.enabled(false, &log);
+			monitor.lap(&monitor.stats.enabled_seconds);
+
+			state key = exec.get_key();
+			bool inserted = false;
+			int loc = states.insert(key, 0, &inserted);
+			monitor.lap(&monitor.stats.hash_seconds);
+			monitor.visit(inserted);
+			petri::iterator trans = result.create(g.transitions[index].subdivide(term));
+			result.connect(top.node, trans);
+			if (inserted) {
+				petri::iterator node = result.create(place(key.encodings));
+				states.value(loc) = node.index;
+				result.connect(trans, node);
+				simulations.push_back(simulation(pool.acquire(exec), node));
 			} else {
-				petri::iterator trans = result.create(g.transitions[index].subdivide(term));
-				result.connect(simulations.back().node, trans);
-				result.connect(trans, loc->second);
-				simulations.pop_back();
+				result.connect(trans, petri::iterator(place::type, states.value(loc)));
 			}
+
+			exec.rollback(log);
 		}
 
-		if (sim.exec.ready.size() == 0) {
-			deadlock d = sim.exec.get_state();
+		if (exec.ready.size() == 0) {
+			deadlock d = exec.get_state();
 			vector<deadlock>::iterator dloc = lower_bound(deadlocks.begin(), deadlocks.end(), d);
 			if (dloc == deadlocks.end() || *dloc != d) {
-				error("", d.to_string(g), __FILE__, __LINE__);
+				config.diagnostics->report(g, diagnostic(d));
 				deadlocks.insert(dloc, d);
 			}
 
-			simulations.back().exec.merge_errors(sim.exec);
+			if (not simulations.empty())
+				simulations.back().exec->merge_errors(exec);
 		}
 
 		//count++;
 	}
 
-	if (report_progress)
-		done_progress();
+	monitor.finish(states.size());
 
+	deferred.flush(g);
 	return result;
 }
 
+graph to_state_graph(graph &g, bool report_progress) {
+	elaborate_config config;
+	config.report_progress = report_progress;
+	return to_state_graph(g, config);
+}
+
 struct firing {
 	boolean::cube guard;
 	term_index action;
@@ -406,9 +1820,18 @@ cycle get_cycle(graph &g, simulator &sim) {
 	return result;
 }
 
+// The most finished frames that get_cycles() holds on to for reuse.
+const size_t cycle_spare_frames = 64;
+
 vector<cycle> get_cycles(graph &g, bool report_progress) {
+	history_scope histories;
+	scratch_scope scratch;
 	vector<cycle> result;
 	list<frame> frames;
+	// Finished frames are spliced in here instead of being destroyed so that
+	// their nodes, simulators, and index arrays can be reused by new frames.
+	// Only the last cycle_spare_frames of them are kept.
+	list<frame> spare;
 	//hashtable<state, 200> states;
 	for (int i = 0; i < (int)g.reset.size(); i++) {
 		frames.push_back(frame(simulator(&g, g.reset[i])));
@@ -425,8 +1848,11 @@ vector<cycle> get_cycles(graph &g, bool report_progress) {
 				indices[j] += i->indices[j];*/
 
 		//cout << "Iteration " << iteration << ": " << frames.size() << " frames left" << endl;
-		frame curr = frames.front();
-		frames.pop_front();
+		while (spare.size() >= cycle_spare_frames) {
+			spare.pop_back();
+		}
+		spare.splice(spare.begin(), frames, frames.begin());
+		frame &curr = spare.front();
 
 		/*for (int i = 0; i < (int)curr.indices.size(); i++)
 			cout << curr.indices[i] << " ";
@@ -534,7 +1960,12 @@ vector<cycle> get_cycles(graph &g, bool report_progress) {
 				} else { // if (!states.contains(t.loc))
 					//states.insert(t.loc);
 					excluded = possible[index[2]];
-					frames.push_back(curr);
+					if (spare.size() > 1) {
+						frames.splice(frames.end(), spare, std::prev(spare.end()));
+						frames.back() = curr;
+					} else {
+						frames.push_back(curr);
+					}
 					frames.back().part.firings.push_back(t);
 					frames.back().sim.fire(index[2]);
 
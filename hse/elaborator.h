@@ -7,13 +7,164 @@
 
 #include "graph.h"
 #include "simulator.h"
+#include "state_table.h"
+
+#include <functional>
 
 #ifndef elaborator_h
 #define elaborator_h
 
 namespace hse
 {
+	// A snapshot of how an exploration is going. See elaborate_config::monitor.
+	struct elaborate_stats
+	{
+		elaborate_stats();
+		~elaborate_stats();
+
+		// Seconds since the exploration started, and whether it has finished.
+		double elapsed;
+		bool done;
+
+		// Distinct states visited and successors that were already visited.
+		size_t states;
+		size_t revisits;
+
+		// New states checked for subsumption and the ones that were skipped.
+		size_t checked;
+		size_t pruned;
+
+		// Pending simulations now and at most.
+		size_t frontier;
+		size_t peak_frontier;
+
+		// The load of the in-memory visited table and the bytes of visited states.
+		double load;
+		size_t bytes;
+
+		// Seconds in enabled(), fire(), and the visited set.
+		double enabled_seconds;
+		double fire_seconds;
+		double hash_seconds;
+
+		double states_per_second() const;
+		double revisit_ratio() const;
+		double bytes_per_state() const;
+
+		// A single line JSON object with all of the above.
+		string to_json() const;
+	};
+
+	// The knobs of elaborate(). The defaults are the serial depth first search.
+	struct elaborate_config
+	{
+		elaborate_config();
+		elaborate_config(bool annotate_ghosts, bool record_predicates, bool report_progress);
+		~elaborate_config();
+
+		bool annotate_ghosts;
+		bool record_predicates;
+		bool report_progress;
+
+		// The number of work stealing threads, 0 for one per core.
+		int threads;
+
+		// Bytes of visited states and pending simulations to keep in memory
+		// before spilling to spill_directory, 0 for no limit.
+		size_t visited_budget;
+		size_t frontier_budget;
+		string spill_directory;
+
+		// Skip interleavings that can't change any predicate, see find_reducible().
+		bool reduce;
+
+		// Skip states covered by a visited state, see subsumption_index.
+		bool subsume;
+
+		// Reuse simulators and scratch memory, see simulator_pool and scratch_scope.
+		bool recycle;
+
+		enum {
+			EXPLICIT = 0,
+			SYMBOLIC = 1
+		};
+
+		// The backend, see symbolic.h.
+		int engine;
+
+		// Receives the statistics every progress_interval seconds and at the end.
+		std::function<void(const elaborate_stats &)> monitor;
+		string stats_path;
+		double progress_interval;
+
+		// Save the exploration here every checkpoint_interval seconds, see resume_elaborate().
+		string checkpoint_path;
+		double checkpoint_interval;
+
+		// Where errors go, see diagnostic.h. Null holds them until the end.
+		diagnostic_sink *diagnostics;
+	};
+
+	// A single state in the reachable state graph kept by elaborate_cache.
+	struct cached_state
+	{
+		cached_state();
+		~cached_state();
+
+		// The offset of this state in elaborate_cache::states.
+		uint32_t offset;
+
+		// The successors of this state, indexed into elaborate_cache::nodes.
+		vector<int> next;
+
+		// What this state recorded into each place before masking.
+		vector<int> places;
+		vector<boolean::cover> predicate;
+		vector<boolean::cover> effective;
+
+		bool deadlock;
+	};
+
+	// The reachable state graph of the last elaboration and the graph it came from.
+	struct elaborate_cache
+	{
+		elaborate_cache();
+		~elaborate_cache();
+
+		state_table states;
+		vector<cached_state> nodes;
+
+		// The snapshot of the graph, nets at or above nets are new.
+		int nets;
+		vector<bool> place_valid;
+		vector<vector<int> > place_prev;
+		vector<vector<int> > place_next;
+		vector<bool> transition_valid;
+		vector<vector<int> > transition_prev;
+		vector<vector<int> > transition_next;
+		vector<boolean::cover> assume;
+		vector<boolean::cover> guard;
+		vector<boolean::cover> local_action;
+		vector<boolean::cover> remote_action;
+
+		// Returns the index of the node for s, adding one if s is new.
+		int insert(const state &s, bool *inserted = nullptr);
+
+		void snapshot(const graph &g);
+		vector<bool> affected(const graph &g) const;
+		vector<bool> reusable(const graph &g);
+		void clear();
+	};
+
+	void elaborate(graph &g, const elaborate_config &config);
+
+	// Continue from a checkpoint, false if it can't be read or is for another graph.
+	bool resume_elaborate(graph &g, string path, const elaborate_config &config = elaborate_config());
+
+	// Elaborate g, reusing the states in cache that the changes to g can't reach.
+	void elaborate(graph &g, const elaborate_config &config, elaborate_cache &cache);
 	void elaborate(graph &g, bool annotate_ghosts = false, bool record_predicates = true, bool report_progress = false);
+	graph to_state_graph(graph &g, const elaborate_config &config);
 	graph to_state_graph(graph &g, bool report_progress = false);
 	graph to_petri_net(graph &g, bool report_progress = false);
 }
@@ -791,6 +791,7 @@ void encoder::insert_state_variable(bool debug) {
 	// states, but I can't seem to pin it down.
 	base->erase_redundant();
 	base->update_masks();
+	base->update_arc_index();
 
 	// TODO(edward.bingham) Update the predicate space and conflicts without
 	// re-elaborating the whole state space. This is not required, it is an
@@ -867,6 +868,11 @@ bool encoder::insert_state_variables(int max_count, bool senseless, bool report_
 		}
 	}
 
+	// Each insertion only changes the graph around the new transitions, so
+	// every elaboration after the first reuses the parts of the state space
+	// that can't reach those changes.
+	elaborate_cache cache;
+
 	int count = 0;
 	for (int i = 0; i < max_count and not conflicts.empty(); i++) {
 		Timer tmri;
@@ -878,7 +884,7 @@ bool encoder::insert_state_variables(int max_count, bool senseless, bool report_
 
 		float insertDelay = tmri.since();
 		tmri.reset();
-		elaborate(*base, true, true, false);
+		elaborate(*base, elaborate_config(true, true, false), cache);
 
 		float elabDelay = tmri.since();
 
@@ -223,6 +223,8 @@ string net::to_string() const {
 
 graph::graph()
 {
+	revision = 0;
+	indexed_revision = ~0ull;
 }
 
 graph::~graph()
@@ -323,6 +325,7 @@ void graph::setGhost(int uid) {
 		nets[uid].is_ghost = true;
 		ghost_nets.push_back(uid);
 		sort(ghost_nets.begin(), ghost_nets.end());
+		modified();
 	}
 }
 
@@ -342,6 +345,7 @@ int graph::create(net n) {
 	if (nets.back().is_ghost) {
 		ghost_nets.push_back(uid);
 	}
+	modified();
 	return uid;
 }
 
@@ -360,6 +364,7 @@ void graph::connect_remote(int from, int to) {
 	sort(nets[from].remote.begin(), nets[from].remote.end());
 	nets[from].remote.erase(unique(nets[from].remote.begin(), nets[from].remote.end()), nets[from].remote.end());
 	nets[to].remote = nets[from].remote;
+	modified();
 }
 
 /**
@@ -393,6 +398,11 @@ vector<vector<int> > graph::remote_groups() {
  * @return Reference to the transition
  */
 hse::transition &graph::at(term_index idx) {
+	modified();
+	return transitions[idx.index];
+}
+
+const hse::transition &graph::at(term_index idx) const {
 	return transitions[idx.index];
 }
 
@@ -403,6 +413,11 @@ hse::transition &graph::at(term_index idx) {
  * @return Reference to the term (boolean cube)
  */
 boolean::cube &graph::term(term_index idx) {
+	modified();
+	return transitions[idx.index].local_action[idx.term];
+}
+
+const boolean::cube &graph::term(term_index idx) const {
 	return transitions[idx.index].local_action[idx.term];
 }
 
@@ -458,6 +473,7 @@ Mapping<petri::iterator> graph::merge(graph g) {
 	}
 
 	// Remap all expressions to new variables
+	modified();
 	return super::merge(g);
 }
 
@@ -756,6 +772,67 @@ void graph::update_masks() {
 	}
 }
 
+/**
+ * @brief Rebuild the index of arcs by place and by transition
+ * 
+ * This is a counting sort of arcs[place::type] by source place and by
+ * destination transition. Within each group, the arcs stay in the same order
+ * they have in arcs[place::type]. Since this is called whenever the graph
+ * changes, it also calls modified() so that the next simulator
+ * builds a new one.
+ */
+void graph::update_arc_index() {
+	const vector<petri::arc> &in = arcs[petri::place::type];
+
+	place_offset.assign(places.size()+1, 0);
+	transition_offset.assign(transitions.size()+1, 0);
+	for (int i = 0; i < (int)in.size(); i++) {
+		place_offset[in[i].from.index+1]++;
+		transition_offset[in[i].to.index+1]++;
+	}
+	for (int i = 1; i < (int)place_offset.size(); i++) {
+		place_offset[i] += place_offset[i-1];
+	}
+	for (int i = 1; i < (int)transition_offset.size(); i++) {
+		transition_offset[i] += transition_offset[i-1];
+	}
+
+	place_arcs.resize(in.size());
+	transition_arcs.resize(in.size());
+	vector<int> place_fill(place_offset.begin(), place_offset.end()-1);
+	vector<int> transition_fill(transition_offset.begin(), transition_offset.end()-1);
+	for (int i = 0; i < (int)in.size(); i++) {
+		place_arcs[place_fill[in[i].from.index]++] = i;
+		transition_arcs[transition_fill[in[i].to.index]++] = i;
+	}
+
+	modified();
+	indexed_revision = revision;
+}
+
+/**
+ * @brief Record a change to the graph
+ * 
+ * Bumps the revision so that any compiled snapshot of the graph no longer
+ * matches it, and drops the cached snapshot.
+ */
+void graph::modified() {
+	revision++;
+	compiled.reset();
+}
+
+/**
+ * @brief Check whether the arc index matches the current graph
+ * 
+ * The index is stale as soon as anything calls modified(), see revision.
+ */
+bool graph::arc_index_ready() const {
+	return indexed_revision == revision
+		and (int)place_arcs.size() == (int)arcs[petri::place::type].size()
+		and (int)place_offset.size() == (int)places.size()+1
+		and (int)transition_offset.size() == (int)transitions.size()+1;
+}
+
 /**
  * @brief Post-process the graph to optimize and validate its structure
  * 
@@ -968,6 +1045,7 @@ void graph::post_process(bool proper_nesting, bool aggressive, bool annotate, bo
 
 	// Determine the actual starting location of the tokens given the state information
 	update_masks();
+	update_arc_index();
 }
 
 /**
@@ -1120,6 +1198,7 @@ void graph::annotate_conditional_branches() {
 			}
 		}
 	}
+	modified();
 }
 
 }
@@ -7,9 +7,13 @@
 
 #include "state.h"
 
+#include <memory>
+
 namespace hse
 {
 
+struct compiled_graph;
+
 const string ghost_prefix = "__b";
 
 using petri::iterator;
@@ -178,15 +182,68 @@ struct graph : petri::graph<hse::place, hse::transition, petri::token, hse::stat
 
 	void setGhost(int uid);
 
-	using super::create;
 	int create(net n = net());
 
+	// The mutators of petri::graph, wrapped so that every edit to the
+	// structure of the graph calls modified().
+	template <typename... Args>
+	decltype(auto) create(Args&&... args) {
+		modified();
+		return super::create(std::forward<Args>(args)...);
+	}
+
+	template <typename... Args>
+	decltype(auto) connect(Args&&... args) {
+		modified();
+		return super::connect(std::forward<Args>(args)...);
+	}
+
+	template <typename... Args>
+	decltype(auto) erase_arc(Args&&... args) {
+		modified();
+		return super::erase_arc(std::forward<Args>(args)...);
+	}
+
+	template <typename... Args>
+	decltype(auto) pinch(Args&&... args) {
+		modified();
+		return super::pinch(std::forward<Args>(args)...);
+	}
+
+	template <typename... Args>
+	decltype(auto) insert_at(Args&&... args) {
+		modified();
+		return super::insert_at(std::forward<Args>(args)...);
+	}
+
+	template <typename... Args>
+	decltype(auto) duplicate(Args&&... args) {
+		modified();
+		return super::duplicate(std::forward<Args>(args)...);
+	}
+
+	template <typename... Args>
+	decltype(auto) erase_redundant(Args&&... args) {
+		modified();
+		return super::erase_redundant(std::forward<Args>(args)...);
+	}
+
+	template <typename... Args>
+	decltype(auto) reduce(Args&&... args) {
+		modified();
+		return super::reduce(std::forward<Args>(args)...);
+	}
+
 	void connect_remote(int from, int to);
 	vector<vector<int> > remote_groups();
 	string getNetName(int uid) const;
 
+	// The non-const versions hand out a reference that may be written
+	// through, so they call modified().
 	hse::transition &at(term_index idx);
+	const hse::transition &at(term_index idx) const;
 	boolean::cube &term(term_index idx);
+	const boolean::cube &term(term_index idx) const;
 
 	using super::merge;
 	virtual Mapping<petri::iterator> merge(graph g);
@@ -202,6 +259,36 @@ struct graph : petri::graph<hse::place, hse::transition, petri::token, hse::stat
 
 	void update_masks();
 
+	// An index of the arcs in arcs[place::type] by their endpoints so that the
+	// simulator can find the transitions that consume from a marked place
+	// without scanning every arc in the graph. The arcs out of place i are
+	// place_arcs[place_offset[i]] through place_arcs[place_offset[i+1]-1] and
+	// the arcs into transition i are found the same way through
+	// transition_offset and transition_arcs. Both hold indices into
+	// arcs[place::type] in increasing order. The index must be rebuilt with
+	// update_arc_index() after the arcs are modified. indexed_revision is the
+	// revision it was built at.
+	vector<int> place_offset;
+	vector<int> place_arcs;
+	vector<int> transition_offset;
+	vector<int> transition_arcs;
+	uint64_t indexed_revision;
+
+	void update_arc_index();
+	bool arc_index_ready() const;
+
+	// The snapshot of this graph that simulators read from, see compile() in
+	// compiled.h. update_arc_index() clears it.
+	std::shared_ptr<const compiled_graph> compiled;
+
+	// Counts the changes to this graph so that the arc index and the snapshot
+	// can tell whether they are stale, see compiled_graph::matches(). Every
+	// mutator of this class calls modified(). Code that writes to the nodes
+	// directly, through places[] or transitions[], must call it as well.
+	uint64_t revision;
+
+	void modified();
+
 	void post_process(bool proper_nesting = false, bool aggressive = false, bool annotate=true, bool debug=false);
 	void check_variables();
 	vector<petri::iterator> relevant_nodes(vector<petri::iterator> i);
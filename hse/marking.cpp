@@ -0,0 +1,179 @@
+#include "marking.h"
+
+#include <common/message.h>
+#include <bit>
+
+namespace hse
+{
+
+marking::marking()
+{
+}
+
+marking::marking(int places)
+{
+	words.resize((places+63)/64, 0);
+}
+
+marking::marking(const vector<petri::token> &tokens, int places)
+{
+	words.resize((places+63)/64, 0);
+	for (auto i = tokens.begin(); i != tokens.end(); i++) {
+		set(i->index);
+	}
+}
+
+marking::~marking()
+{
+}
+
+void marking::set(int place)
+{
+	if (place < 0) {
+		internal("", "negative place index in marking", __FILE__, __LINE__);
+		return;
+	}
+
+	if (place/64 >= (int)words.size()) {
+		words.resize(place/64+1, 0);
+	}
+	words[place/64] |= 1ull << (place%64);
+}
+
+void marking::unset(int place)
+{
+	if (place >= 0 and place/64 < (int)words.size()) {
+		words[place/64] &= ~(1ull << (place%64));
+	}
+}
+
+bool marking::has(int place) const
+{
+	return place >= 0 and place/64 < (int)words.size()
+		and ((words[place/64] >> (place%64)) & 1) != 0;
+}
+
+int marking::count() const
+{
+	int result = 0;
+	for (auto w = words.begin(); w != words.end(); w++) {
+		result += std::popcount(*w);
+	}
+	return result;
+}
+
+bool marking::empty() const
+{
+	for (auto w = words.begin(); w != words.end(); w++) {
+		if (*w != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+vector<petri::token> marking::tokens() const
+{
+	vector<petri::token> result;
+	for (int i = 0; i < (int)words.size(); i++) {
+		uint64_t w = words[i];
+		while (w != 0) {
+			result.push_back(petri::token(i*64 + std::countr_zero(w)));
+			w &= w-1;
+		}
+	}
+	return result;
+}
+
+bool marking::is_subset_of(const marking &m) const
+{
+	for (int i = 0; i < (int)words.size(); i++) {
+		uint64_t other = i < (int)m.words.size() ? m.words[i] : 0;
+		if ((words[i] & ~other) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Trailing zero words are skipped so that the hash doesn't depend on the
+// number of places the marking was sized for.
+uint64_t marking::hash() const
+{
+	int size = (int)words.size();
+	while (size > 0 and words[size-1] == 0) {
+		size--;
+	}
+
+	uint64_t result = 0xcbf29ce484222325ull;
+	for (int i = 0; i < size; i++) {
+		result = (result ^ words[i]) * 0x100000001b3ull;
+	}
+	return result;
+}
+
+marking &marking::operator|=(const marking &m)
+{
+	if (m.words.size() > words.size()) {
+		words.resize(m.words.size(), 0);
+	}
+	for (int i = 0; i < (int)m.words.size(); i++) {
+		words[i] |= m.words[i];
+	}
+	return *this;
+}
+
+marking &marking::operator&=(const marking &m)
+{
+	for (int i = 0; i < (int)words.size(); i++) {
+		words[i] &= i < (int)m.words.size() ? m.words[i] : 0;
+	}
+	return *this;
+}
+
+marking operator|(marking m0, const marking &m1)
+{
+	m0 |= m1;
+	return m0;
+}
+
+marking operator&(marking m0, const marking &m1)
+{
+	m0 &= m1;
+	return m0;
+}
+
+bool operator==(const marking &m0, const marking &m1)
+{
+	int size = (int)max(m0.words.size(), m1.words.size());
+	for (int i = 0; i < size; i++) {
+		uint64_t w0 = i < (int)m0.words.size() ? m0.words[i] : 0;
+		uint64_t w1 = i < (int)m1.words.size() ? m1.words[i] : 0;
+		if (w0 != w1) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool operator!=(const marking &m0, const marking &m1)
+{
+	return not (m0 == m1);
+}
+
+// This orders markings by their words from the lowest places up, which is
+// all that the ordered containers need.
+bool operator<(const marking &m0, const marking &m1)
+{
+	int size = (int)max(m0.words.size(), m1.words.size());
+	for (int i = 0; i < size; i++) {
+		uint64_t w0 = i < (int)m0.words.size() ? m0.words[i] : 0;
+		uint64_t w1 = i < (int)m1.words.size() ? m1.words[i] : 0;
+		if (w0 != w1) {
+			return w0 < w1;
+		}
+	}
+	return false;
+}
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <common/standard.h>
+#include <petri/state.h>
+
+namespace hse
+{
+
+// The set of marked places of a safe net, one bit per place. This holds the
+// same information as the sorted token vector of a state with no place marked
+// twice, but equality, hashing, subset tests, and union work on whole words
+// instead of walking two vectors. Bits past the end of words are unmarked,
+// so two markings sized for different numbers of places still compare equal
+// when they mark the same places.
+struct marking
+{
+	marking();
+	marking(int places);
+	marking(const vector<petri::token> &tokens, int places = 0);
+	~marking();
+
+	vector<uint64_t> words;
+
+	void set(int place);
+	void unset(int place);
+	bool has(int place) const;
+	int count() const;
+	bool empty() const;
+
+	// Convert back to a sorted token vector.
+	vector<petri::token> tokens() const;
+
+	bool is_subset_of(const marking &m) const;
+	uint64_t hash() const;
+
+	marking &operator|=(const marking &m);
+	marking &operator&=(const marking &m);
+};
+
+marking operator|(marking m0, const marking &m1);
+marking operator&(marking m0, const marking &m1);
+
+bool operator==(const marking &m0, const marking &m1);
+bool operator!=(const marking &m0, const marking &m1);
+bool operator<(const marking &m0, const marking &m1);
+
+}
+
+namespace std {
+
+template<> struct hash<hse::marking> {
+	std::size_t operator()(const hse::marking& m) const noexcept {
+		return (std::size_t)m.hash();
+	}
+};
+
+}
@@ -0,0 +1,125 @@
+#include "monitor.h"
+
+#include <common/message.h>
+
+namespace hse
+{
+
+elaborate_monitor::elaborate_monitor(const elaborate_config &config, bool show_progress) : config(config)
+{
+	this->show_progress = show_progress;
+	timed = config.monitor or not config.stats_path.empty();
+	mark = 0.0;
+	last = 0.0;
+	steps = 0;
+	fptr = nullptr;
+	if (not config.stats_path.empty()) {
+		fptr = fopen(config.stats_path.c_str(), "a");
+		if (fptr == nullptr) {
+			error("", "unable to open '" + config.stats_path + "' for elaboration statistics", __FILE__, __LINE__);
+		}
+	}
+}
+
+elaborate_monitor::~elaborate_monitor()
+{
+	if (fptr != nullptr) {
+		fclose(fptr);
+		fptr = nullptr;
+	}
+}
+
+bool elaborate_monitor::active() const
+{
+	return timed or show_progress;
+}
+
+void elaborate_monitor::lap(double *section)
+{
+	if (not timed) {
+		return;
+	}
+
+	double now = timer.since();
+	if (section != nullptr) {
+		*section += now - mark;
+	}
+	mark = now;
+}
+
+void elaborate_monitor::visit(bool inserted)
+{
+	if (not inserted) {
+		stats.revisits++;
+	}
+}
+
+void elaborate_monitor::step(size_t states, size_t frontier, const state_table &table, size_t bytes)
+{
+	stats.states = states;
+	stats.frontier = frontier;
+	stats.peak_frontier = max(stats.peak_frontier, frontier);
+
+	// Checking the clock on every step costs more than the step itself for
+	// small designs.
+	if ((++steps & 0xFF) != 0 or not active()) {
+		return;
+	}
+
+	if (due()) {
+		report(states, frontier, table.slots.empty() ? 0.0 : (double)table.size()/(double)table.slots.size(), bytes);
+	}
+}
+
+bool elaborate_monitor::due()
+{
+	if (not active()) {
+		return false;
+	}
+
+	stats.elapsed = timer.since();
+	return stats.elapsed - last >= config.progress_interval;
+}
+
+void elaborate_monitor::report(size_t states, size_t frontier, double load, size_t bytes)
+{
+	stats.elapsed = timer.since();
+	last = stats.elapsed;
+	stats.states = states;
+	stats.frontier = frontier;
+	stats.peak_frontier = max(stats.peak_frontier, frontier);
+	stats.load = load;
+	stats.bytes = bytes;
+	emit();
+}
+
+void elaborate_monitor::finish(size_t states)
+{
+	stats.states = states;
+	stats.frontier = 0;
+	stats.elapsed = timer.since();
+	stats.done = true;
+	emit();
+	if (show_progress) {
+		done_progress();
+	}
+}
+
+void elaborate_monitor::emit()
+{
+	if (config.monitor) {
+		config.monitor(stats);
+	}
+	if (fptr != nullptr) {
+		fprintf(fptr, "%s\n", stats.to_json().c_str());
+		fflush(fptr);
+	}
+	if (show_progress and not stats.done) {
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "%zu states %.0f/s, frontier %zu (peak %zu), %.0f%% revisits, %.0f bytes/state",
+			stats.states, stats.states_per_second(), stats.frontier, stats.peak_frontier, 100.0*stats.revisit_ratio(), stats.bytes_per_state());
+		progress("", buffer, __FILE__, __LINE__);
+	}
+}
+
+}
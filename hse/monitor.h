@@ -0,0 +1,59 @@
+#pragma once
+
+#include <common/standard.h>
+#include <common/timer.h>
+#include "elaborator.h"
+#include "state_table.h"
+
+namespace hse
+{
+
+// Collects the elaborate_stats for one exploration and hands them to the
+// monitor callback, the stats file, and the progress line every
+// progress_interval seconds. Every explorer reports through one of these.
+// It is not thread safe, so the parallel explorer only touches it from the
+// thread that started the workers.
+struct elaborate_monitor
+{
+	elaborate_monitor(const elaborate_config &config, bool show_progress);
+	~elaborate_monitor();
+
+	const elaborate_config &config;
+	bool show_progress;
+
+	// Whether to measure the time spent in enabled(), fire(), and hashing.
+	// Reading the clock around every call isn't free.
+	bool timed;
+
+	elaborate_stats stats;
+	Timer timer;
+	double mark;
+	double last;
+	size_t steps;
+	FILE *fptr;
+
+	// Whether anything is listening, if not there is no point in gathering
+	// the statistics.
+	bool active() const;
+
+	// Add the time since the last call to lap() to section, which may be
+	// null to just restart the clock.
+	void lap(double *section);
+
+	// Count a successor, inserted is whether it was new.
+	void visit(bool inserted);
+
+	// Called once per simulation popped off the frontier.
+	void step(size_t states, size_t frontier, const state_table &table, size_t bytes);
+
+	// Whether progress_interval seconds have passed since the last report.
+	bool due();
+
+	// Fill in the rest of the statistics and hand them out.
+	void report(size_t states, size_t frontier, double load, size_t bytes);
+
+	void finish(size_t states);
+	void emit();
+};
+
+}
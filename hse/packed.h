@@ -0,0 +1,139 @@
+#pragma once
+
+#include <common/standard.h>
+#include <boolean/cube.h>
+
+#include <bit>
+
+namespace hse
+{
+
+// A cube of at most 32*W nets packed into W 64 bit words with no heap
+// storage. The words hold the 32 bit words of boolean::cube::values two at a
+// time, so every net keeps the same two bit code it has in boolean::cube, and
+// nets past the end are don't-cares. This covers the common case of a
+// process with at most 64 or 128 nets, where comparing two encodings is a
+// handful of word operations instead of a walk over two vectors.
+//
+// The only user is simulator::invalidate(), which diffs the encodings
+// against those of the last call to enabled() to find the guard checks to
+// forget, see simulator::packed_diff. This is not a packed state
+// representation: simulator::encoding, simulator::global, and
+// state::encodings stay boolean::cube, and guard checks and assignments go
+// through the boolean library, so the elaborator never takes this path.
+template <int W>
+struct packed_cube
+{
+	packed_cube()
+	{
+		for (int i = 0; i < W; i++) {
+			words[i] = ~0ull;
+		}
+	}
+
+	packed_cube(const boolean::cube &c)
+	{
+		pack(c);
+	}
+
+	~packed_cube()
+	{
+	}
+
+	uint64_t words[W];
+
+	static bool fits(int nets)
+	{
+		return nets <= 32*W;
+	}
+
+	// Returns false if c assigns a net that doesn't fit, in which case the
+	// packed cube only holds the nets that do.
+	bool pack(const boolean::cube &c)
+	{
+		int size = (int)c.values.size();
+		for (int i = 0; i < W; i++) {
+			uint64_t lo = 2*i < size ? c.values[2*i] : 0xFFFFFFFFu;
+			uint64_t hi = 2*i+1 < size ? c.values[2*i+1] : 0xFFFFFFFFu;
+			words[i] = lo | (hi << 32);
+		}
+
+		for (int i = 2*W; i < size; i++) {
+			if (c.values[i] != 0xFFFFFFFFu) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	boolean::cube unpack() const
+	{
+		boolean::cube result;
+		result.values.resize(2*W);
+		for (int i = 0; i < W; i++) {
+			result.values[2*i] = (unsigned int)(words[i] & 0xFFFFFFFFu);
+			result.values[2*i+1] = (unsigned int)(words[i] >> 32);
+		}
+		while (not result.values.empty() and result.values.back() == 0xFFFFFFFFu) {
+			result.values.pop_back();
+		}
+		return result;
+	}
+
+	packed_cube &operator&=(const packed_cube &c)
+	{
+		for (int i = 0; i < W; i++) {
+			words[i] &= c.words[i];
+		}
+		return *this;
+	}
+
+	packed_cube operator&(const packed_cube &c) const
+	{
+		packed_cube result = *this;
+		result &= c;
+		return result;
+	}
+
+	bool operator==(const packed_cube &c) const
+	{
+		for (int i = 0; i < W; i++) {
+			if (words[i] != c.words[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool operator!=(const packed_cube &c) const
+	{
+		return not (*this == c);
+	}
+
+	bool is_subset_of(const packed_cube &c) const
+	{
+		for (int i = 0; i < W; i++) {
+			if ((words[i] & c.words[i]) != words[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Call f with every net whose value differs between this cube and c, in
+	// increasing order.
+	template <typename F>
+	void for_each_change(const packed_cube &c, F f) const
+	{
+		for (int i = 0; i < W; i++) {
+			uint64_t diff = words[i] ^ c.words[i];
+			while (diff != 0) {
+				int bit = std::countr_zero(diff) & ~1;
+				f(32*i + bit/2);
+				diff &= ~(3ull << bit);
+			}
+		}
+	}
+};
+
+}
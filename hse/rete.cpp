@@ -0,0 +1,298 @@
+#include "rete.h"
+#include "diagnostic.h"
+#include <common/message.h>
+
+namespace hse
+{
+
+rete_production::rete_production()
+{
+	transition = -1;
+	missing = 0;
+}
+
+rete_production::rete_production(int transition, int literals)
+{
+	this->transition = transition;
+	this->missing = literals;
+}
+
+rete_production::~rete_production()
+{
+}
+
+rete_simulator::rete_simulator()
+{
+	base = nullptr;
+	diagnostics = nullptr;
+}
+
+rete_simulator::rete_simulator(graph *base, state initial)
+{
+	this->base = base;
+	this->diagnostics = nullptr;
+	if (base == nullptr) {
+		return;
+	}
+
+	int places = (int)base->places.size();
+	int transitions = (int)base->transitions.size();
+	int nets = base->netCount();
+
+	inputs.resize(transitions);
+	outputs.resize(transitions);
+	alpha.resize(places + 2*nets);
+	satisfied.resize(transitions, 0);
+	position.resize(transitions, -1);
+
+	// The working memory has to be sized before the productions are compiled
+	// since literal() places the net literals after the place literals.
+	marking.resize(places, 0);
+	values.resize(nets, 2);
+
+	// Compile the guard and assumption of each transition into productions.
+	for (int i = 0; i < transitions; i++) {
+		if (not base->transitions.is_valid(i)) continue;
+
+		inputs[i] = base->prev(transition::type, i);
+		outputs[i] = base->next(transition::type, i);
+		sort(inputs[i].begin(), inputs[i].end());
+		inputs[i].erase(unique(inputs[i].begin(), inputs[i].end()), inputs[i].end());
+
+		boolean::cover condition = base->transitions[i].guard & base->transitions[i].assume;
+		for (auto c = condition.cubes.begin(); c != condition.cubes.end(); c++) {
+			vector<int> literals = inputs[i];
+			vector<int> vars = c->vars();
+			bool feasible = true;
+			for (auto v = vars.begin(); v != vars.end() and feasible; v++) {
+				int value = c->get(*v);
+				if (value == 0 or value == 1) {
+					literals.push_back(literal(*v, value));
+				} else if (value < 0) {
+					feasible = false;
+				}
+			}
+			if (not feasible) continue;
+
+			sort(literals.begin(), literals.end());
+			literals.erase(unique(literals.begin(), literals.end()), literals.end());
+
+			int id = (int)productions.size();
+			productions.push_back(rete_production(i, (int)literals.size()));
+			for (auto l = literals.begin(); l != literals.end(); l++) {
+				alpha[*l].push_back(id);
+			}
+
+			if (literals.empty()) {
+				if (satisfied[i]++ == 0) {
+					position[i] = (int)active.size();
+					active.push_back(i);
+				}
+			}
+		}
+	}
+
+	// Load the initial state into the working memory.
+	for (auto t = initial.tokens.begin(); t != initial.tokens.end(); t++) {
+		set_marking(t->index, marking[t->index]+1);
+	}
+
+	boolean::cube encoding = initial.encodings.supercube();
+	for (int v = 0; v < nets; v++) {
+		set_value(v, encoding.get(v));
+	}
+}
+
+rete_simulator::~rete_simulator()
+{
+}
+
+int rete_simulator::literal(int net, int value) const
+{
+	return (int)marking.size() + 2*net + value;
+}
+
+void rete_simulator::assert_literal(int lit)
+{
+	for (auto p = alpha[lit].begin(); p != alpha[lit].end(); p++) {
+		if (--productions[*p].missing == 0) {
+			int t = productions[*p].transition;
+			if (satisfied[t]++ == 0) {
+				position[t] = (int)active.size();
+				active.push_back(t);
+			}
+		}
+	}
+}
+
+void rete_simulator::retract_literal(int lit)
+{
+	for (auto p = alpha[lit].begin(); p != alpha[lit].end(); p++) {
+		if (productions[*p].missing++ == 0) {
+			int t = productions[*p].transition;
+			if (--satisfied[t] == 0) {
+				active[position[t]] = active.back();
+				position[active.back()] = position[t];
+				active.pop_back();
+				position[t] = -1;
+
+				// A net changed under an enabled transition that still has
+				// all of its tokens.
+				bool marked = lit >= (int)marking.size();
+				for (auto i = inputs[t].begin(); i != inputs[t].end() and marked; i++) {
+					marked = marking[*i] > 0;
+				}
+				if (marked) {
+					sink().report(*base, diagnostic(instability(enabled_transition(t))));
+				}
+			}
+		}
+	}
+}
+
+void rete_simulator::set_marking(int place, int count)
+{
+	if (marking[place] == 0 and count > 0) {
+		marking[place] = count;
+		assert_literal(place);
+	} else if (marking[place] > 0 and count == 0) {
+		marking[place] = count;
+		retract_literal(place);
+	} else {
+		marking[place] = count;
+	}
+}
+
+void rete_simulator::set_value(int net, int value)
+{
+	if (value != 0 and value != 1) {
+		value = 2;
+	}
+
+	if (values[net] == value) {
+		return;
+	}
+
+	if (values[net] != 2) {
+		retract_literal(literal(net, values[net]));
+	}
+	values[net] = value;
+	if (value != 2) {
+		assert_literal(literal(net, value));
+	}
+}
+
+// Returns the number of enabled terms. The ready list is sorted by transition
+// and then by term.
+int rete_simulator::enabled()
+{
+	if (base == nullptr) {
+		internal("", "NULL pointer to rete_simulator::base", __FILE__, __LINE__);
+		return 0;
+	}
+
+	vector<int> order = active;
+	sort(order.begin(), order.end());
+
+	ready.clear();
+	for (auto t = order.begin(); t != order.end(); t++) {
+		for (int j = 0; j < (int)base->transitions[*t].local_action.cubes.size(); j++) {
+			ready.push_back(pair<int, int>(*t, j));
+		}
+	}
+
+	return (int)ready.size();
+}
+
+enabled_transition rete_simulator::fire(int index)
+{
+	if (base == nullptr) {
+		internal("", "NULL pointer to rete_simulator::base", __FILE__, __LINE__);
+		return enabled_transition();
+	}
+
+	int t = ready[index].first;
+	int term = ready[index].second;
+	const boolean::cube &action = base->transitions[t].local_action.cubes[term];
+
+	enabled_transition result(t);
+	result.vacuous = true;
+	vector<int> vars = action.vars();
+	for (auto v = vars.begin(); v != vars.end(); v++) {
+		int value = action.get(*v);
+		if ((value == 0 or value == 1) and values[*v] != value) {
+			result.vacuous = false;
+		}
+	}
+	if (result.vacuous) {
+		sink().report(*base, diagnostic("rete_simulator fired T" + ::to_string(t) + " as a step, but it is vacuous"));
+	}
+
+	// Any other enabled transition on separate tokens that drives a net the
+	// other way interferes with this one.
+	for (auto u = active.begin(); u != active.end(); u++) {
+		if (*u == t) continue;
+
+		bool shared = false;
+		for (auto p = inputs[*u].begin(); p != inputs[*u].end() and not shared; p++) {
+			shared = binary_search(inputs[t].begin(), inputs[t].end(), *p);
+		}
+		if (shared) continue;
+
+		const boolean::cover &other = base->transitions[*u].local_action;
+		for (int j = 0; j < (int)other.cubes.size(); j++) {
+			bool opposed = false;
+			for (auto v = vars.begin(); v != vars.end() and not opposed; v++) {
+				int x = action.get(*v);
+				int y = other.cubes[j].get(*v);
+				opposed = (x == 0 and y == 1) or (x == 1 and y == 0);
+			}
+			if (opposed) {
+				sink().report(*base, diagnostic(interference(term_index(t, term), term_index(*u, j))));
+			}
+		}
+	}
+
+	for (auto p = inputs[t].begin(); p != inputs[t].end(); p++) {
+		set_marking(*p, marking[*p]-1);
+	}
+	for (auto p = outputs[t].begin(); p != outputs[t].end(); p++) {
+		set_marking(*p, marking[*p]+1);
+	}
+
+	for (auto v = vars.begin(); v != vars.end(); v++) {
+		int value = action.get(*v);
+		if (value == 0 or value == 1) {
+			set_value(*v, value);
+		}
+	}
+
+	ready.clear();
+	return result;
+}
+
+diagnostic_sink &rete_simulator::sink()
+{
+	return diagnostics != nullptr ? *diagnostics : immediate_diagnostics();
+}
+
+state rete_simulator::get_state()
+{
+	vector<petri::token> tokens;
+	for (int i = 0; i < (int)marking.size(); i++) {
+		for (int j = 0; j < marking[i]; j++) {
+			tokens.push_back(petri::token(i));
+		}
+	}
+
+	boolean::cube encoding;
+	for (int v = 0; v < (int)values.size(); v++) {
+		if (values[v] != 2) {
+			encoding &= boolean::cube(v, values[v]);
+		}
+	}
+
+	return state(tokens, boolean::cover(encoding));
+}
+
+}
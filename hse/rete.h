@@ -0,0 +1,97 @@
+#pragma once
+
+#include <common/standard.h>
+#include <boolean/cube.h>
+#include <boolean/cover.h>
+#include "graph.h"
+#include "state.h"
+
+namespace hse
+{
+
+struct diagnostic_sink;
+
+// A production of the discrimination network. Each transition has one
+// production for each cube of its guard and assumption. The condition of a
+// production is that all of the input places of the transition are marked
+// and every literal in the cube holds.
+struct rete_production
+{
+	rete_production();
+	rete_production(int transition, int literals);
+	~rete_production();
+
+	int transition;
+
+	// The number of literals in the condition of this production that do not
+	// hold in the current state. The production is satisfied when this is zero.
+	int missing;
+};
+
+// This is a second simulation engine for HSE graphs that follows the IDEA in
+// simulator.h. Every place is a variable that is true when the place holds a
+// token, and every transition is a production rule. Its conditions are
+// compiled into a discrimination network in the style of the Rete algorithm.
+// There is one alpha memory per literal that is shared by every production
+// that tests it, and each production counts the literals it is still waiting
+// on. A firing only visits the productions that test the literals it
+// changed, so the work per firing is proportional to the change and not to
+// the size of the graph.
+//
+// Unlike hse::simulator, every transition is an explicit step. This engine
+// does not extend tokens through vacuous transitions and does not model
+// instability or interference. It reports all three through diagnostics
+// when they come up, so a walk that reports nothing matches hse::simulator.
+// It does not check for mutual exclusion. Every net has exactly one value,
+// there is no separate global encoding for isochronic regions.
+struct rete_simulator
+{
+	rete_simulator();
+	rete_simulator(graph *base, state initial);
+	~rete_simulator();
+
+	graph *base;
+
+	// The input and output places of each transition.
+	vector<vector<int> > inputs;
+	vector<vector<int> > outputs;
+
+	// alpha[i] lists the productions that test literal i. The first literals
+	// are "place i is marked" for each place. After those, net v has one
+	// literal for each of its values, see literal().
+	vector<vector<int> > alpha;
+	vector<rete_production> productions;
+
+	// The working memory. marking[i] is the number of tokens at place i and
+	// values[v] is the value of net v, 0, 1, or 2 if it is unknown.
+	vector<int> marking;
+	vector<int> values;
+
+	// satisfied[t] is the number of productions of transition t that are
+	// satisfied. active lists the transitions with at least one satisfied
+	// production and position[t] is the index of t in active, or -1.
+	vector<int> satisfied;
+	vector<int> active;
+	vector<int> position;
+
+	// ready[i].first is the index of an enabled transition in base->transitions
+	// and ready[i].second is the index of a cube in its local action.
+	vector<pair<int, int> > ready;
+
+	// Where the unsupported behavior is reported, see simulator::diagnostics.
+	diagnostic_sink *diagnostics;
+
+	int enabled();
+	enabled_transition fire(int index);
+	state get_state();
+
+	// Used internally
+	int literal(int net, int value) const;
+	void assert_literal(int lit);
+	void retract_literal(int lit);
+	void set_marking(int place, int count);
+	void set_value(int net, int value);
+	diagnostic_sink &sink();
+};
+
+}
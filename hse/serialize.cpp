@@ -0,0 +1,319 @@
+#include "serialize.h"
+
+namespace hse
+{
+
+byte_writer::byte_writer()
+{
+}
+
+byte_writer::~byte_writer()
+{
+}
+
+void byte_writer::clear()
+{
+	data.clear();
+}
+
+void byte_writer::write_uint(uint64_t value)
+{
+	while (value >= 0x80) {
+		data.push_back((uint8_t)(value | 0x80));
+		value >>= 7;
+	}
+	data.push_back((uint8_t)value);
+}
+
+void byte_writer::write_int(int64_t value)
+{
+	write_uint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+void byte_writer::write_bool(bool value)
+{
+	data.push_back(value ? 1 : 0);
+}
+
+void byte_writer::write(const boolean::cube &c)
+{
+	// Words at the end of the cube that are entirely don't-care are implied,
+	// drop them so that equal cubes have equal encodings.
+	int size = (int)c.values.size();
+	while (size > 0 and c.values[size-1] == 0xFFFFFFFFu) {
+		size--;
+	}
+
+	write_uint(size);
+	for (int i = 0; i < size; i++) {
+		write_uint(c.values[i]);
+	}
+}
+
+void byte_writer::write(const boolean::cover &c)
+{
+	write_uint(c.cubes.size());
+	for (auto i = c.cubes.begin(); i != c.cubes.end(); i++) {
+		write(*i);
+	}
+}
+
+// Interned covers are written out in full since their ids are only
+// meaningful within one process.
+void byte_writer::write(const interned_cover &c)
+{
+	write(c.get());
+}
+
+void byte_writer::write(const term_index &t)
+{
+	write_int(t.index);
+	write_int(t.term);
+}
+
+void byte_writer::write(const hse::token &t)
+{
+	write_int(t.index);
+	write(t.guard);
+	write(t.assume);
+	write(t.sequence);
+	write_int(t.cause);
+}
+
+void byte_writer::write(const enabled_transition &t)
+{
+	write_int(t.index);
+	write_uint(t.tokens.size());
+	for (auto i = t.tokens.begin(); i != t.tokens.end(); i++) {
+		write_int(*i);
+	}
+	write_uint(t.output_marking.size());
+	for (auto i = t.output_marking.begin(); i != t.output_marking.end(); i++) {
+		write_int(*i);
+	}
+	vector<term_index> history = t.history.to_vector();
+	write_uint(history.size());
+	for (auto i = history.begin(); i != history.end(); i++) {
+		write(*i);
+	}
+	write(t.guard_action);
+	write(t.guard);
+	write(t.depend);
+	write(t.assume);
+	write(t.sequence);
+	write_bool(t.vacuous);
+	write_bool(t.stable);
+	write_uint(t.fire_at);
+}
+
+void byte_writer::write(const state &s)
+{
+	write_uint(s.tokens.size());
+	for (auto i = s.tokens.begin(); i != s.tokens.end(); i++) {
+		write_int(i->index);
+	}
+	write(s.encodings);
+}
+
+void byte_writer::write(const simulator &sim)
+{
+	write_bool(sim.annotate_ghosts);
+
+	write_uint(sim.history.size());
+	for (auto i = sim.history.begin(); i != sim.history.end(); i++) {
+		write(i->first);
+		write(i->second);
+	}
+
+	write(sim.encoding);
+	write(sim.global);
+
+	write_uint(sim.tokens.size());
+	for (auto i = sim.tokens.begin(); i != sim.tokens.end(); i++) {
+		write(*i);
+	}
+	write_uint(sim.loaded.size());
+	for (auto i = sim.loaded.begin(); i != sim.loaded.end(); i++) {
+		write(*i);
+	}
+	write_uint(sim.ready.size());
+	for (auto i = sim.ready.begin(); i != sim.ready.end(); i++) {
+		write_int(i->first);
+		write_int(i->second);
+	}
+
+	write_uint(sim.now);
+}
+
+byte_reader::byte_reader()
+{
+	data = nullptr;
+	size = 0;
+	offset = 0;
+}
+
+byte_reader::byte_reader(const uint8_t *data, size_t size)
+{
+	this->data = data;
+	this->size = size;
+	this->offset = 0;
+}
+
+byte_reader::~byte_reader()
+{
+}
+
+bool byte_reader::done() const
+{
+	return offset >= size;
+}
+
+uint64_t byte_reader::read_uint()
+{
+	uint64_t result = 0;
+	int shift = 0;
+	while (offset < size) {
+		uint8_t byte = data[offset++];
+		result |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) {
+			return result;
+		}
+		shift += 7;
+	}
+
+	internal("", "unexpected end of serialized data", __FILE__, __LINE__);
+	return result;
+}
+
+int64_t byte_reader::read_int()
+{
+	uint64_t value = read_uint();
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+bool byte_reader::read_bool()
+{
+	if (offset >= size) {
+		internal("", "unexpected end of serialized data", __FILE__, __LINE__);
+		return false;
+	}
+	return data[offset++] != 0;
+}
+
+void byte_reader::read(boolean::cube &c)
+{
+	c.values.resize(read_uint());
+	for (int i = 0; i < (int)c.values.size(); i++) {
+		c.values[i] = (unsigned int)read_uint();
+	}
+}
+
+void byte_reader::read(boolean::cover &c)
+{
+	c.cubes.resize(read_uint());
+	for (int i = 0; i < (int)c.cubes.size(); i++) {
+		read(c.cubes[i]);
+	}
+}
+
+void byte_reader::read(interned_cover &c)
+{
+	boolean::cover value;
+	read(value);
+	c = interned_cover(value);
+}
+
+void byte_reader::read(term_index &t)
+{
+	t.index = (int)read_int();
+	t.term = (int)read_int();
+}
+
+void byte_reader::read(hse::token &t)
+{
+	t.index = (int)read_int();
+	read(t.guard);
+	read(t.assume);
+	read(t.sequence);
+	t.cause = (int)read_int();
+}
+
+void byte_reader::read(enabled_transition &t)
+{
+	t.index = (int)read_int();
+	t.tokens.resize(read_uint());
+	for (int i = 0; i < (int)t.tokens.size(); i++) {
+		t.tokens[i] = (int)read_int();
+	}
+	t.output_marking.resize(read_uint());
+	for (int i = 0; i < (int)t.output_marking.size(); i++) {
+		t.output_marking[i] = (int)read_int();
+	}
+	t.history.clear();
+	for (int i = (int)read_uint(); i > 0; i--) {
+		term_index term;
+		read(term);
+		t.history.push_back(term);
+	}
+	read(t.guard_action);
+	read(t.guard);
+	read(t.depend);
+	read(t.assume);
+	read(t.sequence);
+	t.vacuous = read_bool();
+	t.stable = read_bool();
+	t.fire_at = read_uint();
+}
+
+void byte_reader::read(state &s)
+{
+	s.tokens.resize(read_uint());
+	for (int i = 0; i < (int)s.tokens.size(); i++) {
+		s.tokens[i].index = (int)read_int();
+	}
+	read(s.encodings);
+}
+
+void byte_reader::read(simulator &sim, graph *base)
+{
+	sim.base = base;
+	sim.annotate_ghosts = read_bool();
+
+	sim.history.clear();
+	for (uint64_t count = read_uint(); count > 0; count--) {
+		sim.history.push_back(pair<boolean::cube, term_index>());
+		read(sim.history.back().first);
+		read(sim.history.back().second);
+	}
+
+	read(sim.encoding);
+	read(sim.global);
+
+	sim.tokens.resize(read_uint());
+	for (int i = 0; i < (int)sim.tokens.size(); i++) {
+		read(sim.tokens[i]);
+	}
+	sim.loaded.resize(read_uint());
+	for (int i = 0; i < (int)sim.loaded.size(); i++) {
+		read(sim.loaded[i]);
+	}
+	sim.ready.resize(read_uint());
+	for (int i = 0; i < (int)sim.ready.size(); i++) {
+		sim.ready[i].first = (int)read_int();
+		sim.ready[i].second = (int)read_int();
+	}
+
+	sim.now = read_uint();
+}
+
+uint64_t hash_bytes(const uint8_t *data, size_t size)
+{
+	uint64_t result = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < size; i++) {
+		result ^= data[i];
+		result *= 0x100000001b3ull;
+	}
+	return result;
+}
+
+}
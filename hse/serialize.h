@@ -0,0 +1,76 @@
+#pragma once
+
+#include <common/standard.h>
+#include <boolean/cube.h>
+#include <boolean/cover.h>
+#include "state.h"
+#include "simulator.h"
+
+namespace hse
+{
+
+// These convert the structures used during simulation into a compact binary
+// representation so that they may be written to disk when they no longer fit
+// in memory. All integers are written as LEB128 varints, and signed integers
+// are zigzag encoded first so that small negative numbers stay small.
+//
+// The encoding is canonical: two states compare equal if and only if their
+// encodings are byte for byte identical. This allows the encoded bytes to be
+// sorted and searched directly.
+struct byte_writer
+{
+	byte_writer();
+	~byte_writer();
+
+	vector<uint8_t> data;
+
+	void clear();
+
+	void write_uint(uint64_t value);
+	void write_int(int64_t value);
+	void write_bool(bool value);
+
+	void write(const boolean::cube &c);
+	void write(const boolean::cover &c);
+	void write(const interned_cover &c);
+	void write(const term_index &t);
+	void write(const hse::token &t);
+	void write(const enabled_transition &t);
+	void write(const state &s);
+	void write(const simulator &sim);
+};
+
+struct byte_reader
+{
+	byte_reader();
+	byte_reader(const uint8_t *data, size_t size);
+	~byte_reader();
+
+	const uint8_t *data;
+	size_t size;
+	size_t offset;
+
+	bool done() const;
+
+	uint64_t read_uint();
+	int64_t read_int();
+	bool read_bool();
+
+	void read(boolean::cube &c);
+	void read(boolean::cover &c);
+	void read(interned_cover &c);
+	void read(term_index &t);
+	void read(hse::token &t);
+	void read(enabled_transition &t);
+	void read(state &s);
+
+	// base is not serialized, the caller must provide the graph that the
+	// simulator was running on.
+	void read(simulator &sim, graph *base);
+};
+
+// A 64 bit FNV-1a hash of a byte string. This is used to index serialized
+// states in Bloom filters and hash tables.
+uint64_t hash_bytes(const uint8_t *data, size_t size);
+
+}
@@ -7,10 +7,16 @@
 
 #include "simulator.h"
 #include "graph.h"
+#include "diagnostic.h"
+#include "compiled.h"
+#include "packed.h"
+#include "vcd.h"
 #include <common/text.h>
 #include <common/message.h>
 #include <interpret_boolean/export.h>
 #include <common/math.h>
+#include <mutex>
+#include <climits>
 
 namespace hse
 {
@@ -35,12 +41,13 @@ string instability::to_string(const hse::graph &g)
 
 	result += " cause: {";
 
-	for (int j = 0; j < (int)history.size(); j++)
+	vector<term_index> terms = history.to_vector();
+	for (int j = 0; j < (int)terms.size(); j++)
 	{
 		if (j != 0)
 			result += "; ";
 
-		result += history[j].to_string(g);
+		result += terms[j].to_string(g);
 	}
 	result += "}";
 	return result;
@@ -119,6 +126,11 @@ deadlock::deadlock(vector<token> tokens, boolean::cube encodings) : state(tokens
 
 }
 
+deadlock::deadlock(const marking &places, boolean::cube encodings) : state(places, encodings)
+{
+
+}
+
 deadlock::~deadlock()
 {
 
@@ -129,17 +141,174 @@ string deadlock::to_string(const hse::graph &g)
 	return "deadlock detected at state " + state::to_string(g);
 }
 
+size_t error_hash::operator()(const instability &err) const
+{
+	return (size_t)((uint64_t)(uint32_t)err.index * 0x9E3779B97F4A7C15ull ^ err.history.hash());
+}
+
+size_t error_hash::operator()(const interference &err) const
+{
+	uint64_t result = (uint64_t)(uint32_t)err.first.index * 0x9E3779B97F4A7C15ull;
+	result ^= (uint64_t)(uint32_t)err.first.term * 0xC2B2AE3D27D4EB4Full;
+	result ^= (uint64_t)(uint32_t)err.second.index * 0x165667B19E3779F9ull;
+	result ^= (uint64_t)(uint32_t)err.second.term * 0x27D4EB2F165667C5ull;
+	return (size_t)(result ^ (result >> 29));
+}
+
+size_t error_hash::operator()(const mutex &err) const
+{
+	uint64_t result = (uint64_t)(uint32_t)err.first.index * 0x9E3779B97F4A7C15ull;
+	result ^= err.first.history.hash() * 0xC2B2AE3D27D4EB4Full;
+	result ^= (uint64_t)(uint32_t)err.second.index * 0x165667B19E3779F9ull;
+	result ^= err.second.history.hash() * 0x27D4EB2F165667C5ull;
+	return (size_t)(result ^ (result >> 29));
+}
+
+error_registry::error_registry()
+{
+}
+
+error_registry::~error_registry()
+{
+}
+
+bool error_registry::insert(const instability &err)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return instabilities.insert(err).second;
+}
+
+bool error_registry::insert(const interference &err)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return interferences.insert(err).second;
+}
+
+bool error_registry::insert(const mutex &err)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return mutexes.insert(err).second;
+}
+
+void error_registry::merge(error_registry &other)
+{
+	if (&other == this) {
+		return;
+	}
+
+	std::scoped_lock guard(lock, other.lock);
+	instabilities.insert(other.instabilities.begin(), other.instabilities.end());
+	interferences.insert(other.interferences.begin(), other.interferences.end());
+	mutexes.insert(other.mutexes.begin(), other.mutexes.end());
+}
+
+size_t error_registry::size()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return instabilities.size() + interferences.size() + mutexes.size();
+}
+
+undo_log::undo_log()
+{
+	fired = false;
+	now = 0;
+	updated = false;
+	replaced = false;
+	tokens_size = -1;
+}
+
+undo_log::~undo_log()
+{
+}
+
+void undo_log::clear()
+{
+	fired = false;
+	loaded_tokens.clear();
+	loaded_erased.clear();
+	token_causes.clear();
+	tokens_erased.clear();
+	ready.clear();
+	history_erased.clear();
+	history_next.clear();
+
+	updated = false;
+	replaced = false;
+	enabled_erased.clear();
+	permutation.clear();
+	tokens_size = -1;
+	loaded.clear();
+	enabled_ready.clear();
+}
+
+guard_memo::guard_memo()
+{
+	stamp = 0;
+	previously_enabled = false;
+	ready = 0;
+	vacuous = false;
+}
+
+guard_memo::~guard_memo()
+{
+}
+
+guard_memo_table::guard_memo_table()
+{
+	stamp = 0;
+}
+
+guard_memo_table::guard_memo_table(const guard_memo_table &t)
+{
+	entries = t.entries;
+	watch = t.watch;
+	encoding = t.encoding;
+	global = t.global;
+	stamp = t.stamp;
+}
+
+guard_memo_table::~guard_memo_table()
+{
+}
+
+guard_memo_table &guard_memo_table::operator=(const guard_memo_table &t)
+{
+	entries = t.entries;
+	watch = t.watch;
+	encoding = t.encoding;
+	global = t.global;
+	stamp = t.stamp;
+	return *this;
+}
+
+void guard_memo_table::clear()
+{
+	entries.clear();
+	watch.clear();
+	encoding = boolean::cube();
+	global = boolean::cube();
+	stamp = 0;
+}
+
 simulator::simulator(bool annotate_ghosts)
 {
 	base = NULL;
 	now = 0;
 	this->annotate_ghosts = annotate_ghosts;
+	diagnostics = nullptr;
+	waveform = nullptr;
+	memoize_guards = false;
+	packed_diff = true;
 }
 
 simulator::simulator(graph *base, state initial, bool annotate_ghosts) {
 	this->base = base;
 	this->now = 0;
 	this->annotate_ghosts = annotate_ghosts;
+	this->diagnostics = nullptr;
+	this->waveform = nullptr;
+	this->memoize_guards = false;
+	this->packed_diff = true;
 	if (base != NULL) {
 		encoding = initial.encodings.minimize();
 		global = stripped_encoding();
@@ -155,56 +324,159 @@ simulator::~simulator() {
 // Returns a vector of indices representing the transitions
 // that this marking enabled and the term of each transition
 // that's enabled.
-int simulator::enabled(bool sorted) {
+int simulator::enabled(bool sorted, undo_log *log) {
 	if (base == NULL) {
 		internal("", "NULL pointer to simulator::base", __FILE__, __LINE__);
 		return 0;
 	}
 
+	if (log != nullptr) {
+		log->updated = true;
+	}
+
 	// Do a pre-screen
-	for (int i = (int)tokens.size()-1; i >= 0; i--)
-		if (tokens[i].cause >= 0)
+	for (int i = (int)tokens.size()-1; i >= 0; i--) {
+		if (tokens[i].cause >= 0) {
+			if (log != nullptr) {
+				log->enabled_erased.push_back(pair<int, token>(i, std::move(tokens[i])));
+			}
 			tokens.erase(tokens.begin() + i);
+		}
+	}
 
 	if (tokens.size() == 0)
 		return 0;
 
-	if (!sorted)
-		sort(tokens.begin(), tokens.end());
+	if (!sorted) {
+		if (log != nullptr and not is_sorted(tokens.begin(), tokens.end())) {
+			// Remember where each token came from so that the sort can be undone.
+			log->permutation.resize(tokens.size());
+			for (int i = 0; i < (int)tokens.size(); i++) {
+				log->permutation[i] = i;
+			}
+			stable_sort(log->permutation.begin(), log->permutation.end(), [this](int a, int b) {
+				return tokens[a] < tokens[b];
+			});
+
+			vector<token> result;
+			result.reserve(tokens.size());
+			for (int i = 0; i < (int)log->permutation.size(); i++) {
+				result.push_back(std::move(tokens[log->permutation[i]]));
+			}
+			tokens.swap(result);
+		} else {
+			stable_sort(tokens.begin(), tokens.end());
+		}
+	}
+
+	if (log != nullptr) {
+		log->tokens_size = (int)tokens.size();
+	}
+
+	const compiled_graph &cg = snapshot();
+	boolean::cube stripped = stripped_encoding();
+	if (memoize_guards) {
+		invalidate(stripped);
+	}
 
 	// Get the list of transitions that have a sufficient number of tokens at the input places
 	vector<enabled_transition> preload;
 	vector<enabled_transition> potential;
-	vector<int> global_disabled;
-	vector<int> disabled;
-	disabled.reserve(base->transitions.size());
-	
+
+	// The lists that only live for this call are drawn from the scratch
+	// memory of the exploration, see scratch_scope.
+	std::pmr::memory_resource *scratch = scratch_scope::current();
+	std::pmr::vector<int> global_disabled(scratch);
+	std::pmr::vector<int> disabled(scratch);
+
+	// The marked places paired with the index of the token at each one, and
+	// the input arcs of every transition that could be loaded.
+	std::pmr::vector<pair<int, int> > marked(scratch);
+	std::pmr::vector<int> candidates(scratch);
+	std::pmr::vector<int> visit(scratch);
+	std::pmr::vector<int> loaded_before(scratch);
+	std::pmr::vector<int> matching_tokens(scratch);
+	std::pmr::vector<int> test(scratch);
+
 	int preload_size = 0;
 	do {
 		disabled = global_disabled;
 		preload_size = preload.size();
-		for (auto a = base->arcs[place::type].begin(); a != base->arcs[place::type].end(); a++) {
+
+		// A transition can only be loaded if there is a token at every one of
+		// its input places, so we start from the marked places and only
+		// visit the input arcs of those transitions. Every other arc would be
+		// skipped or would only disable a transition that never makes it into
+		// the loaded list. The arcs are visited in the same order as
+		// base->arcs so that the result is the same as a scan of every arc.
+		marked.clear();
+		for (int j = 0; j < (int)tokens.size(); j++) {
+			marked.push_back(pair<int, int>(tokens[j].index, j));
+		}
+		sort(marked.begin(), marked.end());
+
+		loaded_before.clear();
+		for (int i = 0; i < preload_size; i++) {
+			loaded_before.push_back(preload[i].index);
+		}
+		sort(loaded_before.begin(), loaded_before.end());
+
+		candidates.clear();
+		for (int j = 0; j < (int)marked.size(); j++) {
+			if (j > 0 and marked[j].first == marked[j-1].first) continue;
+
+			int p = marked[j].first;
+			for (int k = cg.place_offset[p]; k < cg.place_offset[p+1]; k++) {
+				candidates.push_back(cg.arc_to[cg.place_arcs[k]]);
+			}
+		}
+		sort(candidates.begin(), candidates.end());
+		candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+
+		visit.clear();
+		for (auto t = candidates.begin(); t != candidates.end(); t++) {
+			if (binary_search(disabled.begin(), disabled.end(), *t)
+				or binary_search(loaded_before.begin(), loaded_before.end(), *t)) continue;
+
+			bool covered = true;
+			for (int k = cg.transition_offset[*t]; k < cg.transition_offset[*t+1] and covered; k++) {
+				auto m = lower_bound(marked.begin(), marked.end(), pair<int, int>(cg.arc_from[cg.transition_arcs[k]], -1));
+				covered = m != marked.end() and m->first == cg.arc_from[cg.transition_arcs[k]];
+			}
+
+			if (covered) {
+				visit.insert(visit.end(), cg.transition_arcs.begin() + cg.transition_offset[*t], cg.transition_arcs.begin() + cg.transition_offset[*t+1]);
+			}
+		}
+		sort(visit.begin(), visit.end());
+
+		for (auto k = visit.begin(); k != visit.end(); k++) {
+			int from = cg.arc_from[*k];
+			int to = cg.arc_to[*k];
+			auto at = lower_bound(marked.begin(), marked.end(), pair<int, int>(from, -1));
+
 			// A transition will only be in disabled if we've already determined that it can't be enabled.
-			auto d = lower_bound(disabled.begin(), disabled.end(), a->to.index);
-			if (d == disabled.end() or *d != a->to.index) {
+			auto d = lower_bound(disabled.begin(), disabled.end(), to);
+			if (d == disabled.end() or *d != to) {
 				// Find the index of this transition (if any) in the loaded pool
 				bool loaded_found = false;
 				for (int i = (int)preload.size()-1; i >= 0; i--) {
-					if (preload[i].index == a->to.index) {
+					if (preload[i].index == to) {
 						loaded_found = true;
 
 						// Check to make sure that this enabled transition isn't from a previous iteration.
 						if (i >= preload_size) {
 							// Check to see if there is any token at the input place of this arc and make sure that
 							// this token has not already been consumed by this particular transition
-							vector<int> matching_tokens;
-							for (int j = 0; j < (int)tokens.size(); j++) {
-								if (a->from.index == tokens[j].index) {
+							matching_tokens.clear();
+							for (auto m = at; m != marked.end() and m->first == from; m++) {
+								int j = m->second;
+								{
 									// We have to implement a recursive...ish algorithm here
 									// to check to see if this token has already been used by
 									// any of the transitions in the chain
 									bool used = false;
-									vector<int> test = preload[i].tokens;
+									test.assign(preload[i].tokens.begin(), preload[i].tokens.end());
 									for (int k = 0; k < (int)test.size() and not used; k++) {
 										used = (test[k] == j);
 										if (tokens[test[k]].cause >= 0) {
@@ -229,7 +501,7 @@ int simulator::enabled(bool sorted) {
 							} else {
 								// If we didn't find a token at the input place, then we know that this transition can't
 								// be enabled. So lets remove this from the list of possibly enabled transitions
-								disabled.insert(d, a->to.index);
+								disabled.insert(d, to);
 								preload.erase(preload.begin() + i);
 							}
 						}
@@ -241,16 +513,15 @@ int simulator::enabled(bool sorted) {
 				// previous iterations. We need to add it to the loaded list.
 				if (!loaded_found) {
 					bool token_found = false;
-					for (int j = 0; j < (int)tokens.size(); j++)
-						if (a->from.index == tokens[j].index)
-						{
-							token_found = true;
-							preload.push_back(enabled_transition(a->to.index));
-							preload.back().tokens.push_back(j);
-						}
+					for (auto m = at; m != marked.end() and m->first == from; m++)
+					{
+						token_found = true;
+						preload.push_back(enabled_transition(to));
+						preload.back().tokens.push_back(m->second);
+					}
 
 					if (!token_found)
-						disabled.insert(d, a->to.index);
+						disabled.insert(d, to);
 				}
 			}
 		}
@@ -365,8 +636,9 @@ int simulator::enabled(bool sorted) {
 				}
 			}
 			guard.minimize();*/
-			boolean::cover guard = preload[i].depend & base->transitions[preload[i].index].guard;
-			preload[i].assume &= base->transitions[preload[i].index].assume;
+			const compiled_transition &ct = cg.transitions[preload[i].index];
+			interned_cover guard = preload[i].depend & ct.interned_guard;
+			preload[i].assume &= ct.interned_assume;
 
 			// Check for unstable transitions
 			bool previously_enabled = false;
@@ -383,24 +655,40 @@ int simulator::enabled(bool sorted) {
 
 			// Now we check to see if the current state passes the guard
 			// TODO(edward.bingham) assume should be built into passes_guard
-			int isReady = boolean::passes_guard(stripped_encoding(), global, preload[i].assume, guard, &preload[i].guard_action);
-			if (isReady < 0 && previously_enabled) {
-				isReady = 0;
-			}
+			int isReady = 0;
+			const guard_memo *m = memoize_guards ? &memo.entries[preload[i].index] : nullptr;
+			if (m != nullptr and m->stamp != 0
+				and m->previously_enabled == previously_enabled
+				and m->depend == preload[i].depend
+				and m->assume == preload[i].assume) {
+				isReady = m->ready;
+				preload[i].guard_action = m->guard_action;
+				preload[i].stable = (isReady > 0);
+				preload[i].vacuous = m->vacuous;
+			} else {
+				isReady = boolean::passes_guard(stripped, global, preload[i].assume.get(), guard.get(), &preload[i].guard_action);
+				if (isReady < 0 && previously_enabled) {
+					isReady = 0;
+				}
 
-			preload[i].stable = (isReady > 0);
-			preload[i].vacuous = boolean::vacuous_assign(global, base->transitions[preload[i].index].remote_action, preload[i].stable);
+				preload[i].stable = (isReady > 0);
+				preload[i].vacuous = boolean::vacuous_assign(global, ct.remote_action, preload[i].stable);
+				if (memoize_guards) {
+					remember(preload[i].index, preload[i], previously_enabled, isReady, guard.get());
+				}
+			}
 			preload[i].stable = preload[i].stable || preload[i].vacuous;
 
 			// if the transition is vacuous, then we've already passed the guard even
 			// if the guard is not satisfied by the current state
 			if (preload[i].vacuous) {
-				vector<int> output = base->next(transition::type, preload[i].index);
+				int first = cg.output_offset[preload[i].index];
+				int last = cg.output_offset[preload[i].index+1];
 				bool loop = true;
-				for (int j = 0; j < (int)output.size() and loop; j++) {
+				for (int j = first; j < last and loop; j++) {
 					loop = false;
 					for (int k = 0; k < (int)tokens.size() and not loop; k++) {
-						loop = tokens[k].index == output[j];
+						loop = tokens[k].index == cg.output_places[j];
 					}
 				}
 
@@ -417,35 +705,24 @@ int simulator::enabled(bool sorted) {
 					}
 					preload.erase(preload.begin() + i);
 				} else {
-					boolean::cover guard = preload[i].depend;
-					boolean::cover assume = preload[i].assume & base->transitions[preload[i].index].assume;
+					interned_cover assume = preload[i].assume & ct.interned_assume;
 					//boolean::cover sequence = preload[i].sequence;
-					if (base->transitions[preload[i].index].local_action.is_tautology()) {
-						guard &= base->transitions[preload[i].index].guard;
-					} else {
-						//sequence = base->transitions[preload[i].index].local_action;
-						// the guard should be the most minimal possible guard necessary to
-						// guard any multi-branch selection statement (unless the
-						// transition is a skip, in which case any guard should be passed
-						// on to the next transition). If there isn't a multi-term
-						// selection statement, then the guard should be ignored.
-						boolean::cover exclude = base->exclusion(preload[i].index);
-						boolean::cover weak = boolean::weakest_guard(base->transitions[preload[i].index].guard, exclude);
-						guard &= weak;
-						//cout << "setting token guard:" << emit_expression(base->transitions[preload[i].index].guard, *variables) << " exclude:" << emit_expression(exclude, *variables) << " weak:" << emit_expression(weak, *variables) << " result:" << emit_expression(guard, *variables) << endl;
-					}
 
-					for (int j = 0; j < (int)output.size(); j++)
+					// the guard should be the most minimal possible guard necessary to
+					// guard any multi-branch selection statement (unless the
+					// transition is a skip, in which case any guard should be passed
+					// on to the next transition). If there isn't a multi-term
+					// selection statement, then the guard should be ignored. This
+					// only depends on the graph, so it is computed once by compile().
+					interned_cover guard = preload[i].depend & ct.interned_propagated;
+
+					for (int j = first; j < last; j++)
 					{
 						preload[i].output_marking.push_back((int)tokens.size());
-						tokens.push_back(token(output[j], assume, guard, 1/*sequence*/, i));
+						tokens.push_back(token(cg.output_places[j], assume, guard, 1/*sequence*/, i));
 					}
 				}
 			} else {
-				if (isReady >= 0) {
-					potential.push_back(preload[i]);
-				}
-
 				for (int j = 0; j < (int)tokens.size(); j++) {
 					if (tokens[j].cause > i) {
 						tokens[j].cause--;
@@ -456,27 +733,39 @@ int simulator::enabled(bool sorted) {
 				if (d == global_disabled.end() or *d != preload[i].index) {
 					global_disabled.insert(d, preload[i].index);
 				}
+
+				// This is about to be erased, so there is no need to copy it.
+				if (isReady >= 0) {
+					potential.push_back(std::move(preload[i]));
+				}
 				preload.erase(preload.begin() + i);
 			}
 		}
 	} while ((int)preload.size() != preload_size);
 
 	for (int i = 0; i < (int)potential.size(); i++) {
-		vector<int> output = base->next(transition::type, potential[i].index);
-		for (int j = 0; j < (int)output.size(); j++) {
+		int index = potential[i].index;
+		for (int j = cg.output_offset[index]; j < cg.output_offset[index+1]; j++) {
 			potential[i].output_marking.push_back((int)tokens.size());
-			tokens.push_back(token(output[j], 1/*assume*/, 1/*guard*/, base->transitions[potential[i].index].local_action, preload.size()));
+			tokens.push_back(token(cg.output_places[j], 1/*assume*/, 1/*guard*/, cg.transitions[index].interned_local_action, preload.size()));
 		}
 
-		preload.push_back(potential[i]);
+		preload.push_back(std::move(potential[i]));
 	}
 
-	loaded = preload;
+	if (log != nullptr) {
+		log->replaced = true;
+		log->loaded.swap(loaded);
+		log->enabled_ready.swap(ready);
+		loaded.swap(preload);
+	} else {
+		loaded.swap(preload);
+	}
 	ready.clear();
 
 	for (int i = 0; i < (int)loaded.size(); i++) {
 		if (not loaded[i].vacuous) {
-			for (int j = 0; j < (int)base->transitions[loaded[i].index].local_action.cubes.size(); j++) {
+			for (int j = 0; j < (int)cg.transitions[loaded[i].index].local_action.cubes.size(); j++) {
 				ready.push_back(pair<int, int>(i, j));
 			}
 		}
@@ -485,7 +774,7 @@ int simulator::enabled(bool sorted) {
 	return ready.size();
 }
 
-enabled_transition simulator::fire(int index)
+enabled_transition simulator::fire(int index, undo_log *log)
 {
 	if (base == NULL)
 	{
@@ -493,10 +782,22 @@ enabled_transition simulator::fire(int index)
 		return enabled_transition();
 	}
 
+	if (log != nullptr) {
+		log->fired = true;
+		log->now = now;
+		log->encoding = encoding;
+		log->global = global;
+	}
+
+	if (errors == nullptr) {
+		errors = std::make_shared<error_registry>();
+	}
+
+	const compiled_graph &cg = snapshot();
 	enabled_transition t = loaded[ready[index].first];
 	int term = ready[index].second;
-	boolean::cube local_action = base->transitions[t.index].local_action[term];
-	boolean::cube remote_action = base->transitions[t.index].remote_action[term];
+	boolean::cube local_action = cg.transitions[t.index].local_action[term];
+	boolean::cube remote_action = cg.transitions[t.index].remote_action[term];
 	if (t.fire_at > now) {
 		now = t.fire_at;
 	}
@@ -505,7 +806,7 @@ enabled_transition simulator::fire(int index)
 	// Since we know that no transition can use the same token twice, we can simply mush them all
 	// into one big list and then remove duplicates.
 	// assumes that a transition in the loaded array only depends upon transitions before it in the array
-	vector<int> visited(1, ready[index].first);
+	std::pmr::vector<int> visited(1, ready[index].first, scratch_scope::current());
 	for (int i = 0; i < (int)t.tokens.size(); i++) {
 		if (tokens[t.tokens[i]].cause >= 0 and tokens[t.tokens[i]].cause < ready[index].first)
 		{
@@ -523,14 +824,24 @@ enabled_transition simulator::fire(int index)
 
 	for (int i = 0; i < (int)loaded.size(); i++) {
 		if (find(visited.begin(), visited.end(), i) == visited.end()) {
+			bool saved = false;
 			for (int j = 0; j < (int)loaded[i].tokens.size(); j++) {
 				if (tokens[loaded[i].tokens[j]].cause >= 0
 				  and tokens[loaded[i].tokens[j]].cause < i
 				  and find(visited.begin(), visited.end(), tokens[loaded[i].tokens[j]].cause) == visited.end()) {
+					if (log != nullptr and not saved) {
+						log->loaded_tokens.push_back(pair<int, vector<int> >(i, loaded[i].tokens));
+						saved = true;
+					}
 					loaded[i].tokens.insert(loaded[i].tokens.end(), loaded[tokens[loaded[i].tokens[j]].cause].tokens.begin(), loaded[tokens[loaded[i].tokens[j]].cause].tokens.end());
 				}
 			}
 
+			if (log != nullptr and not saved and (not is_sorted(loaded[i].tokens.begin(), loaded[i].tokens.end())
+			  or adjacent_find(loaded[i].tokens.begin(), loaded[i].tokens.end()) != loaded[i].tokens.end())) {
+				log->loaded_tokens.push_back(pair<int, vector<int> >(i, loaded[i].tokens));
+			}
+
 			sort(loaded[i].tokens.begin(), loaded[i].tokens.end());
 			loaded[i].tokens.resize(unique(loaded[i].tokens.begin(), loaded[i].tokens.end()) - loaded[i].tokens.begin());
 		}
@@ -541,6 +852,9 @@ enabled_transition simulator::fire(int index)
 	for (int i = (int)loaded.size()-1; i >= 0; i--)
 	{
 		if (loaded[i].index == t.index) {
+			if (log != nullptr) {
+				log->loaded_erased.push_back(pair<int, enabled_transition>(i, std::move(loaded[i])));
+			}
 			loaded.erase(loaded.begin() + i);
 			continue;
 		}
@@ -550,34 +864,31 @@ enabled_transition simulator::fire(int index)
 		{
 			bool is_deterministic = true;
 			for (int k = 0; k < (int)intersect.size() && is_deterministic; k++)
-				is_deterministic = not base->places[tokens[intersect[k]].index].arbiter;
+				is_deterministic = not cg.arbiter[tokens[intersect[k]].index];
 
 			if (not loaded[i].vacuous and is_deterministic)
 			{
-				cout << "Intersect: (";
-				for (int l = 0; l < (int)intersect.size(); l++)
-					cout << tokens[intersect[l]].index << " ";
-				cout << ")";
-				cout << "Arbiters: (";
-				for (int l = 0; l < (int)intersect.size(); l++) {
-					if (base->places[tokens[intersect[l]].index].arbiter) {
-						cout << tokens[intersect[l]].index << " ";
-					}
-				}
-				cout << ")";
 				mutex err = mutex(t, loaded[i]);
-				vector<mutex>::iterator loc = lower_bound(mutex_errors.begin(), mutex_errors.end(), err);
-				if (loc == mutex_errors.end() || *loc != err)
+				if (errors->insert(err))
 				{
-					mutex_errors.insert(loc, err);
-					error("", err.to_string(*base), __FILE__, __LINE__);
+					vector<int> places;
+					for (int l = 0; l < (int)intersect.size(); l++) {
+						places.push_back(tokens[intersect[l]].index);
+					}
+					sink().report(*base, diagnostic(err, places));
 				}
 			}
 
+			if (log != nullptr) {
+				log->loaded_erased.push_back(pair<int, enabled_transition>(i, std::move(loaded[i])));
+			}
 			loaded.erase(loaded.begin() + i);
 		}
 	}
 
+	if (log != nullptr) {
+		log->ready.swap(ready);
+	}
 	ready.clear();
 
 	// take the set symmetric difference, but leave the two sets separate.
@@ -595,25 +906,32 @@ enabled_transition simulator::fire(int index)
 	// Check to see if this transition is unstable
 	if (not t.stable and not t.vacuous) {
 		instability err = instability(t);
-		vector<instability>::iterator loc = lower_bound(instability_errors.begin(), instability_errors.end(), err);
-		if (loc == instability_errors.end() || *loc != err) {
-			instability_errors.insert(loc, err);
-			error("", err.to_string(*base), __FILE__, __LINE__);
+		if (errors->insert(err)) {
+			sink().report(*base, diagnostic(err));
 		}
 	}
 
 	// Update the tokens
 	for (int i = 0; i < (int)t.output_marking.size(); i++) {
+		if (log != nullptr) {
+			log->token_causes.push_back(pair<int, int>(t.output_marking[i], tokens[t.output_marking[i]].cause));
+		}
 		tokens[t.output_marking[i]].cause = -1;
 	}
 
 	sort(t.tokens.begin(), t.tokens.end());
 	for (int i = t.tokens.size()-1; i >= 0; i--) {
+		if (log != nullptr) {
+			log->tokens_erased.push_back(pair<int, token>(t.tokens[i], std::move(tokens[t.tokens[i]])));
+		}
 		tokens.erase(tokens.begin() + t.tokens[i]);
 	}
 
 	for (int i = tokens.size()-1; i >= 0; i--) {
 		if (tokens[i].cause >= 0) {
+			if (log != nullptr) {
+				log->tokens_erased.push_back(pair<int, token>(i, std::move(tokens[i])));
+			}
 			tokens.erase(tokens.begin() + i);
 		}
 	}
@@ -627,34 +945,36 @@ enabled_transition simulator::fire(int index)
 	// Check for interfering transitions. Interfering transitions are the active
 	// transitions that have fired since this active transition was enabled.
 	// TODO(edward.bingham) timing assumptions seem to be preventing the simulator from identifying interference.
-	for (int j = 0; j < (int)t.history.size(); j++) {
-		if (boolean::are_mutex(base->transitions[t.index].remote_action[term], base->transitions[t.history[j].index].local_action[t.history[j].term]))
+	vector<term_index> fired = t.history.to_vector();
+	for (int j = 0; j < (int)fired.size(); j++) {
+		if (boolean::are_mutex(cg.transitions[t.index].remote_action[term], cg.transitions[fired[j].index].local_action[fired[j].term]))
 		{
-			interference err(term_index(t.index, term), t.history[j]);
-			vector<interference>::iterator loc = lower_bound(interference_errors.begin(), interference_errors.end(), err);
-			if (loc == interference_errors.end() || *loc != err)
+			interference err(term_index(t.index, term), fired[j]);
+			if (errors->insert(err))
 			{
-				interference_errors.insert(loc, err);
-				error("", err.to_string(*base), __FILE__, __LINE__);
+				sink().report(*base, diagnostic(err));
 			}
 		}
 
-		local_action = boolean::interfere(local_action, base->transitions[t.history[j].index].remote_action[t.history[j].term]);
-		remote_action = boolean::interfere(remote_action, base->transitions[t.history[j].index].remote_action[t.history[j].term]);
+		local_action = boolean::interfere(local_action, cg.transitions[fired[j].index].remote_action[fired[j].term]);
+		remote_action = boolean::interfere(remote_action, cg.transitions[fired[j].index].remote_action[fired[j].term]);
 	}
 
 	// Update the state
 	boolean::cover annotated_action = local_action;
 	if (annotate_ghosts) {
-		annotated_action &= base->transitions[t.index].ghost;
+		annotated_action &= cg.transitions[t.index].ghost;
 	}
 
 	global = local_assign(global, remote_action, t.stable);
 	encoding = remote_assign(local_assign(encoding, annotated_action, t.stable), global, true);
 
 	for (int i = (int)loaded.size()-1; i >= 0; i--) {
-		if (are_mutex(loaded[i].assume, global)
-			or (are_mutex(local_assign(global, base->transitions[loaded[i].index].remote_action, true), t.assume) and not loaded[i].stable)) {
+		if (are_mutex(loaded[i].assume.get(), global)
+			or (are_mutex(local_assign(global, cg.transitions[loaded[i].index].remote_action, true), t.assume.get()) and not loaded[i].stable)) {
+			if (log != nullptr) {
+				log->loaded_erased.push_back(pair<int, enabled_transition>(i, std::move(loaded[i])));
+			}
 			loaded.erase(loaded.begin() + i);
 		}
 	}
@@ -662,13 +982,22 @@ enabled_transition simulator::fire(int index)
 	// Update the history. The first thing we need to do is remove any assignments that no longer
 	// have any effect on the global state. So we remove history items where all of the terms
 	// in their assignments are conflicting with terms in more recent assignments.
-	boolean::cube actions = base->transitions[t.index].local_action.cubes[term].mask();
+	boolean::cube actions = cg.transitions[t.index].local_action.cubes[term].mask();
 	for (list<pair<boolean::cube, term_index> >::reverse_iterator i = history.rbegin(); i != history.rend();) {
-		if (base->transitions[i->second.index].local_action.cubes[i->second.term].mask(actions).is_tautology()) {
+		if (cg.transitions[i->second.index].local_action.cubes[i->second.term].mask(actions).is_tautology()) {
 			i++;
-			i = list<pair<boolean::cube, term_index> >::reverse_iterator(history.erase(i.base()));
+			if (log != nullptr) {
+				// Keep the erased entry around so that we can put it back.
+				auto curr = i.base();
+				auto next = std::next(curr);
+				log->history_next.push_back(next);
+				log->history_erased.splice(log->history_erased.end(), history, curr);
+				i = list<pair<boolean::cube, term_index> >::reverse_iterator(next);
+			} else {
+				i = list<pair<boolean::cube, term_index> >::reverse_iterator(history.erase(i.base()));
+			}
 		} else {
-			actions = actions.combine_mask(base->transitions[i->second.index].local_action.cubes[i->second.term].mask());
+			actions = actions.combine_mask(cg.transitions[i->second.index].local_action.cubes[i->second.term].mask());
 			i++;
 		}
 	}
@@ -680,47 +1009,201 @@ enabled_transition simulator::fire(int index)
 		loaded[i].history.push_back(term_index(t.index, term));
 	}
 
+	if (waveform != nullptr) {
+		waveform->sample(*this);
+	}
+
 	return t;
 }
 
 void simulator::merge_errors(const simulator &sim)
 {
-	if (instability_errors.size() > 0)
-	{
-		vector<instability> old_instability_errors;
-		swap(instability_errors, old_instability_errors);
-		instability_errors.resize(old_instability_errors.size() + sim.instability_errors.size());
-		merge(sim.instability_errors.begin(), sim.instability_errors.end(), old_instability_errors.begin(), old_instability_errors.end(), instability_errors.begin());
-		instability_errors.resize(unique(instability_errors.begin(), instability_errors.end()) - instability_errors.begin());
+	if (sim.errors == nullptr) {
+		return;
+	} else if (errors == nullptr) {
+		errors = sim.errors;
+	} else {
+		errors->merge(*sim.errors);
 	}
-	else
-		instability_errors = sim.instability_errors;
+}
 
-	if (interference_errors.size() > 0)
-	{
-		vector<interference> old_interference_errors;
-		swap(interference_errors, old_interference_errors);
-		interference_errors.resize(sim.interference_errors.size() + old_interference_errors.size());
-		merge(sim.interference_errors.begin(), sim.interference_errors.end(), old_interference_errors.begin(), old_interference_errors.end(), interference_errors.begin());
-		interference_errors.resize(unique(interference_errors.begin(), interference_errors.end()) - interference_errors.begin());
+void simulator::rollback(undo_log &log)
+{
+	// Undo enabled()
+	if (log.updated) {
+		if (log.replaced) {
+			loaded.swap(log.loaded);
+			ready.swap(log.enabled_ready);
+		}
+
+		if (log.tokens_size >= 0) {
+			tokens.erase(tokens.begin() + log.tokens_size, tokens.end());
+		}
+
+		if (not log.permutation.empty()) {
+			vector<token> result(tokens.size());
+			for (int i = 0; i < (int)log.permutation.size(); i++) {
+				result[log.permutation[i]] = std::move(tokens[i]);
+			}
+			tokens.swap(result);
+		}
+
+		for (int i = (int)log.enabled_erased.size()-1; i >= 0; i--) {
+			tokens.insert(tokens.begin() + log.enabled_erased[i].first, std::move(log.enabled_erased[i].second));
+		}
 	}
-	else
-		interference_errors = sim.interference_errors;
 
-	if (mutex_errors.size() > 0)
-	{
-		vector<mutex> old_mutex_errors;
-		swap(mutex_errors, old_mutex_errors);
-		mutex_errors.resize(sim.mutex_errors.size() + old_mutex_errors.size());
-		merge(sim.mutex_errors.begin(), sim.mutex_errors.end(), old_mutex_errors.begin(), old_mutex_errors.end(), mutex_errors.begin());
-		mutex_errors.resize(unique(mutex_errors.begin(), mutex_errors.end()) - mutex_errors.begin());
+	// Undo fire()
+	if (log.fired) {
+		for (int i = 0; i < (int)loaded.size(); i++) {
+			loaded[i].history.pop_back();
+		}
+
+		for (int i = (int)log.loaded_erased.size()-1; i >= 0; i--) {
+			loaded.insert(loaded.begin() + log.loaded_erased[i].first, std::move(log.loaded_erased[i].second));
+		}
+
+		for (int i = (int)log.loaded_tokens.size()-1; i >= 0; i--) {
+			loaded[log.loaded_tokens[i].first].tokens.swap(log.loaded_tokens[i].second);
+		}
+
+		ready.swap(log.ready);
+
+		for (int i = (int)log.tokens_erased.size()-1; i >= 0; i--) {
+			tokens.insert(tokens.begin() + log.tokens_erased[i].first, std::move(log.tokens_erased[i].second));
+		}
+
+		for (int i = (int)log.token_causes.size()-1; i >= 0; i--) {
+			tokens[log.token_causes[i].first].cause = log.token_causes[i].second;
+		}
+
+		history.pop_back();
+		for (int i = (int)log.history_next.size()-1; i >= 0; i--) {
+			history.splice(log.history_next[i], log.history_erased, std::prev(log.history_erased.end()));
+		}
+
+		global = log.global;
+		encoding = log.encoding;
+		now = log.now;
 	}
-	else
-		mutex_errors = sim.mutex_errors;
+
+	log.clear();
+}
+
+diagnostic_sink &simulator::sink() {
+	return diagnostics != nullptr ? *diagnostics : immediate_diagnostics();
 }
 
 boolean::cube simulator::stripped_encoding() {
-	return encoding.without(base->ghost_nets).minimize().supercube();
+	return encoding.without(snapshot().ghost_nets).minimize().supercube();
+}
+
+const compiled_graph &simulator::snapshot() {
+	if (compiled == nullptr or not compiled->matches(*base)) {
+		compiled = compile(*base);
+
+		// The remembered guard checks were made against the old snapshot.
+		memo.clear();
+	}
+	return *compiled;
+}
+
+// The packed version of the loop in simulator::invalidate(). Only the
+// nets that changed are visited.
+template <int W>
+void invalidate_changes(simulator &sim, const boolean::cube &stripped)
+{
+	packed_cube<W> encoding(stripped);
+	packed_cube<W> global(sim.global);
+	auto unwatch = [&sim](int net) {
+		sim.unwatch(net);
+	};
+	encoding.for_each_change(packed_cube<W>(sim.memo.encoding), unwatch);
+	global.for_each_change(packed_cube<W>(sim.memo.global), unwatch);
+}
+
+// Invalidate the guard checks that read a net whose value has changed since
+// the last call to enabled().
+void simulator::invalidate(const boolean::cube &stripped) {
+	// The graph changed underneath us, none of the checks can be trusted.
+	const compiled_graph &cg = snapshot();
+	if ((int)memo.entries.size() != (int)cg.transitions.size() or (int)memo.watch.size() != cg.nets) {
+		memo.entries.assign(cg.transitions.size(), guard_memo());
+		memo.watch.assign(cg.nets, vector<pair<int, int> >());
+	}
+
+	if (packed_diff and packed_cube<2>::fits(cg.nets)) {
+		invalidate_changes<2>(*this, stripped);
+	} else if (packed_diff and packed_cube<4>::fits(cg.nets)) {
+		invalidate_changes<4>(*this, stripped);
+	} else {
+		for (int v = 0; v < (int)memo.watch.size(); v++) {
+			if (not memo.watch[v].empty() and (stripped.get(v) != memo.encoding.get(v) or global.get(v) != memo.global.get(v))) {
+				unwatch(v);
+			}
+		}
+	}
+
+	memo.encoding = stripped;
+	memo.global = global;
+}
+
+// Invalidate every guard check that read net.
+void simulator::unwatch(int net) {
+	if (net >= (int)memo.watch.size()) {
+		return;
+	}
+
+	for (auto w = memo.watch[net].begin(); w != memo.watch[net].end(); w++) {
+		if (memo.entries[w->first].stamp == w->second) {
+			memo.entries[w->first].stamp = 0;
+		}
+	}
+	memo.watch[net].clear();
+}
+
+// Record the result of a guard check and add it to the watch list of every
+// net that the check read.
+void simulator::remember(int index, const enabled_transition &t, bool previously_enabled, int ready, const boolean::cover &guard) {
+	if (memo.stamp == INT_MAX) {
+		for (auto m = memo.entries.begin(); m != memo.entries.end(); m++) {
+			m->stamp = 0;
+		}
+		for (auto w = memo.watch.begin(); w != memo.watch.end(); w++) {
+			w->clear();
+		}
+		memo.stamp = 0;
+	}
+
+	guard_memo &m = memo.entries[index];
+	m.stamp = ++memo.stamp;
+	m.depend = t.depend;
+	m.assume = t.assume;
+	m.previously_enabled = previously_enabled;
+	m.ready = ready;
+	m.guard_action = t.guard_action;
+	m.vacuous = t.vacuous;
+
+	vector<int> reads = guard.vars();
+	vector<int> assume = t.assume->vars();
+	const vector<int> &remote = snapshot().transitions[index].remote_nets;
+	reads.insert(reads.end(), assume.begin(), assume.end());
+	reads.insert(reads.end(), remote.begin(), remote.end());
+	sort(reads.begin(), reads.end());
+	reads.erase(unique(reads.begin(), reads.end()), reads.end());
+
+	for (auto v = reads.begin(); v != reads.end(); v++) {
+		vector<pair<int, int> > &list = memo.watch[*v];
+		list.push_back(pair<int, int>(index, m.stamp));
+
+		// Entries for checks that were invalidated through some other net are
+		// left behind, so clear them out before the list gets too long.
+		if (list.size() > 2*memo.entries.size()+16) {
+			list.erase(remove_if(list.begin(), list.end(), [this](const pair<int, int> &w) {
+				return memo.entries[w.first].stamp != w.second;
+			}), list.end());
+		}
+	}
 }
 
 state simulator::get_state()
@@ -6,6 +6,10 @@
 #include "graph.h"
 #include "state.h"
 
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+
 namespace hse
 {
 
@@ -60,14 +64,156 @@ struct deadlock : state
 	deadlock();
 	deadlock(const state &s);
 	deadlock(vector<token> tokens, boolean::cube encodings);
+	deadlock(const marking &places, boolean::cube encodings);
 	~deadlock();
 
 	string to_string(const hse::graph &g);
 };
 
+struct diagnostic_sink;
+struct vcd_writer;
+struct compiled_graph;
+
+// Hashes each kind of error by its canonical key: the transition, the term,
+// and the history of firings that caused it. The histories are interned, so
+// they hash in constant time, see term_history.
+struct error_hash
+{
+	size_t operator()(const instability &err) const;
+	size_t operator()(const interference &err) const;
+	size_t operator()(const mutex &err) const;
+};
+
+// The errors found by every simulator in one exploration. The elaborator
+// visits many versions of the same state and would otherwise report the same
+// error over and over again. Simulators copied from one another share a
+// registry, and it is safe to use from multiple threads.
+struct error_registry
+{
+	error_registry();
+	~error_registry();
+
+	std::mutex lock;
+	std::unordered_set<instability, error_hash> instabilities;
+	std::unordered_set<interference, error_hash> interferences;
+	std::unordered_set<mutex, error_hash> mutexes;
+
+	// These return true if the error had not been found before.
+	bool insert(const instability &err);
+	bool insert(const interference &err);
+	bool insert(const mutex &err);
+
+	void merge(error_registry &other);
+	size_t size();
+};
+
 // This keeps track of a single simulation of a set of HSE and makes it easy to
 // control that simulation either through an interactive interface or
 // programmatically.
+// An undo log records the changes that simulator::fire() and
+// simulator::enabled() make to a simulator so that simulator::rollback() can
+// revert them in place. The elaborator uses this to try each enabled
+// transition without copying the whole simulator, only copying it when it
+// finds a state that it hasn't seen before. Logs are meant to be cleared and
+// reused so that their buffers don't have to be reallocated.
+struct undo_log
+{
+	undo_log();
+	~undo_log();
+
+	// Changes made by fire()
+	bool fired;
+	uint64_t now;
+	boolean::cover encoding;
+	boolean::cube global;
+
+	// The original tokens of each entry in simulator::loaded whose tokens were
+	// flattened, indexed before any entries were erased.
+	vector<pair<int, vector<int> > > loaded_tokens;
+
+	// The entries erased from simulator::loaded in the order they were erased
+	// and the index each one was erased from.
+	vector<pair<int, enabled_transition> > loaded_erased;
+
+	// The original causes of the tokens that were promoted by the firing, and
+	// the tokens erased by it in the order they were erased.
+	vector<pair<int, int> > token_causes;
+	vector<pair<int, token> > tokens_erased;
+
+	vector<pair<int, int> > ready;
+
+	// The entries erased from simulator::history in the order they were erased
+	// along with the entry that followed each of them at the time.
+	list<pair<boolean::cube, term_index> > history_erased;
+	vector<list<pair<boolean::cube, term_index> >::iterator> history_next;
+
+	// Changes made by enabled()
+	bool updated;
+	bool replaced;
+	vector<pair<int, token> > enabled_erased;
+
+	// tokens[i] was at permutation[i] before the tokens were sorted. This is
+	// empty if they were already sorted.
+	vector<int> permutation;
+
+	// The number of tokens before enabled() added its own.
+	int tokens_size;
+
+	vector<enabled_transition> loaded;
+	vector<pair<int, int> > enabled_ready;
+
+	void clear();
+};
+
+// The result of checking the guard of a transition in simulator::enabled().
+// When memoizing guards, the simulator keeps one of these for each transition
+// and reuses it for as long as the inputs to the check are unchanged.
+struct guard_memo
+{
+	guard_memo();
+	~guard_memo();
+
+	// Zero if this entry is not valid. Otherwise, it matches the stamp of this
+	// entry in the watch lists of the nets that the check read.
+	int stamp;
+
+	// The inputs to the check other than the state.
+	interned_cover depend;
+	interned_cover assume;
+	bool previously_enabled;
+
+	// The result of the check.
+	int ready;
+	boolean::cube guard_action;
+	bool vacuous;
+};
+
+// The remembered guard checks of a simulator, see simulator::memoize_guards.
+// Copying a simulator copies its table, so the copy goes on reusing the
+// checks. The table stays empty unless memoize_guards is set, so the
+// explorers, which copy simulators constantly, don't pay for it.
+struct guard_memo_table
+{
+	guard_memo_table();
+	guard_memo_table(const guard_memo_table &t);
+	~guard_memo_table();
+
+	guard_memo_table &operator=(const guard_memo_table &t);
+
+	// The memo for each transition, indexed by transition.
+	vector<guard_memo> entries;
+
+	// watch[v] lists the (transition, stamp) of every check that read net v.
+	vector<vector<pair<int, int> > > watch;
+
+	// The encodings at the time of the last call to enabled().
+	boolean::cube encoding;
+	boolean::cube global;
+	int stamp;
+
+	void clear();
+};
+
 struct simulator
 {
 	// This is used by hse::graph to roll up the reset transitions.
@@ -82,10 +228,21 @@ struct simulator
 	// This simulator is also used for elaboration, so a lot of the errors we
 	// encounter may be encountered multiple times as the elaborator visits
 	// different versions of the same state. This record errors of different
-	// types to be deduplicated and displayed at the end of elaboration.
-	vector<instability> instability_errors;
-	vector<interference> interference_errors;
-	vector<mutex> mutex_errors;
+	// types to be deduplicated and displayed at the end of elaboration. Copies
+	// of a simulator share its registry. If this is null, fire() creates one.
+	// Errors stay in the registry after a rollback, since they have already
+	// been reported.
+	std::shared_ptr<error_registry> errors;
+
+	// New errors are reported here. The sink is shared with copies of this
+	// simulator and not owned by it. If this is null, errors are printed as
+	// they are found, see immediate_diagnostics().
+	diagnostic_sink *diagnostics;
+
+	// If this isn't null, fire() writes the value of every net that changed to
+	// this waveform. Like diagnostics, it is shared with copies of this
+	// simulator and not owned by it, see vcd.h.
+	vcd_writer *waveform;
 
 	// This records the set of transitions in the order they were fired.
 	// Currently it is used to help with debugging (an instability happened and
@@ -178,6 +335,8 @@ struct simulator
 	// One could then use this: Carmona, Josep, Jordi Cortadella, and Enric
 	// Pastor. "A structural encoding technique for the synthesis of asynchronous
 	// circuits." Fundamenta Informaticae 50.2 (2002): 135-154.
+	// The production rule engine is in rete.h. It doesn't handle vacuous
+	// transitions, so it's only a drop-in replacement for graphs without them.
 
 	// These transitions could be selected to fire next. An enabled transition is
 	// one in which all of the gates on the pull up or pull down network are
@@ -196,11 +355,49 @@ struct simulator
 
 	uint64_t now;
 
-	int enabled(bool sorted = false);
-	enabled_transition fire(int index);
+	// A firing only changes the value of the nets in its action, so most of the
+	// guards checked by enabled() have the same result as the last time they
+	// were checked. If memoize_guards is set, enabled() remembers the result
+	// of each guard check in memo and lists each check in the watch list of
+	// every net it read. Before the next check, any entry on the watch list
+	// of a net whose value changed is invalidated, and only the checks that
+	// are no longer valid are repeated. This is only a memo of the guard
+	// checks: enabled() still walks the tokens and rebuilds the loaded and
+	// ready transitions on every call. It is meant for long random walks, see
+	// random_walks() and simulate_timed(), and is off by default.
+	//
+	// If packed_diff is set and the graph has at most 128 nets, the nets that
+	// changed since the last call to enabled() are found by comparing packed
+	// copies of the encodings a word at a time instead of one net at a time,
+	// see packed.h. This only affects the invalidation of the guard memo, so
+	// it does nothing unless memoize_guards is set. It is on by default,
+	// turning it off is only useful for benchmarking.
+	bool memoize_guards;
+	bool packed_diff;
+	guard_memo_table memo;
+
+	// The snapshot of base that enabled() and fire() read from, shared with
+	// copies of this simulator and with every other simulator on the same
+	// graph, see compiled.h. snapshot() fetches a new one if base changed.
+	std::shared_ptr<const compiled_graph> compiled;
+	const compiled_graph &snapshot();
+
+	int enabled(bool sorted = false, undo_log *log = nullptr);
+	enabled_transition fire(int index, undo_log *log = nullptr);
+
+	// Revert the changes recorded in log, which must be the most recent
+	// changes made to this simulator. The log is cleared.
+	void rollback(undo_log &log);
 
 	boolean::cube stripped_encoding();
 
+	diagnostic_sink &sink();
+
+	// Used internally by enabled() when memoize_guards is set
+	void invalidate(const boolean::cube &stripped);
+	void unwatch(int net);
+	void remember(int index, const enabled_transition &t, bool previously_enabled, int ready, const boolean::cover &guard);
+
 	void merge_errors(const simulator &sim);
 	state get_state();
 	state get_key();
@@ -10,6 +10,9 @@
 #include "state.h"
 #include "graph.h"
 #include "expression.h"
+#include <common/message.h>
+#include <mutex>
+#include <atomic>
 
 namespace hse
 {
@@ -86,6 +89,707 @@ bool operator!=(term_index i, term_index j)
 	return (i.index != j.index || i.term != j.term);
 }
 
+// A single node of a term_history. parent is the node for the list without
+// this term, or -1.
+struct history_node
+{
+	term_index term;
+	int parent;
+	int size;
+	uint64_t hash;
+};
+
+// Nodes are allocated in fixed size blocks that never move, so a thread can
+// follow a node index it was handed without taking a lock. Interning a new
+// node only locks one of the shards, which are picked by the hash of the
+// node, and each thread keeps a small cache of the nodes it interned
+// recently. Threads also reserve ids history_reserve at a time so that they
+// don't all bump the same counter on every new node, and the shards are
+// aligned to cache lines so that neighboring locks don't share one. The ids
+// are ints, so the arena stops well short of INT_MAX.
+const int history_block_bits = 16;
+const int history_block_size = 1<<history_block_bits;
+const int history_max_blocks = 1<<14;
+const int history_shard_bits = 6;
+const int history_shards = 1<<history_shard_bits;
+const int history_cache_size = 4096;
+const int history_reserve = 256;
+
+struct alignas(64) history_shard
+{
+	history_shard();
+	~history_shard();
+
+	std::mutex lock;
+
+	// Open addressing table from (parent, term) to node, -1 is empty.
+	vector<int> unique;
+	size_t count;
+};
+
+struct history_arena
+{
+	history_arena();
+	~history_arena();
+
+	// Distinguishes this arena from any other arena that was allocated at the
+	// same address, see history_cache.
+	uint64_t serial;
+
+	std::atomic<history_node*> blocks[history_max_blocks];
+	std::atomic<int64_t> count;
+	history_shard shards[history_shards];
+
+	const history_node &at(int node) const;
+	int intern(int parent, term_index term);
+};
+
+// The most recent nodes interned by one thread.
+struct history_cache
+{
+	history_cache();
+	~history_cache();
+
+	struct line
+	{
+		uint64_t serial;
+		int parent;
+		term_index term;
+		int node;
+	};
+
+	line lines[history_cache_size];
+
+	// The ids this thread reserved from the arena with this serial and has
+	// not used yet.
+	uint64_t reserved_serial;
+	int64_t reserved_next;
+	int64_t reserved_end;
+};
+
+std::atomic<uint64_t> history_serial(1);
+
+history_shard::history_shard()
+{
+	unique.resize(64, -1);
+	count = 0;
+}
+
+history_shard::~history_shard()
+{
+}
+
+history_cache::history_cache()
+{
+	for (int i = 0; i < history_cache_size; i++) {
+		lines[i].serial = 0;
+	}
+	reserved_serial = 0;
+	reserved_next = 0;
+	reserved_end = 0;
+}
+
+history_cache::~history_cache()
+{
+}
+
+history_arena::history_arena()
+{
+	serial = history_serial.fetch_add(1);
+	for (int i = 0; i < history_max_blocks; i++) {
+		blocks[i].store(nullptr, std::memory_order_relaxed);
+	}
+	count.store(0);
+}
+
+history_arena::~history_arena()
+{
+	for (int i = 0; i < history_max_blocks; i++) {
+		delete [] blocks[i].load();
+	}
+}
+
+const history_node &history_arena::at(int node) const
+{
+	return blocks[node >> history_block_bits].load(std::memory_order_acquire)[node & (history_block_size-1)];
+}
+
+uint64_t history_hash(uint64_t parent, term_index term)
+{
+	uint64_t result = parent * 0x9E3779B97F4A7C15ull;
+	result ^= (uint64_t)(uint32_t)term.index * 0xC2B2AE3D27D4EB4Full;
+	result ^= (uint64_t)(uint32_t)term.term * 0x165667B19E3779F9ull;
+	return result ^ (result >> 29);
+}
+
+int history_arena::intern(int parent, term_index term)
+{
+	uint64_t hash = history_hash(parent < 0 ? 0 : at(parent).hash, term);
+
+	static thread_local history_cache cache;
+	history_cache::line &line = cache.lines[hash & (history_cache_size-1)];
+	if (line.serial == serial and line.parent == parent and line.term == term) {
+		return line.node;
+	}
+
+	history_shard &shard = shards[hash >> (64-history_shard_bits)];
+	std::lock_guard<std::mutex> guard(shard.lock);
+	size_t mask = shard.unique.size()-1;
+	size_t loc = hash & mask;
+	while (shard.unique[loc] >= 0) {
+		const history_node &n = at(shard.unique[loc]);
+		if (n.parent == parent and n.term == term) {
+			line = history_cache::line{serial, parent, term, shard.unique[loc]};
+			return shard.unique[loc];
+		}
+		loc = (loc+1) & mask;
+	}
+
+	if (cache.reserved_serial != serial or cache.reserved_next >= cache.reserved_end) {
+		// The reservations line up with the blocks, so they never run past the
+		// last one.
+		int64_t start = count.fetch_add(history_reserve);
+		if (start >= (int64_t)history_max_blocks*history_block_size) {
+			// Drop the term rather than index past the last block.
+			internal("", "out of space for transition histories", __FILE__, __LINE__);
+			return parent;
+		}
+		cache.reserved_serial = serial;
+		cache.reserved_next = start;
+		cache.reserved_end = start + history_reserve;
+	}
+
+	int result = (int)cache.reserved_next++;
+	std::atomic<history_node*> &slot = blocks[result >> history_block_bits];
+	history_node *block = slot.load(std::memory_order_acquire);
+	if (block == nullptr) {
+		history_node *fresh = new history_node[history_block_size];
+		if (slot.compare_exchange_strong(block, fresh, std::memory_order_acq_rel)) {
+			block = fresh;
+		} else {
+			delete [] fresh;
+		}
+	}
+	block[result & (history_block_size-1)] = history_node{term, parent, parent < 0 ? 1 : at(parent).size+1, hash};
+	shard.unique[loc] = result;
+
+	if (++shard.count*2 > shard.unique.size()) {
+		vector<int> old(shard.unique.size()*2, -1);
+		old.swap(shard.unique);
+		mask = shard.unique.size()-1;
+		for (auto i = old.begin(); i != old.end(); i++) {
+			if (*i >= 0) {
+				for (loc = at(*i).hash & mask; shard.unique[loc] >= 0; loc = (loc+1) & mask);
+				shard.unique[loc] = *i;
+			}
+		}
+	}
+
+	line = history_cache::line{serial, parent, term, result};
+	return result;
+}
+
+// The arena for the histories made on this thread. This is the arena of the
+// innermost history_scope, or a process wide arena outside of any scope.
+thread_local std::shared_ptr<history_arena> current_histories;
+
+history_arena &histories()
+{
+	if (current_histories != nullptr) {
+		return *current_histories;
+	}
+	static history_arena arena;
+	return arena;
+}
+
+history_scope::history_scope()
+{
+	previous = current_histories;
+	current_histories = std::make_shared<history_arena>();
+}
+
+history_scope::history_scope(std::shared_ptr<history_arena> arena)
+{
+	previous = current_histories;
+	current_histories = arena;
+}
+
+history_scope::~history_scope()
+{
+	current_histories = previous;
+}
+
+std::shared_ptr<history_arena> history_scope::current()
+{
+	return current_histories;
+}
+
+// The pool of the innermost scratch_scope on this thread, if any.
+thread_local std::pmr::memory_resource *current_scratch = nullptr;
+
+scratch_scope::scratch_scope(bool enabled)
+{
+	previous = current_scratch;
+	if (enabled) {
+		current_scratch = &pool;
+	}
+}
+
+scratch_scope::~scratch_scope()
+{
+	current_scratch = previous;
+}
+
+std::pmr::memory_resource *scratch_scope::current()
+{
+	return current_scratch != nullptr ? current_scratch : std::pmr::new_delete_resource();
+}
+
+term_history::term_history()
+{
+	node = -1;
+}
+
+term_history::~term_history()
+{
+}
+
+int term_history::size() const
+{
+	return node < 0 ? 0 : histories().at(node).size;
+}
+
+bool term_history::empty() const
+{
+	return node < 0;
+}
+
+term_index term_history::back() const
+{
+	return histories().at(node).term;
+}
+
+uint64_t term_history::hash() const
+{
+	return node < 0 ? 0 : histories().at(node).hash;
+}
+
+void term_history::push_back(term_index term)
+{
+	node = histories().intern(node, term);
+}
+
+void term_history::pop_back()
+{
+	if (node >= 0) {
+		node = histories().at(node).parent;
+	}
+}
+
+void term_history::clear()
+{
+	node = -1;
+}
+
+vector<term_index> term_history::to_vector() const
+{
+	vector<term_index> result(size());
+	int i = (int)result.size();
+	for (int n = node; n >= 0; n = histories().at(n).parent) {
+		result[--i] = histories().at(n).term;
+	}
+	return result;
+}
+
+bool operator<(const term_history &i, const term_history &j)
+{
+	return i.node != j.node and i.to_vector() < j.to_vector();
+}
+
+bool operator>(const term_history &i, const term_history &j)
+{
+	return j < i;
+}
+
+bool operator<=(const term_history &i, const term_history &j)
+{
+	return not (j < i);
+}
+
+bool operator>=(const term_history &i, const term_history &j)
+{
+	return not (i < j);
+}
+
+bool operator==(const term_history &i, const term_history &j)
+{
+	return i.node == j.node;
+}
+
+bool operator!=(const term_history &i, const term_history &j)
+{
+	return i.node != j.node;
+}
+
+// Covers are stored in fixed size blocks that never move, the same way as
+// history nodes, so that a handle can be followed without taking a lock.
+const int cover_block_bits = 12;
+const int cover_block_size = 1<<cover_block_bits;
+const int cover_max_blocks = 1<<15;
+
+// The intern table and the AND memo are split into independently locked
+// shards by hash, and each thread checks a small cache of its own before
+// it touches a shard. Once the simulator has seen the handful of guards in a
+// design, every lookup is answered by the thread's cache without a lock.
+const int cover_shard_bits = 6;
+const int cover_shards = 1<<cover_shard_bits;
+const int cover_cache_size = 4096;
+
+struct cover_entry
+{
+	boolean::cover value;
+	uint64_t hash;
+};
+
+// A memoized AND of the covers a and b with a < b.
+struct cover_and
+{
+	int a;
+	int b;
+	int result;
+};
+
+// Aligned to a cache line so that threads locking neighboring shards don't
+// contend for the same line.
+struct alignas(64) cover_shard
+{
+	cover_shard();
+	~cover_shard();
+
+	std::mutex lock;
+
+	// Open addressing table from the hash of a cover to its id, -1 is empty.
+	vector<int> unique;
+	size_t count;
+
+	// Open addressing table of memoized ANDs, a is -1 if the entry is empty.
+	vector<cover_and> ands;
+	size_t and_count;
+};
+
+struct cover_table
+{
+	cover_table();
+	~cover_table();
+
+	std::atomic<cover_entry*> blocks[cover_max_blocks];
+	std::atomic<int64_t> count;
+	cover_shard shards[cover_shards];
+
+	const cover_entry &at(int id) const;
+	int intern(const boolean::cover &c);
+	int intersect(int a, int b);
+};
+
+// The most recent lookups made by one thread. The table is never cleared,
+// so entries never go stale.
+struct cover_cache
+{
+	cover_cache();
+	~cover_cache();
+
+	uint64_t intern_hash[cover_cache_size];
+	int intern_id[cover_cache_size];
+	cover_and ands[cover_cache_size];
+};
+
+// The number of 32 bit words in c ignoring the trailing words that are
+// entirely don't-care.
+int significant_words(const boolean::cube &c)
+{
+	int size = (int)c.values.size();
+	while (size > 0 and c.values[size-1] == 0xFFFFFFFFu) {
+		size--;
+	}
+	return size;
+}
+
+uint64_t cover_hash(const boolean::cover &c)
+{
+	uint64_t result = 0xcbf29ce484222325ull ^ (uint64_t)c.cubes.size();
+	for (auto i = c.cubes.begin(); i != c.cubes.end(); i++) {
+		int size = significant_words(*i);
+		for (int j = 0; j < size; j++) {
+			result = (result ^ i->values[j]) * 0x100000001b3ull;
+		}
+		result = (result ^ 0x9E3779B97F4A7C15ull) * 0x100000001b3ull;
+	}
+	return result ^ (result >> 29);
+}
+
+// Whether a and b have the same cubes in the same order.
+bool same_cubes(const boolean::cover &a, const boolean::cover &b)
+{
+	if (a.cubes.size() != b.cubes.size()) {
+		return false;
+	}
+
+	for (int i = 0; i < (int)a.cubes.size(); i++) {
+		int size = significant_words(a.cubes[i]);
+		if (size != significant_words(b.cubes[i])
+			or not std::equal(a.cubes[i].values.begin(), a.cubes[i].values.begin()+size, b.cubes[i].values.begin())) {
+			return false;
+		}
+	}
+	return true;
+}
+
+uint64_t and_hash(int a, int b)
+{
+	uint64_t hash = (uint64_t)(uint32_t)a * 0x9E3779B97F4A7C15ull ^ (uint64_t)(uint32_t)b * 0xC2B2AE3D27D4EB4Full;
+	return hash ^ (hash >> 29);
+}
+
+cover_shard::cover_shard()
+{
+	unique.resize(64, -1);
+	count = 0;
+	ands.resize(64, cover_and{-1, -1, -1});
+	and_count = 0;
+}
+
+cover_shard::~cover_shard()
+{
+}
+
+cover_cache::cover_cache()
+{
+	for (int i = 0; i < cover_cache_size; i++) {
+		intern_hash[i] = 0;
+		intern_id[i] = -1;
+		ands[i] = cover_and{-1, -1, -1};
+	}
+}
+
+cover_cache::~cover_cache()
+{
+}
+
+cover_cache &local_covers()
+{
+	static thread_local cover_cache cache;
+	return cache;
+}
+
+cover_table::cover_table()
+{
+	for (int i = 0; i < cover_max_blocks; i++) {
+		blocks[i].store(nullptr, std::memory_order_relaxed);
+	}
+	count.store(0);
+
+	// These are the ids promised by interned_cover.
+	intern(boolean::cover());
+	intern(boolean::cover(1));
+}
+
+cover_table::~cover_table()
+{
+	for (int i = 0; i < cover_max_blocks; i++) {
+		delete [] blocks[i].load();
+	}
+}
+
+const cover_entry &cover_table::at(int id) const
+{
+	return blocks[id >> cover_block_bits].load(std::memory_order_acquire)[id & (cover_block_size-1)];
+}
+
+int cover_table::intern(const boolean::cover &c)
+{
+	uint64_t hash = cover_hash(c);
+
+	cover_cache &cache = local_covers();
+	int line = (int)(hash & (cover_cache_size-1));
+	if (cache.intern_id[line] >= 0 and cache.intern_hash[line] == hash
+		and same_cubes(at(cache.intern_id[line]).value, c)) {
+		return cache.intern_id[line];
+	}
+
+	cover_shard &shard = shards[hash >> (64-cover_shard_bits)];
+	std::lock_guard<std::mutex> guard(shard.lock);
+	size_t mask = shard.unique.size()-1;
+	size_t loc = hash & mask;
+	while (shard.unique[loc] >= 0) {
+		const cover_entry &e = at(shard.unique[loc]);
+		if (e.hash == hash and same_cubes(e.value, c)) {
+			cache.intern_hash[line] = hash;
+			cache.intern_id[line] = shard.unique[loc];
+			return shard.unique[loc];
+		}
+		loc = (loc+1) & mask;
+	}
+
+	int64_t next = count.fetch_add(1);
+	if (next >= (int64_t)cover_max_blocks*cover_block_size) {
+		internal("", "out of space for interned covers", __FILE__, __LINE__);
+		return 1;
+	}
+
+	int result = (int)next;
+	std::atomic<cover_entry*> &slot = blocks[result >> cover_block_bits];
+	cover_entry *block = slot.load(std::memory_order_acquire);
+	if (block == nullptr) {
+		cover_entry *fresh = new cover_entry[cover_block_size];
+		if (slot.compare_exchange_strong(block, fresh, std::memory_order_acq_rel)) {
+			block = fresh;
+		} else {
+			delete [] fresh;
+		}
+	}
+	block[result & (cover_block_size-1)].value = c;
+	block[result & (cover_block_size-1)].hash = hash;
+	shard.unique[loc] = result;
+
+	if (++shard.count*2 > shard.unique.size()) {
+		vector<int> old(shard.unique.size()*2, -1);
+		old.swap(shard.unique);
+		mask = shard.unique.size()-1;
+		for (auto i = old.begin(); i != old.end(); i++) {
+			if (*i >= 0) {
+				for (loc = at(*i).hash & mask; shard.unique[loc] >= 0; loc = (loc+1) & mask);
+				shard.unique[loc] = *i;
+			}
+		}
+	}
+
+	cache.intern_hash[line] = hash;
+	cache.intern_id[line] = result;
+	return result;
+}
+
+int cover_table::intersect(int a, int b)
+{
+	if (a == b or b == 1) {
+		return a;
+	} else if (a == 1) {
+		return b;
+	} else if (a == 0 or b == 0) {
+		return 0;
+	} else if (a > b) {
+		std::swap(a, b);
+	}
+
+	uint64_t hash = and_hash(a, b);
+	cover_cache &cache = local_covers();
+	cover_and &line = cache.ands[hash & (cover_cache_size-1)];
+	if (line.a == a and line.b == b) {
+		return line.result;
+	}
+
+	cover_shard &shard = shards[hash >> (64-cover_shard_bits)];
+	{
+		std::lock_guard<std::mutex> guard(shard.lock);
+		size_t mask = shard.ands.size()-1;
+		for (size_t loc = hash & mask; shard.ands[loc].a >= 0; loc = (loc+1) & mask) {
+			if (shard.ands[loc].a == a and shard.ands[loc].b == b) {
+				line = shard.ands[loc];
+				return line.result;
+			}
+		}
+	}
+
+	// Compute the AND without holding the lock. If another thread gets here
+	// first, both find the same id.
+	int result = intern(at(a).value & at(b).value);
+	line = cover_and{a, b, result};
+
+	std::lock_guard<std::mutex> guard(shard.lock);
+	size_t mask = shard.ands.size()-1;
+	size_t loc = hash & mask;
+	for (; shard.ands[loc].a >= 0; loc = (loc+1) & mask) {
+		if (shard.ands[loc].a == a and shard.ands[loc].b == b) {
+			return result;
+		}
+	}
+	shard.ands[loc] = line;
+
+	if (++shard.and_count*2 > shard.ands.size()) {
+		vector<cover_and> old(shard.ands.size()*2, cover_and{-1, -1, -1});
+		old.swap(shard.ands);
+		mask = shard.ands.size()-1;
+		for (auto i = old.begin(); i != old.end(); i++) {
+			if (i->a >= 0) {
+				for (loc = and_hash(i->a, i->b) & mask; shard.ands[loc].a >= 0; loc = (loc+1) & mask);
+				shard.ands[loc] = *i;
+			}
+		}
+	}
+	return result;
+}
+
+cover_table &covers()
+{
+	static cover_table table;
+	return table;
+}
+
+interned_cover::interned_cover()
+{
+	id = 0;
+}
+
+interned_cover::interned_cover(int value)
+{
+	if (value == 0 or value == 1) {
+		id = value;
+	} else {
+		id = covers().intern(boolean::cover(value));
+	}
+}
+
+interned_cover::interned_cover(const boolean::cover &c)
+{
+	id = covers().intern(c);
+}
+
+interned_cover::~interned_cover()
+{
+}
+
+const boolean::cover &interned_cover::get() const
+{
+	return covers().at(id).value;
+}
+
+const boolean::cover *interned_cover::operator->() const
+{
+	return &covers().at(id).value;
+}
+
+interned_cover &interned_cover::operator&=(const interned_cover &c)
+{
+	id = covers().intersect(id, c.id);
+	return *this;
+}
+
+interned_cover operator&(const interned_cover &a, const interned_cover &b)
+{
+	interned_cover result;
+	result.id = covers().intersect(a.id, b.id);
+	return result;
+}
+
+bool operator==(const interned_cover &a, const interned_cover &b)
+{
+	return a.id == b.id;
+}
+
+bool operator!=(const interned_cover &a, const interned_cover &b)
+{
+	return a.id != b.id;
+}
+
 enabled_transition::enabled_transition()
 {
 	index = 0;
@@ -181,7 +885,7 @@ token::token(petri::token t)
 	sequence = 1;
 }
 
-token::token(int index, boolean::cover assume, boolean::cover guard, boolean::cover sequence, int cause)
+token::token(int index, interned_cover assume, interned_cover guard, interned_cover sequence, int cause)
 {
 	this->index = index;
 	this->guard = guard;
@@ -220,6 +924,12 @@ state::state(vector<hse::token> tokens, boolean::cover encodings)
 	this->encodings = encodings;
 }
 
+state::state(const hse::marking &places, boolean::cover encodings)
+{
+	this->tokens = places.tokens();
+	this->encodings = encodings;
+}
+
 state::~state()
 {
 
@@ -230,14 +940,16 @@ void state::hash(hasher &hash) const
 	hash.put(&tokens);
 }
 
+hse::marking state::get_marking() const
+{
+	return hse::marking(tokens);
+}
+
 state state::merge(const state &s0, const state &s1)
 {
 	state result;
 
-	result.tokens.resize(s0.tokens.size() + s1.tokens.size());
-	::merge(s0.tokens.begin(), s0.tokens.end(), s1.tokens.begin(), s1.tokens.end(), result.tokens.begin());
-	result.tokens.resize(unique(result.tokens.begin(), result.tokens.end()) - result.tokens.begin());
-
+	result.tokens = (s0.get_marking() | s1.get_marking()).tokens();
 	result.encodings = s0.encodings & s1.encodings;
 
 	return result;
@@ -6,7 +6,11 @@
 #include <petri/state.h>
 #include <petri/graph.h>
 
+#include "marking.h"
+
 #include <bit>
+#include <memory>
+#include <memory_resource>
 
 namespace hse
 {
@@ -38,6 +42,114 @@ bool operator>=(term_index i, term_index j);
 bool operator==(term_index i, term_index j);
 bool operator!=(term_index i, term_index j);
 
+struct history_arena;
+
+// Makes a history arena the arena of the current thread for as long as this
+// object lives, see term_history. The default constructor starts a new
+// arena, the other one joins an existing arena so that the worker threads of
+// an exploration can share it. The arena is freed in bulk once the last
+// scope that uses it is gone, so histories made inside a scope must not be
+// used outside of it. Diagnostics store plain term lists for this reason.
+struct history_scope
+{
+	history_scope();
+	history_scope(std::shared_ptr<history_arena> arena);
+	~history_scope();
+
+	// The arena that was current when this scope was opened.
+	std::shared_ptr<history_arena> previous;
+
+	// The arena of the innermost scope on this thread, null outside of any
+	// scope.
+	static std::shared_ptr<history_arena> current();
+};
+
+// Makes a pool the scratch memory of the current thread for as long as this
+// object lives. The simulator builds and throws away a handful of small
+// vectors on every call to enabled() and fire(). Drawn from the pool, their
+// storage is recycled instead of going back to the global allocator, and it
+// is all released at once when the scope ends. Outside of any scope, or if
+// the scope was disabled, scratch memory comes from the global allocator.
+// Every thread of an exploration opens its own scope since the pool isn't
+// thread safe.
+struct scratch_scope
+{
+	scratch_scope(bool enabled = true);
+	~scratch_scope();
+
+	std::pmr::memory_resource *previous;
+	std::pmr::unsynchronized_pool_resource pool;
+
+	// The scratch memory of the innermost scope on this thread.
+	static std::pmr::memory_resource *current();
+};
+
+// A persistent list of the terms fired since a transition was enabled. Lists
+// that share a prefix share the nodes for that prefix, and every node is
+// interned in the arena of the current history_scope, or in an arena that
+// lives as long as the process outside of any scope. So two lists are equal
+// exactly when they end at the same node, and copying, appending, and
+// checking for equality all take constant time. The explorers each open a
+// scope so that their histories are released when they finish.
+struct term_history
+{
+	term_history();
+	~term_history();
+
+	// The index of the newest node in this list, or -1 if it is empty.
+	int node;
+
+	int size() const;
+	bool empty() const;
+	term_index back() const;
+	uint64_t hash() const;
+
+	void push_back(term_index term);
+	void pop_back();
+	void clear();
+
+	// The terms in this list from the oldest to the newest.
+	vector<term_index> to_vector() const;
+};
+
+bool operator<(const term_history &i, const term_history &j);
+bool operator>(const term_history &i, const term_history &j);
+bool operator<=(const term_history &i, const term_history &j);
+bool operator>=(const term_history &i, const term_history &j);
+bool operator==(const term_history &i, const term_history &j);
+bool operator!=(const term_history &i, const term_history &j);
+
+// A handle to a cover that is stored once in a table shared by all threads.
+// Covers with the same cubes in the same order get the same id, so copying a
+// handle or comparing two of them is a single integer operation no matter
+// how large the cover is. The AND of two handles is memoized by the pair of
+// ids since the simulator combines the same few guards over and over.
+// Covers are never freed, but interning bounds the table by the number of
+// distinct covers. id 0 is always the empty cover and id 1 is always the
+// tautology.
+//
+// Interning a cover has to hash it, so the conversion from a cover is
+// explicit. Anything that is used on every step, like the guards of the
+// graph, should be interned once up front, see compiled_transition.
+struct interned_cover
+{
+	interned_cover();
+	interned_cover(int value);
+	explicit interned_cover(const boolean::cover &c);
+	~interned_cover();
+
+	int id;
+
+	const boolean::cover &get() const;
+	const boolean::cover *operator->() const;
+
+	interned_cover &operator&=(const interned_cover &c);
+};
+
+interned_cover operator&(const interned_cover &a, const interned_cover &b);
+bool operator==(const interned_cover &a, const interned_cover &b);
+bool operator!=(const interned_cover &a, const interned_cover &b);
+
 // This stores all the information necessary to fire an enabled transition: the local
 // and remote tokens that enable it, and the total state of those tokens.
 struct enabled_transition : petri::enabled_transition
@@ -45,8 +157,13 @@ struct enabled_transition : petri::enabled_transition
 	enabled_transition();
 	enabled_transition(int index);
 	enabled_transition(int index, int term);
+	enabled_transition(const enabled_transition &t) = default;
+	enabled_transition(enabled_transition &&t) = default;
 	~enabled_transition();
 
+	enabled_transition &operator=(const enabled_transition &t) = default;
+	enabled_transition &operator=(enabled_transition &&t) = default;
+
 	// inherited from petri::enabled_transition
 	// int index;
 	// vector<int> tokens;
@@ -61,7 +178,7 @@ struct enabled_transition : petri::enabled_transition
 	// between when this transition was enabled and when it fires. This allows us
 	// to determine whether this transition was stable and non-interfering when
 	// we finally decide to let the event fire.
-	vector<term_index> history;
+	term_history history;
 	
 	// The intersection of all of the terms of the guard of this transition which
 	// the current state passed. This is recorded by boolean::passes_guard(),
@@ -71,19 +188,19 @@ struct enabled_transition : petri::enabled_transition
 	// The effective guard of this enabled transition. The definition of
 	// "effective guard" is a bit lengthy, see simulator.cpp for a thorough
 	// discussion.
-	boolean::cover guard;
+	interned_cover guard;
 
 	// The collection of all the guards through vacuous transitions leading to
 	// this transition.
-	boolean::cover depend;
+	interned_cover depend;
 
 	// The collection of all assumptions through vacuous transitions leading to
 	// this transition.
-	boolean::cover assume;
+	interned_cover assume;
 
 	// The set of assignments up to and including the last non-vacuous assignment
 	// preceding this enabled transition.
-	boolean::cover sequence;
+	interned_cover sequence;
 
 	// An enabled transition is vacuous if the assignment would leave the current
 	// state encoding unaffected.
@@ -114,21 +231,26 @@ struct token : petri::token
 	//token(const hse::token &t);
 	//token(petri::token t, boolean::cover guard, boolean::cover sequence);
 	token(petri::token t);
-	token(int index, boolean::cover assume, boolean::cover guard, boolean::cover sequence, int cause=-1);
+	token(int index, interned_cover assume, interned_cover guard, interned_cover sequence, int cause=-1);
+	token(const token &t) = default;
+	token(token &&t) = default;
 	~token();
 
+	token &operator=(const token &t) = default;
+	token &operator=(token &&t) = default;
+
 	// The current place this token resides at.
 	// inherited from petri::token
 	// int index
 
 	// Contains the previous guards not acknowledged by a non-vacuous transition.
-	boolean::cover guard;
+	interned_cover guard;
 
 	// Contains the previous assumptions not implemented by a non-vacuous transition.
-	boolean::cover assume;
+	interned_cover assume;
 
 	// Contains the previous assignments experienced by the input tokens.
-	boolean::cover sequence;
+	interned_cover sequence;
 
 	// If this token is an extension of the base
 	// state through a vacuous transition, which
@@ -152,6 +274,7 @@ struct state : petri::state<petri::token>
 	state();
 	state(vector<petri::token> tokens, boolean::cover encodings);
 	state(vector<hse::token> tokens, boolean::cover encodings);
+	state(const hse::marking &places, boolean::cover encodings);
 	~state();
 
 	// The tokens marking our location in the HSE
@@ -163,6 +286,10 @@ struct state : petri::state<petri::token>
 
 	void hash(hasher &hash) const;
 
+	// The tokens as a set of places. This assumes that no place holds more
+	// than one token, see marking.
+	hse::marking get_marking() const;
+
 	static state merge(const state &s0, const state &s1);
 	static state collapse(int index, const state &s);
 	state convert(map<petri::iterator, vector<petri::iterator> > translate) const;
@@ -188,6 +315,20 @@ template<> struct hash<hse::state> {
 			int r = i%32;
 			result = result ^ ((value << r) | (value >> (32-r)));
 		}
+
+		// Fold in the encodings as well, otherwise every state with the same
+		// marking lands in the same bucket. Trailing words that are entirely
+		// don't-care are implied and skipped.
+		for (auto c = s.encodings.cubes.begin(); c != s.encodings.cubes.end(); c++) {
+			int size = (int)c->values.size();
+			while (size > 0 and c->values[size-1] == 0xFFFFFFFFu) {
+				size--;
+			}
+			for (int i = 0; i < size; i++) {
+				result = (result ^ c->values[i]) * 0x100000001b3ull;
+			}
+			result = (result ^ size) * 0x100000001b3ull;
+		}
 		return result;
 	}
 };
@@ -0,0 +1,777 @@
+#include "state_store.h"
+#include "serialize.h"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <random>
+
+namespace hse
+{
+
+// The number of records between entries in the sparse index of a run.
+const int run_block_size = 64;
+
+// The number of bits per key and number of hash functions for the Bloom
+// filter of a run. This gives a false positive rate of about 1%.
+const int bloom_bits_per_key = 10;
+const int bloom_hashes = 7;
+
+// Merge all of the runs into one once there are this many of them.
+const int max_runs = 16;
+
+string spill_path(string directory, string kind)
+{
+	static std::atomic<uint64_t> next(0);
+	static uint64_t tag = ((uint64_t)std::random_device()() << 32) ^ (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+
+	if (directory.empty()) {
+		directory = std::filesystem::temp_directory_path().string();
+	}
+
+	return (std::filesystem::path(directory) / ("hse_" + kind + "_" + ::to_string(tag) + "_" + ::to_string(next++) + ".bin")).string();
+}
+
+void bloom_probes(uint64_t hash, uint64_t *h1, uint64_t *h2)
+{
+	*h1 = hash;
+	*h2 = ((hash >> 32) ^ (hash * 0x9E3779B97F4A7C15ull)) | 1;
+}
+
+void write_record(FILE *fptr, const string &key)
+{
+	byte_writer header;
+	header.write_uint(key.size());
+	fwrite(header.data.data(), 1, header.data.size(), fptr);
+	fwrite(key.data(), 1, key.size(), fptr);
+}
+
+bool read_record(FILE *fptr, string &key)
+{
+	uint64_t length = 0;
+	for (int shift = 0; ; shift += 7) {
+		int c = fgetc(fptr);
+		if (c == EOF or shift > 63) {
+			return false;
+		}
+		length |= (uint64_t)(c & 0x7F) << shift;
+		if ((c & 0x80) == 0) {
+			break;
+		}
+	}
+
+	key.resize(length);
+	return fread(key.data(), 1, length, fptr) == length;
+}
+
+// Parse the records of a block that has already been read into memory.
+void read_records(const vector<uint8_t> &buffer, vector<string> &keys)
+{
+	byte_reader reader(buffer.data(), buffer.size());
+	while (not reader.done()) {
+		size_t length = reader.read_uint();
+		keys.push_back(string((const char*)buffer.data() + reader.offset, length));
+		reader.offset += length;
+	}
+}
+
+void read_block(FILE *fptr, uint64_t from, uint64_t to, vector<uint8_t> &buffer)
+{
+	buffer.resize(to - from);
+	fseek(fptr, (long)from, SEEK_SET);
+	if (fread(buffer.data(), 1, buffer.size(), fptr) != buffer.size()) {
+		internal("", "unable to read spilled states", __FILE__, __LINE__);
+	}
+}
+
+// Write a new run to disk. next() returns the keys in sorted order and false
+// once there are no keys left. count is the total number of keys and is used
+// to size the Bloom filter.
+state_run *write_run(string path, size_t count, std::function<bool(string&)> next)
+{
+	state_run *result = new state_run();
+	result->path = path;
+	result->fptr = fopen(path.c_str(), "w+b");
+	if (result->fptr == nullptr) {
+		error("", "unable to open '" + path + "' to spill visited states", __FILE__, __LINE__);
+		delete result;
+		return nullptr;
+	}
+
+	size_t bits = max((size_t)64, count*bloom_bits_per_key);
+	result->bloom.resize((bits+63)/64, 0);
+	bits = result->bloom.size()*64;
+
+	uint64_t offset = 0;
+	string key;
+	while (next(key)) {
+		if (result->count%run_block_size == 0) {
+			result->index_keys.push_back(key);
+			result->index_offsets.push_back(offset);
+		}
+
+		uint64_t h1, h2;
+		bloom_probes(hash_bytes((const uint8_t*)key.data(), key.size()), &h1, &h2);
+		for (int i = 0; i < bloom_hashes; i++) {
+			uint64_t bit = (h1 + i*h2)%bits;
+			result->bloom[bit/64] |= (1ull << (bit%64));
+		}
+
+		write_record(result->fptr, key);
+		offset = (uint64_t)ftell(result->fptr);
+		result->count++;
+	}
+	result->index_offsets.push_back(offset);
+	fflush(result->fptr);
+
+	return result;
+}
+
+state_run::state_run()
+{
+	fptr = nullptr;
+	count = 0;
+}
+
+state_run::~state_run()
+{
+	close();
+}
+
+bool state_run::may_contain(uint64_t hash) const
+{
+	if (bloom.empty()) {
+		return false;
+	}
+
+	uint64_t bits = bloom.size()*64;
+	uint64_t h1, h2;
+	bloom_probes(hash, &h1, &h2);
+	for (int i = 0; i < bloom_hashes; i++) {
+		uint64_t bit = (h1 + i*h2)%bits;
+		if ((bloom[bit/64] & (1ull << (bit%64))) == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool state_run::contains(const string &key, uint64_t hash)
+{
+	if (fptr == nullptr or not may_contain(hash)) {
+		return false;
+	}
+
+	auto block = upper_bound(index_keys.begin(), index_keys.end(), key);
+	if (block == index_keys.begin()) {
+		return false;
+	}
+	int b = (int)(block - index_keys.begin()) - 1;
+
+	vector<uint8_t> buffer;
+	read_block(fptr, index_offsets[b], index_offsets[b+1], buffer);
+
+	vector<string> keys;
+	read_records(buffer, keys);
+	return binary_search(keys.begin(), keys.end(), key);
+}
+
+void state_run::close()
+{
+	if (fptr != nullptr) {
+		fclose(fptr);
+		fptr = nullptr;
+		std::remove(path.c_str());
+	}
+}
+
+state_store::state_store()
+{
+	budget = 0;
+	count = 0;
+}
+
+state_store::state_store(size_t budget, string directory)
+{
+	this->budget = budget;
+	this->directory = directory;
+	count = 0;
+}
+
+state_store::~state_store()
+{
+	clear();
+}
+
+bool state_store::insert(const state &s)
+{
+	if (runs.empty()) {
+		bool inserted = false;
+		hot.insert(s, 0, &inserted);
+		if (not inserted) {
+			return false;
+		}
+	} else {
+		if (hot.find(s) >= 0) {
+			return false;
+		}
+
+		byte_writer writer;
+		writer.write(s);
+		string key((const char*)writer.data.data(), writer.data.size());
+		uint64_t hash = hash_bytes(writer.data.data(), writer.data.size());
+		for (int i = (int)runs.size()-1; i >= 0; i--) {
+			if (runs[i]->contains(key, hash)) {
+				return false;
+			}
+		}
+
+		hot.insert(s);
+	}
+	count++;
+
+	if (budget > 0 and hot.bytes() > budget) {
+		spill();
+	}
+	return true;
+}
+
+size_t state_store::size() const
+{
+	return count;
+}
+
+void state_store::spill()
+{
+	if (hot.size() == 0) {
+		return;
+	}
+
+	vector<string> keys;
+	keys.reserve(hot.size());
+	byte_writer writer;
+	for (int i = 0; i < (int)hot.slots.size(); i++) {
+		if (hot.is_valid(i)) {
+			writer.clear();
+			writer.write(hot.key(i));
+			keys.push_back(string((const char*)writer.data.data(), writer.data.size()));
+		}
+	}
+	sort(keys.begin(), keys.end());
+
+	auto i = keys.begin();
+	state_run *run = write_run(spill_path(directory, "states"), keys.size(), [&](string &key) {
+		if (i == keys.end()) {
+			return false;
+		}
+		key = *(i++);
+		return true;
+	});
+
+	// If we can't write to disk, then we just have to keep going in memory.
+	if (run == nullptr) {
+		budget = 0;
+		return;
+	}
+
+	runs.push_back(run);
+	hot.clear();
+
+	if ((int)runs.size() >= max_runs) {
+		compact();
+	}
+}
+
+// A sequential reader over the records of a run used to merge runs.
+struct run_cursor
+{
+	run_cursor(state_run *run) : run(run), block(0), index(0) {
+		load();
+	}
+	~run_cursor() {}
+
+	state_run *run;
+	int block;
+	vector<string> keys;
+	int index;
+
+	void load() {
+		keys.clear();
+		index = 0;
+		if (block+1 < (int)run->index_offsets.size()) {
+			vector<uint8_t> buffer;
+			read_block(run->fptr, run->index_offsets[block], run->index_offsets[block+1], buffer);
+			read_records(buffer, keys);
+		}
+	}
+
+	bool done() const {
+		return index >= (int)keys.size();
+	}
+
+	void next() {
+		if (++index >= (int)keys.size()) {
+			block++;
+			load();
+		}
+	}
+};
+
+void state_store::compact()
+{
+	if (runs.size() < 2) {
+		return;
+	}
+
+	size_t total = 0;
+	vector<run_cursor> cursors;
+	for (auto i = runs.begin(); i != runs.end(); i++) {
+		total += (*i)->count;
+		cursors.push_back(run_cursor(*i));
+	}
+
+	// There are only a handful of runs, so a linear scan for the smallest key
+	// is faster than a heap. The runs are disjoint, so there are no
+	// duplicates to remove.
+	state_run *merged = write_run(spill_path(directory, "states"), total, [&](string &key) {
+		int best = -1;
+		for (int i = 0; i < (int)cursors.size(); i++) {
+			if (not cursors[i].done() and (best < 0 or cursors[i].keys[cursors[i].index] < cursors[best].keys[cursors[best].index])) {
+				best = i;
+			}
+		}
+
+		if (best < 0) {
+			return false;
+		}
+
+		key = cursors[best].keys[cursors[best].index];
+		cursors[best].next();
+		return true;
+	});
+
+	if (merged == nullptr) {
+		return;
+	}
+
+	for (auto i = runs.begin(); i != runs.end(); i++) {
+		delete *i;
+	}
+	runs.clear();
+	runs.push_back(merged);
+}
+
+void state_store::save(FILE *fptr)
+{
+	byte_writer writer;
+	writer.write_uint(count);
+	write_record(fptr, string((const char*)writer.data.data(), writer.data.size()));
+
+	for (int i = 0; i < (int)hot.slots.size(); i++) {
+		if (not hot.is_valid(i)) continue;
+
+		writer.clear();
+		writer.write(hot.key(i));
+		write_record(fptr, string((const char*)writer.data.data(), writer.data.size()));
+	}
+
+	for (auto r = runs.begin(); r != runs.end(); r++) {
+		for (run_cursor cursor(*r); not cursor.done(); cursor.next()) {
+			write_record(fptr, cursor.keys[cursor.index]);
+		}
+	}
+}
+
+bool state_store::load(FILE *fptr)
+{
+	string record;
+	if (not read_record(fptr, record)) {
+		return false;
+	}
+	byte_reader header((const uint8_t*)record.data(), record.size());
+	size_t total = header.read_uint();
+
+	for (size_t i = 0; i < total; i++) {
+		if (not read_record(fptr, record)) {
+			return false;
+		}
+
+		state s;
+		byte_reader reader((const uint8_t*)record.data(), record.size());
+		reader.read(s);
+		insert(s);
+	}
+	return true;
+}
+
+void state_store::clear()
+{
+	for (auto i = runs.begin(); i != runs.end(); i++) {
+		delete *i;
+	}
+	runs.clear();
+	hot.clear();
+	count = 0;
+}
+
+// Roughly estimate the number of bytes of memory used by a simulator. This
+// doesn't need to be exact, it just needs to scale with the real thing so that
+// the memory budget means something.
+size_t estimate_size(const boolean::cube &c)
+{
+	return sizeof(boolean::cube) + c.values.size()*sizeof(unsigned int);
+}
+
+size_t estimate_size(const boolean::cover &c)
+{
+	size_t result = sizeof(boolean::cover);
+	for (auto i = c.cubes.begin(); i != c.cubes.end(); i++) {
+		result += estimate_size(*i);
+	}
+	return result;
+}
+
+size_t estimate_size(const simulator &sim)
+{
+	size_t result = sizeof(simulator);
+	result += estimate_size(sim.encoding) + estimate_size(sim.global);
+	for (auto i = sim.history.begin(); i != sim.history.end(); i++) {
+		result += 2*sizeof(void*) + sizeof(term_index) + estimate_size(i->first);
+	}
+	for (auto i = sim.tokens.begin(); i != sim.tokens.end(); i++) {
+		result += sizeof(hse::token);
+	}
+	// The guards, assumptions, and sequences are interned and shared between
+	// simulators, so they are only counted as the size of their handles.
+	for (auto i = sim.loaded.begin(); i != sim.loaded.end(); i++) {
+		result += sizeof(enabled_transition)
+			+ (i->tokens.size() + i->output_marking.size())*sizeof(int)
+			+ estimate_size(i->guard_action);
+	}
+	result += sim.ready.size()*sizeof(pair<int, int>);
+	return result;
+}
+
+simulator_pool::simulator_pool()
+{
+	recycle = true;
+}
+
+simulator_pool::~simulator_pool()
+{
+	clear();
+}
+
+simulator *simulator_pool::acquire(const simulator &sim)
+{
+	if (spare.empty()) {
+		return new simulator(sim);
+	}
+
+	simulator *result = spare.back();
+	spare.pop_back();
+	*result = sim;
+	return result;
+}
+
+void simulator_pool::release(simulator *sim)
+{
+	if (recycle) {
+		spare.push_back(sim);
+	} else {
+		delete sim;
+	}
+}
+
+void simulator_pool::clear()
+{
+	for (auto i = spare.begin(); i != spare.end(); i++) {
+		delete *i;
+	}
+	spare.clear();
+}
+
+simulation_stack::simulation_stack()
+{
+	base = nullptr;
+	budget = 0;
+	resident_bytes = 0;
+	count = 0;
+}
+
+simulation_stack::simulation_stack(graph *base, size_t budget, string directory)
+{
+	this->base = base;
+	this->budget = budget;
+	this->directory = directory;
+	resident_bytes = 0;
+	count = 0;
+}
+
+simulation_stack::~simulation_stack()
+{
+	clear();
+}
+
+void simulation_stack::push_back(const simulator &sim)
+{
+	resident.push_back(pool.acquire(sim));
+	count++;
+
+	if (budget > 0) {
+		footprint.push_back(estimate_size(sim));
+		resident_bytes += footprint.back();
+		if (resident_bytes > budget) {
+			spill();
+		}
+	}
+}
+
+void simulation_stack::pop_back(simulator &sim)
+{
+	if (resident.empty()) {
+		reload();
+	}
+
+	sim = *resident.back();
+	pool.release(resident.back());
+	resident.pop_back();
+	count--;
+
+	if (not footprint.empty()) {
+		resident_bytes -= footprint.back();
+		footprint.pop_back();
+	}
+}
+
+bool simulation_stack::empty() const
+{
+	return count == 0;
+}
+
+size_t simulation_stack::size() const
+{
+	return count;
+}
+
+size_t simulation_stack::erase_if(std::function<bool(simulator &)> dominated)
+{
+	deque<simulator*> kept;
+	deque<size_t> kept_footprint;
+	size_t removed = 0;
+	for (size_t i = 0; i < resident.size(); i++) {
+		if (dominated(*resident[i])) {
+			pool.release(resident[i]);
+			removed++;
+			if (not footprint.empty()) {
+				resident_bytes -= footprint[i];
+			}
+		} else {
+			kept.push_back(resident[i]);
+			if (not footprint.empty()) {
+				kept_footprint.push_back(footprint[i]);
+			}
+		}
+	}
+
+	resident.swap(kept);
+	footprint.swap(kept_footprint);
+	count -= removed;
+	return removed;
+}
+
+void simulation_stack::spill()
+{
+	// Keep the newest half resident since that's what the depth first search
+	// is going to need next.
+	size_t total = resident.size()/2;
+	if (total == 0) {
+		return;
+	}
+
+	string path = spill_path(directory, "frontier");
+	FILE *fptr = fopen(path.c_str(), "wb");
+	if (fptr == nullptr) {
+		error("", "unable to open '" + path + "' to spill pending simulations", __FILE__, __LINE__);
+		budget = 0;
+		footprint.clear();
+		resident_bytes = 0;
+		return;
+	}
+
+	byte_writer writer;
+	for (size_t i = 0; i < total; i++) {
+		writer.clear();
+		writer.write(*resident.front());
+		write_record(fptr, string((const char*)writer.data.data(), writer.data.size()));
+
+		pool.release(resident.front());
+		resident.pop_front();
+		resident_bytes -= footprint.front();
+		footprint.pop_front();
+	}
+	fclose(fptr);
+
+	segments.push_back(pair<string, size_t>(path, total));
+}
+
+void simulation_stack::reload()
+{
+	if (segments.empty()) {
+		internal("", "pop from an empty simulation stack", __FILE__, __LINE__);
+		return;
+	}
+
+	string path = segments.back().first;
+	segments.pop_back();
+
+	FILE *fptr = fopen(path.c_str(), "rb");
+	if (fptr == nullptr) {
+		internal("", "unable to reload pending simulations from '" + path + "'", __FILE__, __LINE__);
+		return;
+	}
+
+	fseek(fptr, 0, SEEK_END);
+	long length = ftell(fptr);
+	vector<uint8_t> buffer;
+	read_block(fptr, 0, (uint64_t)length, buffer);
+	fclose(fptr);
+	std::remove(path.c_str());
+
+	byte_reader reader(buffer.data(), buffer.size());
+	while (not reader.done()) {
+		size_t length = reader.read_uint();
+		byte_reader record(buffer.data() + reader.offset, length);
+		reader.offset += length;
+
+		simulator sim;
+		record.read(sim, base);
+		resident.push_back(pool.acquire(sim));
+		if (budget > 0) {
+			footprint.push_back(estimate_size(sim));
+			resident_bytes += footprint.back();
+		}
+	}
+}
+
+void simulation_stack::save(FILE *fptr)
+{
+	byte_writer writer;
+	writer.write_uint(count);
+	write_record(fptr, string((const char*)writer.data.data(), writer.data.size()));
+
+	for (auto i = segments.begin(); i != segments.end(); i++) {
+		FILE *segment = fopen(i->first.c_str(), "rb");
+		if (segment == nullptr) {
+			internal("", "unable to read pending simulations from '" + i->first + "'", __FILE__, __LINE__);
+			continue;
+		}
+
+		string record;
+		while (read_record(segment, record)) {
+			write_record(fptr, record);
+		}
+		fclose(segment);
+	}
+
+	for (auto i = resident.begin(); i != resident.end(); i++) {
+		writer.clear();
+		writer.write(**i);
+		write_record(fptr, string((const char*)writer.data.data(), writer.data.size()));
+	}
+}
+
+bool simulation_stack::load(FILE *fptr)
+{
+	string record;
+	if (not read_record(fptr, record)) {
+		return false;
+	}
+	byte_reader header((const uint8_t*)record.data(), record.size());
+	size_t total = header.read_uint();
+
+	for (size_t i = 0; i < total; i++) {
+		if (not read_record(fptr, record)) {
+			return false;
+		}
+
+		simulator sim;
+		byte_reader reader((const uint8_t*)record.data(), record.size());
+		reader.read(sim, base);
+		push_back(sim);
+	}
+	return true;
+}
+
+void simulation_stack::clear()
+{
+	for (auto i = segments.begin(); i != segments.end(); i++) {
+		std::remove(i->first.c_str());
+	}
+	segments.clear();
+	for (auto i = resident.begin(); i != resident.end(); i++) {
+		pool.release(*i);
+	}
+	resident.clear();
+	pool.clear();
+	footprint.clear();
+	resident_bytes = 0;
+	count = 0;
+}
+
+subsumption_index::subsumption_index()
+{
+	checked = 0;
+	pruned = 0;
+}
+
+subsumption_index::~subsumption_index()
+{
+}
+
+bool subsumption_index::insert(state s)
+{
+	checked++;
+	vector<state> &visited = markings[s.get_marking()];
+	for (auto i = visited.begin(); i != visited.end(); i++) {
+		if (s.is_subset_of(*i)) {
+			pruned++;
+			return false;
+		}
+	}
+
+	for (auto i = visited.begin(); i != visited.end(); ) {
+		if (i->is_subset_of(s)) {
+			i = visited.erase(i);
+		} else {
+			i++;
+		}
+	}
+	visited.push_back(s);
+	return true;
+}
+
+bool subsumption_index::contains(const state &s) const
+{
+	auto loc = markings.find(s.get_marking());
+	if (loc == markings.end()) {
+		return false;
+	}
+
+	for (auto i = loc->second.begin(); i != loc->second.end(); i++) {
+		if (i->tokens == s.tokens and i->encodings == s.encodings) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void subsumption_index::clear()
+{
+	markings.clear();
+	checked = 0;
+	pruned = 0;
+}
+
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <common/standard.h>
+#include <deque>
+#include <functional>
+#include <cstdio>
+#include "state.h"
+#include "simulator.h"
+#include "state_table.h"
+
+namespace hse
+{
+
+// Returns a new unique file path in directory for spilled data. If directory
+// is empty, the system's temporary directory is used.
+string spill_path(string directory, string kind);
+
+// Write a length prefixed record to a file and read one back. read_record
+// returns false at the end of the file.
+void write_record(FILE *fptr, const string &key);
+bool read_record(FILE *fptr, string &key);
+
+// A sorted run of serialized states that was spilled to disk. The run is
+// checked with a Bloom filter before we ever touch the disk, and a sparse
+// index of the first key in every block of records narrows each lookup down
+// to a single block read.
+struct state_run
+{
+	state_run();
+	~state_run();
+
+	string path;
+	FILE *fptr;
+	size_t count;
+
+	vector<uint64_t> bloom;
+
+	// index_keys[i] is the first key in block i, stored at index_offsets[i].
+	// The last offset is the end of the file.
+	vector<string> index_keys;
+	vector<uint64_t> index_offsets;
+
+	bool may_contain(uint64_t hash) const;
+	bool contains(const string &key, uint64_t hash);
+	void close();
+};
+
+// The set of visited states for elaborate(). Newly visited states go into an
+// in-memory hot table, see state_table. When the hot table grows past the
+// memory budget, it is sorted and written to disk as a new run. Once there are
+// too many runs, they are merged into one so that every lookup touches at
+// most a handful of files. This trades speed for memory rather than crashing
+// the machine.
+struct state_store
+{
+	state_store();
+	state_store(size_t budget, string directory);
+	~state_store();
+
+	// budget is the number of bytes the hot table may use before it is
+	// spilled. 0 keeps everything in memory.
+	size_t budget;
+	string directory;
+
+	state_table hot;
+
+	vector<state_run*> runs;
+	size_t count;
+
+	// Returns true if this state has not been visited before.
+	bool insert(const state &s);
+	size_t size() const;
+
+	void spill();
+	void compact();
+	void clear();
+
+	// Write every visited state to fptr as a count followed by one record per
+	// state, and read them back in. This is used for checkpoints.
+	void save(FILE *fptr);
+	bool load(FILE *fptr);
+};
+
+// A free list of simulators for the explorers, which would otherwise create
+// and destroy one for every state they visit. Copying a simulator into a
+// spare one reuses the storage of its tokens, enabled transitions, history
+// and encodings, so once an exploration has warmed up it mostly stops calling
+// the allocator. Everything is released at once by clear() when the
+// exploration is done.
+struct simulator_pool
+{
+	simulator_pool();
+	~simulator_pool();
+
+	// If this is false, released simulators are deleted right away. This is
+	// only useful to measure what the pool saves.
+	bool recycle;
+
+	vector<simulator*> spare;
+
+	// Returns a simulator that holds a copy of sim.
+	simulator *acquire(const simulator &sim);
+	void release(simulator *sim);
+	void clear();
+};
+
+// The stack of pending simulations for the depth first search in
+// elaborate(). Once the resident simulations use more than the memory budget,
+// the oldest half of them are written to disk as a segment. The segments are
+// reloaded in last in first out order as the resident simulations run out, so
+// the order of exploration is unchanged.
+struct simulation_stack
+{
+	simulation_stack();
+	simulation_stack(graph *base, size_t budget, string directory);
+	~simulation_stack();
+
+	graph *base;
+
+	// budget is the number of bytes the resident simulations may use before
+	// they are spilled. 0 keeps everything in memory.
+	size_t budget;
+	string directory;
+
+	// The resident simulations belong to pool.
+	simulator_pool pool;
+	deque<simulator*> resident;
+	deque<size_t> footprint;
+	size_t resident_bytes;
+
+	// The spilled segments from oldest to newest along with the number of
+	// simulations in each.
+	vector<pair<string, size_t> > segments;
+	size_t count;
+
+	// pop_back() copies the top of the stack into sim, which lets the caller
+	// hold on to one simulator for the whole exploration.
+	void push_back(const simulator &sim);
+	void pop_back(simulator &sim);
+	bool empty() const;
+	size_t size() const;
+
+	// Drop every resident simulation for which dominated returns true.
+	// Spilled simulations are left alone. Returns the number dropped.
+	size_t erase_if(std::function<bool(simulator &)> dominated);
+
+	void spill();
+	void reload();
+	void clear();
+
+	// Write every pending simulation to fptr from the bottom of the stack to
+	// the top and read them back in, see state_store::save().
+	void save(FILE *fptr);
+	bool load(FILE *fptr);
+};
+
+// The visited states of elaborate() grouped by marking. A state whose
+// encodings are a subset of the encodings of a visited state with the same
+// marking is dominated: so long as the simulator is monotone in its
+// encodings, exploring it can't record anything the other state won't. Each
+// marking keeps only the states that aren't dominated by another. These are
+// full copies held in memory next to the state_store of the same
+// exploration, so the index costs about as much as the visited states that
+// it keeps.
+struct subsumption_index
+{
+	subsumption_index();
+	~subsumption_index();
+
+	// States whose tokens differ only by a place that holds two tokens share
+	// a bucket, which is fine since is_subset_of() compares the tokens.
+	map<marking, vector<state> > markings;
+
+	// The number of states offered to insert() and the number of those that
+	// were dominated.
+	size_t checked;
+	size_t pruned;
+
+	// Returns false if s is dominated by a state in the index. Otherwise, s is
+	// added and any states that it dominates are removed.
+	bool insert(state s);
+
+	// Returns true if s is in the index, which is to say that it hasn't been
+	// dominated by anything inserted since.
+	bool contains(const state &s) const;
+
+	void clear();
+};
+
+}
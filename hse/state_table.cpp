@@ -0,0 +1,293 @@
+#include "state_table.h"
+
+namespace hse
+{
+
+// Tables start with this many slots, it must be a power of two.
+const size_t initial_slots = 64;
+
+uint64_t mix64(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebull;
+	x ^= x >> 31;
+	return x;
+}
+
+state_table::state_table()
+{
+	count = 0;
+	max_probe = 0;
+}
+
+state_table::~state_table()
+{
+}
+
+void state_table::pack(const state &s)
+{
+	packed.clear();
+
+	int width = 1;
+	for (auto i = s.tokens.begin(); i != s.tokens.end(); i++) {
+		if (i->index < 0) {
+			internal("", "negative token index in state", __FILE__, __LINE__);
+		}
+		width = max(width, (int)std::bit_width((uint64_t)i->index));
+	}
+
+	// Trailing words that are entirely don't-care are implied.
+	int words = 0;
+	for (auto c = s.encodings.cubes.begin(); c != s.encodings.cubes.end(); c++) {
+		int size = (int)c->values.size();
+		while (size > 0 and c->values[size-1] == 0xFFFFFFFFu) {
+			size--;
+		}
+		words = max(words, size);
+	}
+
+	// Dense markings are cheaper to store as a bitset. This only depends on
+	// the tokens, so equal states always pick the same layout.
+	bool dense = false;
+	uint64_t bitset_words = 0;
+	if (not s.tokens.empty()) {
+		bool strict = true;
+		for (int i = 1; i < (int)s.tokens.size() and strict; i++) {
+			strict = s.tokens[i-1].index < s.tokens[i].index;
+		}
+		bitset_words = (uint64_t)s.tokens.back().index/64 + 1;
+		dense = strict and bitset_words*64 < (uint64_t)s.tokens.size()*(uint64_t)width;
+	}
+
+	uint64_t tokens = dense ? bitset_words : s.tokens.size();
+	uint64_t cubes = s.encodings.cubes.size();
+	if (tokens >= (1u<<20) or cubes >= (1u<<20) or words >= (1<<16)) {
+		internal("", "state is too large to pack", __FILE__, __LINE__);
+	}
+	packed.push_back(tokens | (cubes << 20) | ((uint64_t)words << 40) | ((uint64_t)(width-1) << 56) | ((uint64_t)dense << 62));
+
+	if (dense) {
+		size_t start = packed.size();
+		packed.resize(start + bitset_words, 0);
+		for (auto i = s.tokens.begin(); i != s.tokens.end(); i++) {
+			packed[start + i->index/64] |= 1ull << (i->index%64);
+		}
+	} else {
+		int bit = 64;
+		for (auto i = s.tokens.begin(); i != s.tokens.end(); i++) {
+			uint64_t index = (uint64_t)i->index;
+			if (bit == 64) {
+				packed.push_back(0);
+				bit = 0;
+			}
+			packed.back() |= index << bit;
+			if (bit + width > 64) {
+				packed.push_back(index >> (64 - bit));
+				bit = bit + width - 64;
+			} else {
+				bit += width;
+			}
+		}
+	}
+
+	bool half = false;
+	for (auto c = s.encodings.cubes.begin(); c != s.encodings.cubes.end(); c++) {
+		for (int i = 0; i < words; i++) {
+			uint64_t value = i < (int)c->values.size() ? c->values[i] : 0xFFFFFFFFu;
+			if (half) {
+				packed.back() |= value << 32;
+			} else {
+				packed.push_back(value);
+			}
+			half = not half;
+		}
+	}
+}
+
+int state_table::probe(uint64_t lo, uint64_t hi) const
+{
+	size_t mask = slots.size()-1;
+	size_t i = lo & mask;
+	while (slots[i].offset != 0) {
+		if (slots[i].lo == lo and slots[i].hi == hi) {
+			const slot &curr = slots[i];
+			if (std::equal(packed.begin(), packed.end(), arena.begin() + (curr.offset-1))) {
+				return (int)i;
+			}
+		}
+		i = (i+1) & mask;
+	}
+	return -(int)i-1;
+}
+
+void state_table::grow()
+{
+	vector<slot> old;
+	old.swap(slots);
+	slots.resize(old.empty() ? initial_slots : old.size()*2, slot{0, 0, 0, 0});
+
+	size_t mask = slots.size()-1;
+	for (auto s = old.begin(); s != old.end(); s++) {
+		if (s->offset != 0) {
+			size_t i = s->lo & mask;
+			while (slots[i].offset != 0) {
+				i = (i+1) & mask;
+			}
+			slots[i] = *s;
+		}
+	}
+}
+
+int state_table::insert(const state &s, int value, bool *inserted)
+{
+	if ((count+1)*10 > slots.size()*7) {
+		grow();
+	}
+
+	pack(s);
+	uint64_t lo = 0x9E3779B97F4A7C15ull, hi = 0xC2B2AE3D27D4EB4Full;
+	for (auto w = packed.begin(); w != packed.end(); w++) {
+		lo = mix64(lo ^ *w);
+		hi = mix64(hi + *w);
+	}
+
+	int loc = probe(lo, hi);
+	if (loc >= 0) {
+		if (inserted != nullptr) {
+			*inserted = false;
+		}
+		return loc;
+	}
+	loc = -loc-1;
+
+	if (arena.size() + packed.size() >= 0xFFFFFFFFu) {
+		internal("", "state table arena is full", __FILE__, __LINE__);
+	}
+
+	int length = (int)(((size_t)loc - (lo & (slots.size()-1))) & (slots.size()-1));
+	max_probe = max(max_probe, length);
+
+	slots[loc].lo = lo;
+	slots[loc].hi = hi;
+	slots[loc].offset = (uint32_t)arena.size()+1;
+	slots[loc].value = value;
+	arena.insert(arena.end(), packed.begin(), packed.end());
+	count++;
+
+	if (inserted != nullptr) {
+		*inserted = true;
+	}
+	return loc;
+}
+
+int state_table::find(const state &s)
+{
+	if (slots.empty()) {
+		return -1;
+	}
+
+	pack(s);
+	uint64_t lo = 0x9E3779B97F4A7C15ull, hi = 0xC2B2AE3D27D4EB4Full;
+	for (auto w = packed.begin(); w != packed.end(); w++) {
+		lo = mix64(lo ^ *w);
+		hi = mix64(hi + *w);
+	}
+
+	int loc = probe(lo, hi);
+	return loc >= 0 ? loc : -1;
+}
+
+bool state_table::is_valid(int slot) const
+{
+	return slot >= 0 and slot < (int)slots.size() and slots[slot].offset != 0;
+}
+
+int &state_table::value(int slot)
+{
+	return slots[slot].value;
+}
+
+state state_table::key(int slot) const
+{
+	return at(slots[slot].offset);
+}
+
+state state_table::at(uint32_t offset) const
+{
+	state result;
+	const uint64_t *curr = arena.data() + (offset-1);
+
+	uint64_t header = *(curr++);
+	int tokens = (int)(header & 0xFFFFF);
+	int cubes = (int)((header >> 20) & 0xFFFFF);
+	int words = (int)((header >> 40) & 0xFFFF);
+	int width = (int)((header >> 56) & 0x3F) + 1;
+	bool dense = ((header >> 62) & 1) != 0;
+	uint64_t mask = width == 64 ? ~0ull : ((1ull << width)-1);
+
+	if (dense) {
+		marking m;
+		m.words.assign(curr, curr + tokens);
+		curr += tokens;
+		result.tokens = m.tokens();
+	} else {
+		int bit = 64;
+		for (int i = 0; i < tokens; i++) {
+			if (bit == 64) {
+				curr++;
+				bit = 0;
+			}
+			uint64_t index = (*(curr-1) >> bit);
+			if (bit + width > 64) {
+				index |= *(curr++) << (64 - bit);
+				bit = bit + width - 64;
+			} else {
+				bit += width;
+			}
+			result.tokens.push_back(petri::token((int)(index & mask)));
+		}
+	}
+
+	bool half = false;
+	for (int c = 0; c < cubes; c++) {
+		boolean::cube cube;
+		cube.values.resize(words);
+		for (int i = 0; i < words; i++) {
+			if (half) {
+				cube.values[i] = (unsigned int)(*(curr-1) >> 32);
+			} else {
+				cube.values[i] = (unsigned int)(*(curr++));
+			}
+			half = not half;
+		}
+
+		while (not cube.values.empty() and cube.values.back() == 0xFFFFFFFFu) {
+			cube.values.pop_back();
+		}
+		result.encodings.cubes.push_back(cube);
+	}
+
+	return result;
+}
+
+size_t state_table::size() const
+{
+	return count;
+}
+
+size_t state_table::bytes() const
+{
+	return slots.capacity()*sizeof(slot) + arena.capacity()*sizeof(uint64_t);
+}
+
+void state_table::clear()
+{
+	vector<slot>().swap(slots);
+	vector<uint64_t>().swap(arena);
+	count = 0;
+	max_probe = 0;
+}
+
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <common/standard.h>
+#include "state.h"
+
+namespace hse
+{
+
+// An open addressing hash table for the states visited during elaboration.
+//
+// Storing a state in a std::unordered_set costs a node allocation, a vector
+// of tokens, and a cover with its own vector of cubes, each of which has its
+// own vector of words. Instead, this table packs each state into a short run
+// of 64 bit words in a single arena:
+//
+// header: the number of tokens (20 bits), the number of cubes (20 bits), the
+//   number of 32 bit words per cube (16 bits), the number of bits per token
+//   index (6 bits), and whether the tokens are stored as a marking (1 bit).
+// tokens: each token index is packed into a fixed width bit field. When the
+//   tokens are sorted, no place holds two of them, and the bitset of marked
+//   places is smaller, the words of their marking are stored instead and the
+//   first field of the header counts words instead of tokens. See marking.
+// encodings: each cube is padded out to the same number of words with
+//   don't-cares, two 32 bit words per 64 bit word.
+//
+// Slots hold a 128 bit fingerprint of the packed words, the offset of the
+// packed state in the arena, and a value. The table uses linear probing and
+// stays at most 70% full, so a lookup almost always checks one or two slots
+// and only compares the packed words when the fingerprints match.
+struct state_table
+{
+	state_table();
+	state_table(const state_table &t) = default;
+	state_table(state_table &&t) = default;
+	~state_table();
+
+	state_table &operator=(const state_table &t) = default;
+	state_table &operator=(state_table &&t) = default;
+
+	struct slot
+	{
+		uint64_t lo;
+		uint64_t hi;
+
+		// offset+1 of the packed state in the arena, 0 if the slot is empty.
+		uint32_t offset;
+		int32_t value;
+	};
+
+	vector<slot> slots;
+	vector<uint64_t> arena;
+	size_t count;
+
+	// The longest probe sequence seen so far.
+	int max_probe;
+
+	// Look up s in the table, inserting it with value if it isn't there.
+	// Returns the slot that holds s and sets inserted to whether s was
+	// inserted.
+	int insert(const state &s, int value = 0, bool *inserted = nullptr);
+
+	// Returns the slot that holds s or -1 if s isn't in the table.
+	int find(const state &s);
+
+	bool is_valid(int slot) const;
+	int &value(int slot);
+	state key(int slot) const;
+
+	// Decode the state packed at this offset, see slot::offset. Offsets don't
+	// move when the table grows.
+	state at(uint32_t offset) const;
+
+	size_t size() const;
+
+	// The number of bytes used by the table, including unused slots.
+	size_t bytes() const;
+
+	void clear();
+
+	// The packed version of the state currently being looked up. This is kept
+	// around to avoid an allocation on every lookup.
+	vector<uint64_t> packed;
+
+	void pack(const state &s);
+	int probe(uint64_t lo, uint64_t hi) const;
+	void grow();
+};
+
+}
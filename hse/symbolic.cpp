@@ -0,0 +1,345 @@
+#include "symbolic.h"
+#include "bdd.h"
+#include "simulator.h"
+#include "monitor.h"
+#include "diagnostic.h"
+
+#include <climits>
+
+namespace hse
+{
+
+// The maximum number of deadlocked states that are printed individually.
+const int symbolic_deadlock_limit = 16;
+
+// The symbolic encoding of a single transition. enabled is the set of states
+// in which it may fire and marked the set in which its input places are
+// marked. Firing action term k quantifies out the variables in quantify[k]
+// and replaces them with effect[k]. action[k] is the set of states in which
+// term k would change nothing. pre is its sorted input places and reads the
+// nets its guard and assumption depend on.
+struct symbolic_transition
+{
+	int index;
+	int enabled;
+	int marked;
+	vector<int> quantify;
+	vector<int> effect;
+	vector<int> action;
+	vector<int> pre;
+	vector<int> reads;
+};
+
+// The variable order has one variable per place, which is true when that
+// place holds a token, followed by one variable per net.
+int to_bdd(bdd_manager &m, int offset, const boolean::cube &c)
+{
+	vector<int> vars = c.vars();
+	int result = bdd_manager::one;
+	for (int i = (int)vars.size()-1; i >= 0; i--) {
+		int value = c.get(vars[i]);
+		if (value == 0 or value == 1) {
+			result = m.apply_and(m.literal(offset+vars[i], value == 1), result);
+		} else if (value < 0) {
+			return bdd_manager::zero;
+		}
+	}
+	return result;
+}
+
+int to_bdd(bdd_manager &m, int offset, const boolean::cover &c)
+{
+	int result = bdd_manager::zero;
+	for (auto i = c.cubes.begin(); i != c.cubes.end(); i++) {
+		result = m.apply_or(result, to_bdd(m, offset, *i));
+	}
+	return result;
+}
+
+// Convert a set of encodings that no longer depends on any of the place
+// variables back into a cover over the nets.
+boolean::cover to_cover(bdd_manager &m, int offset, int f)
+{
+	boolean::cover result;
+	m.paths(f, [&](const vector<pair<int, bool> > &path) {
+		boolean::cube c;
+		for (auto i = path.begin(); i != path.end(); i++) {
+			c &= boolean::cube(i->first-offset, i->second ? 1 : 0);
+		}
+		result.cubes.push_back(c);
+		return true;
+	});
+	return result;
+}
+
+// Whether two action terms drive some net to opposite values.
+bool conflicts(const boolean::cube &a, const boolean::cube &b)
+{
+	vector<int> vars = a.vars();
+	for (auto v = vars.begin(); v != vars.end(); v++) {
+		int x = a.get(*v);
+		int y = b.get(*v);
+		if ((x == 0 and y == 1) or (x == 1 and y == 0)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// The explicit engine extends tokens through vacuous firings and checks for
+// unstable guards and interfering assignments, none of which this engine
+// models. Returns a description of the first of these that shows up in the
+// reachable states, or an empty string if there are none. The pairwise
+// checks only look at pairs of transitions that could possibly affect each
+// other.
+string find_unsupported(bdd_manager &m, const graph &g, int reached, const vector<symbolic_transition> &transitions)
+{
+	for (auto t = transitions.begin(); t != transitions.end(); t++) {
+		int from = m.apply_and(reached, t->enabled);
+		for (int k = 0; k < (int)t->action.size(); k++) {
+			if (m.apply_and(from, t->action[k]) != bdd_manager::zero) {
+				return "T" + ::to_string(t->index) + " fires vacuously";
+			}
+		}
+	}
+
+	for (auto t = transitions.begin(); t != transitions.end(); t++) {
+		for (auto u = transitions.begin(); u != transitions.end(); u++) {
+			if (u == t) continue;
+
+			const boolean::cover &left = g.transitions[t->index].local_action;
+			const boolean::cover &right = g.transitions[u->index].local_action;
+
+			// Firing u turns off the guard of t while leaving its tokens.
+			bool writes = false;
+			for (auto c = right.cubes.begin(); c != right.cubes.end() and not writes; c++) {
+				vector<int> vars = c->vars();
+				for (auto v = vars.begin(); v != vars.end() and not writes; v++) {
+					writes = binary_search(t->reads.begin(), t->reads.end(), *v);
+				}
+			}
+			if (writes) {
+				int from = m.apply_and(reached, m.apply_and(t->enabled, u->enabled));
+				for (int k = 0; k < (int)u->effect.size() and from != bdd_manager::zero; k++) {
+					int to = m.apply_and(m.exists(from, u->quantify[k]), u->effect[k]);
+					if (m.apply_and(m.apply_and(to, t->marked), m.negate(t->enabled)) != bdd_manager::zero) {
+						return "T" + ::to_string(t->index) + " is unstable";
+					}
+				}
+			}
+
+			// t and u are enabled at once on separate tokens and drive a net
+			// in opposite directions.
+			if (u < t) continue;
+			bool opposed = false;
+			for (auto a = left.cubes.begin(); a != left.cubes.end() and not opposed; a++) {
+				for (auto b = right.cubes.begin(); b != right.cubes.end() and not opposed; b++) {
+					opposed = conflicts(*a, *b);
+				}
+			}
+			bool shared = false;
+			for (auto p = t->pre.begin(); p != t->pre.end() and not shared; p++) {
+				shared = binary_search(u->pre.begin(), u->pre.end(), *p);
+			}
+			if (opposed and not shared and m.apply_and(reached, m.apply_and(t->enabled, u->enabled)) != bdd_manager::zero) {
+				return "T" + ::to_string(t->index) + " and T" + ::to_string(u->index) + " interfere";
+			}
+		}
+	}
+
+	return "";
+}
+
+size_t elaborate_symbolic(graph &g, const elaborate_config &config, elaborate_monitor &monitor, vector<boolean::cover> &predicate, vector<boolean::cover> &effective, bool *supported)
+{
+	int places = (int)g.places.size();
+	int nets = g.netCount();
+	bdd_manager m(places+nets);
+
+	vector<int> place_vars;
+	for (int i = 0; i < places; i++) {
+		place_vars.push_back(i);
+	}
+	int all_places = m.support(place_vars);
+
+	// Build the enabling condition and the effect of every transition. A
+	// transition is enabled when all of its input places are marked and the
+	// current encoding passes its guard and assumption. Firing it moves the
+	// tokens and applies one term of its local action.
+	vector<symbolic_transition> transitions;
+	for (int i = 0; i < (int)g.transitions.size(); i++) {
+		if (not g.transitions.is_valid(i)) continue;
+
+		vector<int> pre = g.prev(petri::transition::type, i);
+		vector<int> post = g.next(petri::transition::type, i);
+		sort(pre.begin(), pre.end());
+		sort(post.begin(), post.end());
+
+		symbolic_transition t;
+		t.index = i;
+		t.pre = pre;
+		boolean::cover condition = g.transitions[i].guard & g.transitions[i].assume;
+		for (auto c = condition.cubes.begin(); c != condition.cubes.end(); c++) {
+			vector<int> vars = c->vars();
+			t.reads.insert(t.reads.end(), vars.begin(), vars.end());
+		}
+		sort(t.reads.begin(), t.reads.end());
+		t.reads.erase(unique(t.reads.begin(), t.reads.end()), t.reads.end());
+
+		t.marked = bdd_manager::one;
+		for (int j = (int)pre.size()-1; j >= 0; j--) {
+			t.marked = m.apply_and(m.literal(pre[j], true), t.marked);
+		}
+		t.enabled = m.apply_and(t.marked, to_bdd(m, places, condition));
+
+		vector<int> moved = pre;
+		moved.insert(moved.end(), post.begin(), post.end());
+		int marking = bdd_manager::one;
+		for (int j = 0; j < places; j++) {
+			if (binary_search(post.begin(), post.end(), j)) {
+				marking = m.apply_and(marking, m.literal(j, true));
+			} else if (binary_search(pre.begin(), pre.end(), j)) {
+				marking = m.apply_and(marking, m.literal(j, false));
+			}
+		}
+
+		for (auto term = g.transitions[i].local_action.cubes.begin(); term != g.transitions[i].local_action.cubes.end(); term++) {
+			vector<int> vars = moved;
+			vector<int> assigned = term->vars();
+			for (auto v = assigned.begin(); v != assigned.end(); v++) {
+				vars.push_back(places+*v);
+			}
+			sort(vars.begin(), vars.end());
+			vars.erase(unique(vars.begin(), vars.end()), vars.end());
+
+			t.quantify.push_back(m.support(vars));
+			t.action.push_back(to_bdd(m, places, *term));
+			t.effect.push_back(m.apply_and(marking, t.action.back()));
+		}
+
+		transitions.push_back(t);
+	}
+
+	// The initial states are the reset markings, every place that isn't marked
+	// holds no token.
+	int reached = bdd_manager::zero;
+	for (int i = 0; i < (int)g.reset.size(); i++) {
+		vector<int> marked;
+		for (auto j = g.reset[i].tokens.begin(); j != g.reset[i].tokens.end(); j++) {
+			marked.push_back(j->index);
+		}
+		sort(marked.begin(), marked.end());
+
+		int init = to_bdd(m, places, g.reset[i].encodings);
+		for (int j = places-1; j >= 0; j--) {
+			init = m.apply_and(m.literal(j, binary_search(marked.begin(), marked.end(), j)), init);
+		}
+		reached = m.apply_or(reached, init);
+	}
+
+	// Breadth first fixpoint, only the newly reached states are expanded in
+	// each step. The monitor sees the enabling conditions as enabled(), the
+	// images as fire(), and the update of the reached set as hashing.
+	int frontier = reached;
+	while (frontier != bdd_manager::zero) {
+		int next = bdd_manager::zero;
+		for (auto t = transitions.begin(); t != transitions.end(); t++) {
+			monitor.lap(nullptr);
+			int from = m.apply_and(frontier, t->enabled);
+			monitor.lap(&monitor.stats.enabled_seconds);
+			if (from == bdd_manager::zero) continue;
+
+			for (int k = 0; k < (int)t->effect.size(); k++) {
+				next = m.apply_or(next, m.apply_and(m.exists(from, t->quantify[k]), t->effect[k]));
+			}
+			monitor.lap(&monitor.stats.fire_seconds);
+		}
+
+		monitor.lap(nullptr);
+		frontier = m.apply_and(next, m.negate(reached));
+		reached = m.apply_or(reached, frontier);
+		monitor.lap(&monitor.stats.hash_seconds);
+
+		// Counting is linear in the size of the diagrams, so only do it if
+		// somebody is listening.
+		if (monitor.active()) {
+			double added = m.count(frontier);
+			monitor.stats.revisits += (size_t)max(m.count(next) - added, 0.0);
+			if (monitor.due()) {
+				double count = m.count(reached);
+				monitor.report(count >= (double)SIZE_MAX ? SIZE_MAX : (size_t)count,
+					added >= (double)SIZE_MAX ? SIZE_MAX : (size_t)added,
+					m.unique.empty() ? 0.0 : (double)m.nodes.size()/(double)m.unique.size(),
+					m.nodes.size()*sizeof(bdd_node) + m.unique.size()*sizeof(int) + m.cache.size()*sizeof(bdd_manager::cache_entry));
+			}
+		}
+	}
+
+	string unsupported = find_unsupported(m, g, reached, transitions);
+	if (not unsupported.empty()) {
+		config.diagnostics->report(g, diagnostic("the symbolic engine doesn't model that " + unsupported + ", using the explicit engine"));
+		*supported = false;
+		return 0;
+	}
+	*supported = true;
+
+	if (config.record_predicates) {
+		for (int i = 0; i < places; i++) {
+			if (not g.places.is_valid(i)) continue;
+
+			int marked = m.apply_and(reached, m.literal(i, true));
+
+			// Exclude the encodings that would let this token leave the place.
+			// This is the same as the guards that the explicit engine checks on
+			// the loaded transitions, plus the markings of their other inputs.
+			int dis = bdd_manager::one;
+			vector<int> out = g.next(petri::place::type, i);
+			for (auto t = transitions.begin(); t != transitions.end(); t++) {
+				if (find(out.begin(), out.end(), t->index) != out.end()) {
+					dis = m.apply_and(dis, m.negate(t->enabled));
+				}
+			}
+
+			predicate[i] |= to_cover(m, places, m.exists(marked, all_places)).flipped_mask(g.places[i].mask);
+			effective[i] |= to_cover(m, places, m.exists(m.apply_and(marked, dis), all_places)).flipped_mask(g.places[i].mask);
+		}
+	}
+
+	// A reachable state in which no transition is enabled is a deadlock.
+	int dead = reached;
+	for (auto t = transitions.begin(); t != transitions.end(); t++) {
+		dead = m.apply_and(dead, m.negate(t->enabled));
+	}
+
+	if (dead != bdd_manager::zero) {
+		int reported = 0;
+		m.paths(dead, [&](const vector<pair<int, bool> > &path) {
+			// Places that are don't-cares on this path are unmarked in one of
+			// the deadlocked states it covers.
+			marking marked(places);
+			boolean::cube encoding;
+			for (auto i = path.begin(); i != path.end(); i++) {
+				if (i->first < places) {
+					if (i->second) {
+						marked.set(i->first);
+					}
+				} else {
+					encoding &= boolean::cube(i->first-places, i->second ? 1 : 0);
+				}
+			}
+
+			config.diagnostics->report(g, diagnostic(deadlock(marked, encoding)));
+			return ++reported < symbolic_deadlock_limit;
+		});
+
+		double total = m.count(dead);
+		if (total > (double)reported) {
+			config.diagnostics->report(g, diagnostic("found " + ::to_string((size_t)total) + " deadlocked states in total", diagnostic::DEADLOCK));
+		}
+	}
+
+	double total = m.count(reached);
+	return total >= (double)SIZE_MAX ? SIZE_MAX : (size_t)total;
+}
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <common/standard.h>
+#include <boolean/cover.h>
+#include "graph.h"
+#include "elaborator.h"
+
+namespace hse
+{
+
+struct elaborate_monitor;
+
+// The symbolic backend for elaborate(). Instead of visiting one state at a
+// time, it represents whole sets of states as binary decision diagrams and
+// computes the reachable set as a fixpoint of the image of every transition.
+// This handles designs with a lot of concurrency, where the number of
+// interleavings would overwhelm the explicit explorer.
+//
+// predicate and effective are indexed by place and accumulate the same
+// information as the explicit engine. Progress is reported through monitor
+// once per breadth first layer, deadlocks through config.diagnostics.
+// Returns the number of reachable states.
+//
+// Vacuous firings, unstable guards, and interfering assignments aren't
+// modeled. If any of them are reachable, this reports which one through
+// config.diagnostics, sets supported to false, and records nothing so the
+// caller can run the explicit engine instead.
+size_t elaborate_symbolic(graph &g, const elaborate_config &config, elaborate_monitor &monitor, vector<boolean::cover> &predicate, vector<boolean::cover> &effective, bool *supported);
+
+}
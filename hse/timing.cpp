@@ -0,0 +1,412 @@
+#include "timing.h"
+#include "diagnostic.h"
+
+#include <common/message.h>
+#include <common/text.h>
+
+#include <cmath>
+#include <queue>
+#include <tuple>
+
+namespace hse
+{
+
+delay_model::delay_model()
+{
+	kind = PARETO;
+	a = 10000.0;
+	b = 5.0;
+}
+
+delay_model::delay_model(int kind, double a, double b)
+{
+	this->kind = kind;
+	this->a = a;
+	this->b = b;
+}
+
+delay_model::~delay_model()
+{
+}
+
+string delay_model::check() const
+{
+	if (kind == FIXED) {
+		if (a < 0.0) {
+			return "fixed delay " + ::to_string(a) + " is negative";
+		}
+	} else if (kind == UNIFORM) {
+		if (a < 0.0 or b < a) {
+			return "uniform delay needs 0 <= a <= b, got a=" + ::to_string(a) + " b=" + ::to_string(b);
+		}
+	} else if (kind == EXPONENTIAL) {
+		if (a <= 0.0) {
+			return "exponential delay needs a positive mean, got a=" + ::to_string(a);
+		}
+	} else if (kind == PARETO) {
+		if (a <= 0.0 or b <= 0.0) {
+			return "pareto delay needs a positive scale and shape, got a=" + ::to_string(a) + " b=" + ::to_string(b);
+		}
+	} else {
+		return "unknown delay kind " + ::to_string(kind);
+	}
+	return "";
+}
+
+uint64_t delay_model::sample(std::mt19937_64 &rng) const
+{
+	double result = a;
+	if (kind == UNIFORM) {
+		result = std::uniform_real_distribution<double>(a, b)(rng);
+	} else if (kind == EXPONENTIAL) {
+		result = std::exponential_distribution<double>(1.0/a)(rng);
+	} else if (kind == PARETO) {
+		// 1-u is in (0, 1], so this never divides by zero
+		double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+		result = a/std::pow(1.0-u, 1.0/b);
+	}
+	return result <= 0.0 ? 0 : (uint64_t)std::llround(result);
+}
+
+histogram::histogram()
+{
+	width = 1.0;
+	overflow = 0;
+	samples = 0;
+	sum = 0.0;
+	sum2 = 0.0;
+	lo = 0.0;
+	hi = 0.0;
+}
+
+histogram::histogram(double width, int bins)
+{
+	this->width = width;
+	counts.resize(bins, 0);
+	overflow = 0;
+	samples = 0;
+	sum = 0.0;
+	sum2 = 0.0;
+	lo = 0.0;
+	hi = 0.0;
+}
+
+histogram::~histogram()
+{
+}
+
+void histogram::add(double value)
+{
+	if (samples == 0 or value < lo) {
+		lo = value;
+	}
+	if (samples == 0 or value > hi) {
+		hi = value;
+	}
+	samples++;
+	sum += value;
+	sum2 += value*value;
+
+	size_t bin = (size_t)(value/width);
+	if (value >= 0.0 and bin < counts.size()) {
+		counts[bin]++;
+	} else {
+		overflow++;
+	}
+}
+
+double histogram::mean() const
+{
+	return samples == 0 ? 0.0 : sum/(double)samples;
+}
+
+double histogram::stddev() const
+{
+	if (samples < 2) {
+		return 0.0;
+	}
+	double m = mean();
+	return std::sqrt(max(0.0, (sum2 - (double)samples*m*m)/(double)(samples-1)));
+}
+
+string histogram::to_string() const
+{
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "mean %g, stddev %g, min %g, max %g over %zu samples\n", mean(), stddev(), lo, hi, samples);
+	string result = buffer;
+	for (int i = 0; i < (int)counts.size(); i++) {
+		if (counts[i] != 0) {
+			snprintf(buffer, sizeof(buffer), "\t[%g, %g)\t%zu\n", width*(double)i, width*(double)(i+1), counts[i]);
+			result += buffer;
+		}
+	}
+	if (overflow != 0) {
+		snprintf(buffer, sizeof(buffer), "\t[%g, inf)\t%zu\n", width*(double)counts.size(), overflow);
+		result += buffer;
+	}
+	return result;
+}
+
+channel_stats::channel_stats()
+{
+	request = -1;
+	acknowledge = -1;
+	handshakes = 0;
+	requested_at = -1.0;
+}
+
+channel_stats::channel_stats(int request, int acknowledge, const histogram &latency)
+{
+	this->request = request;
+	this->acknowledge = acknowledge;
+	this->latency = latency;
+	handshakes = 0;
+	requested_at = -1.0;
+}
+
+channel_stats::~channel_stats()
+{
+}
+
+timing_config::timing_config()
+{
+	seed = 0;
+	steps = 100000;
+	duration = 0;
+	bin_width = 1000.0;
+	bins = 64;
+	reset = 0;
+	diagnostics = nullptr;
+}
+
+timing_config::~timing_config()
+{
+}
+
+timing_stats::timing_stats()
+{
+	elapsed = 0;
+	steps = 0;
+	deadlocked = false;
+}
+
+timing_stats::~timing_stats()
+{
+}
+
+double timing_stats::throughput(int net) const
+{
+	return elapsed == 0 ? 0.0 : (double)rises[net]/(double)elapsed;
+}
+
+double timing_stats::throughput(const channel_stats &channel) const
+{
+	return elapsed == 0 ? 0.0 : (double)channel.handshakes/(double)elapsed;
+}
+
+string timing_stats::to_string(const graph &g) const
+{
+	string result = "simulated " + ::to_string(steps) + " firings over " + ::to_string(elapsed) + " time units";
+	if (deadlocked) {
+		result += ", then deadlocked";
+	}
+	result += "\ncycle time: " + cycle_time.to_string();
+
+	char buffer[256];
+	for (int i = 0; i < (int)rises.size(); i++) {
+		if (rises[i] != 0) {
+			snprintf(buffer, sizeof(buffer), "%s: %zu rising edges, throughput %g\n", g.netAt(i).c_str(), rises[i], throughput(i));
+			result += buffer;
+		}
+	}
+
+	for (auto c = channels.begin(); c != channels.end(); c++) {
+		snprintf(buffer, sizeof(buffer), "%s/%s: %zu handshakes, throughput %g\n", g.netAt(c->request).c_str(), g.netAt(c->acknowledge).c_str(), c->handshakes, throughput(*c));
+		result += buffer;
+		result += "latency: " + c->latency.to_string();
+	}
+	return result;
+}
+
+timing_stats simulate_timed(graph &g, const timing_config &config)
+{
+	history_scope histories;
+
+	timing_stats result;
+	if (config.steps == 0 and config.duration == 0) {
+		error("", "simulate_timed() needs a limit on the number of steps or the simulated time", __FILE__, __LINE__);
+		return result;
+	} else if (config.reset < 0 or config.reset >= (int)g.reset.size()) {
+		error("", "reset state " + ::to_string(config.reset) + " doesn't exist", __FILE__, __LINE__);
+		return result;
+	}
+
+	// Reject the parameters that would make sample() undefined.
+	vector<pair<string, const delay_model *> > models;
+	models.push_back(pair<string, const delay_model *>("default delay", &config.default_delay));
+	for (auto d = config.transition_delay.begin(); d != config.transition_delay.end(); d++) {
+		models.push_back(pair<string, const delay_model *>("delay of transition " + ::to_string(d->first), &d->second));
+	}
+	for (auto d = config.net_delay.begin(); d != config.net_delay.end(); d++) {
+		models.push_back(pair<string, const delay_model *>("delay of net " + g.netAt(d->first), &d->second));
+	}
+	bool valid = true;
+	for (auto m = models.begin(); m != models.end(); m++) {
+		string msg = m->second->check();
+		if (not msg.empty()) {
+			error("", m->first + ": " + msg, __FILE__, __LINE__);
+			valid = false;
+		}
+	}
+	if (not valid) {
+		return result;
+	}
+
+	int transitions = (int)g.transitions.size();
+	std::mt19937_64 rng(config.seed);
+
+	result.cycle_time = histogram(config.bin_width, config.bins);
+	result.rises.assign(g.netCount(), 0);
+	for (auto c = config.channels.begin(); c != config.channels.end(); c++) {
+		result.channels.push_back(channel_stats(c->first, c->second, histogram(config.bin_width, config.bins)));
+	}
+
+	// Look up the delay of every transition up front.
+	vector<const delay_model *> delays(transitions, &config.default_delay);
+	for (int i = 0; i < transitions; i++) {
+		if (not g.transitions.is_valid(i)) continue;
+
+		auto d = config.transition_delay.find(i);
+		if (d != config.transition_delay.end()) {
+			delays[i] = &d->second;
+			continue;
+		}
+
+		bool found = false;
+		for (auto c = g.transitions[i].local_action.cubes.begin(); c != g.transitions[i].local_action.cubes.end() and not found; c++) {
+			vector<int> vars = c->vars();
+			for (auto v = vars.begin(); v != vars.end() and not found; v++) {
+				auto n = config.net_delay.find(*v);
+				if (n != config.net_delay.end()) {
+					delays[i] = &n->second;
+					found = true;
+				}
+			}
+		}
+	}
+
+	diagnostic_sink deferred;
+	simulator sim(&g, g.reset[config.reset]);
+	sim.memoize_guards = true;
+	sim.diagnostics = config.diagnostics != nullptr ? config.diagnostics : &deferred;
+
+	// Each enabled transition is scheduled to fire at due[t]. The queue is
+	// ordered by that time, and cancelled entries are left in it until they
+	// reach the top. An entry is cancelled if its generation no longer
+	// matches the generation of its transition.
+	typedef std::tuple<uint64_t, uint64_t, int> event;
+	std::priority_queue<event, vector<event>, std::greater<event> > schedule;
+	vector<bool> scheduled(transitions, false);
+	vector<uint64_t> due(transitions, 0);
+	vector<uint64_t> generation(transitions, 0);
+	vector<int> pending;
+
+	// When each transition last fired
+	vector<bool> fired(transitions, false);
+	vector<uint64_t> last(transitions, 0);
+
+	// seen[t] is the last step in which t was ready
+	vector<size_t> seen(transitions, 0);
+
+	while (config.steps == 0 or result.steps < config.steps) {
+		if (sim.enabled() == 0) {
+			result.deadlocked = true;
+			break;
+		}
+
+		size_t step = result.steps+1;
+		for (auto r = sim.ready.begin(); r != sim.ready.end(); r++) {
+			seen[sim.loaded[r->first].index] = step;
+		}
+
+		// A transition that was disabled before it fired loses its place in the
+		// schedule.
+		for (int i = (int)pending.size()-1; i >= 0; i--) {
+			if (seen[pending[i]] != step) {
+				scheduled[pending[i]] = false;
+				generation[pending[i]]++;
+				pending[i] = pending.back();
+				pending.pop_back();
+			}
+		}
+
+		for (auto r = sim.ready.begin(); r != sim.ready.end(); r++) {
+			int t = sim.loaded[r->first].index;
+			if (not scheduled[t]) {
+				scheduled[t] = true;
+				due[t] = sim.now + delays[t]->sample(rng);
+				schedule.push(event(due[t], ++generation[t], t));
+				pending.push_back(t);
+			}
+		}
+
+		while (not scheduled[std::get<2>(schedule.top())] or generation[std::get<2>(schedule.top())] != std::get<1>(schedule.top())) {
+			schedule.pop();
+		}
+
+		int t = std::get<2>(schedule.top());
+		uint64_t when = std::get<0>(schedule.top());
+		if (config.duration != 0 and when > config.duration) {
+			sim.now = config.duration;
+			break;
+		}
+		schedule.pop();
+
+		// Pick one of the enabled terms of its action at random.
+		vector<int> choices;
+		for (int i = 0; i < (int)sim.ready.size(); i++) {
+			if (sim.loaded[sim.ready[i].first].index == t) {
+				choices.push_back(i);
+			}
+		}
+		int index = choices[rng()%choices.size()];
+		int term = sim.ready[index].second;
+		sim.loaded[sim.ready[index].first].fire_at = when;
+		sim.fire(index);
+		result.steps++;
+
+		scheduled[t] = false;
+		generation[t]++;
+		pending.erase(find(pending.begin(), pending.end(), t));
+
+		if (fired[t]) {
+			result.cycle_time.add((double)(sim.now - last[t]));
+		}
+		fired[t] = true;
+		last[t] = sim.now;
+
+		const boolean::cube &action = g.transitions[t].local_action.cubes[term];
+		vector<int> vars = action.vars();
+		for (auto v = vars.begin(); v != vars.end(); v++) {
+			if (action.get(*v) != 1) continue;
+
+			result.rises[*v]++;
+			for (auto c = result.channels.begin(); c != result.channels.end(); c++) {
+				if (c->request == *v and c->requested_at < 0.0) {
+					c->requested_at = (double)sim.now;
+				}
+				if (c->acknowledge == *v and c->requested_at >= 0.0) {
+					c->latency.add((double)sim.now - c->requested_at);
+					c->handshakes++;
+					c->requested_at = -1.0;
+				}
+			}
+		}
+	}
+
+	result.elapsed = sim.now;
+	deferred.flush(g);
+	return result;
+}
+
+}
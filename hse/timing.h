@@ -0,0 +1,156 @@
+#pragma once
+
+#include <common/standard.h>
+#include "graph.h"
+#include "simulator.h"
+
+#include <random>
+
+namespace hse
+{
+
+// The distribution of the delay between when a transition becomes enabled
+// and when it fires, in the same units as simulator::now.
+struct delay_model
+{
+	delay_model();
+	delay_model(int kind, double a, double b = 0.0);
+	~delay_model();
+
+	enum {
+		// always a
+		FIXED = 0,
+		// uniform between a and b
+		UNIFORM = 1,
+		// exponential with a mean of a
+		EXPONENTIAL = 2,
+		// pareto with a scale of a and a shape of b, this is the distribution
+		// that simulator::enabled() uses
+		PARETO = 3
+	};
+
+	int kind;
+	double a;
+	double b;
+
+	// Return why the parameters don't describe a distribution, or an empty
+	// string if they do.
+	string check() const;
+	uint64_t sample(std::mt19937_64 &rng) const;
+};
+
+// A histogram with fixed width bins starting at zero. Samples past the last
+// bin are only counted in overflow, but all samples count toward the summary
+// statistics.
+struct histogram
+{
+	histogram();
+	histogram(double width, int bins);
+	~histogram();
+
+	double width;
+	vector<size_t> counts;
+	size_t overflow;
+
+	size_t samples;
+	double sum;
+	double sum2;
+	double lo;
+	double hi;
+
+	void add(double value);
+	double mean() const;
+	double stddev() const;
+	string to_string() const;
+};
+
+// A handshake between a request net and an acknowledge net. The latency is
+// measured from each rising edge of the request to the next rising edge of
+// the acknowledge.
+struct channel_stats
+{
+	channel_stats();
+	channel_stats(int request, int acknowledge, const histogram &latency);
+	~channel_stats();
+
+	int request;
+	int acknowledge;
+
+	size_t handshakes;
+	histogram latency;
+
+	// when the request last went high, or -1 if it hasn't since the last
+	// acknowledge
+	double requested_at;
+};
+
+struct timing_config
+{
+	timing_config();
+	~timing_config();
+
+	uint64_t seed;
+
+	// The simulation stops after this many firings or once simulator::now
+	// passes duration, whichever comes first. 0 means no limit, but at least
+	// one of them must be set.
+	size_t steps;
+	uint64_t duration;
+
+	// The delay of each transition comes from the first of these that applies:
+	// its entry in transition_delay, the entry in net_delay of the first net
+	// its action assigns, and default_delay.
+	delay_model default_delay;
+	map<int, delay_model> transition_delay;
+	map<int, delay_model> net_delay;
+
+	// The handshakes to measure, as pairs of request and acknowledge nets.
+	vector<pair<int, int> > channels;
+
+	// The shape of every histogram in the result.
+	double bin_width;
+	int bins;
+
+	// Which reset state to start from.
+	int reset;
+
+	// Where the simulator sends the errors it finds. If this is null, they
+	// are held and printed at the end of the run, see diagnostic.h.
+	diagnostic_sink *diagnostics;
+};
+
+struct timing_stats
+{
+	timing_stats();
+	~timing_stats();
+
+	// The simulated time and the number of firings.
+	uint64_t elapsed;
+	size_t steps;
+	bool deadlocked;
+
+	// The time between consecutive firings of the same transition. In a
+	// process that is a single loop, this is the cycle time.
+	histogram cycle_time;
+
+	// The number of rising edges of each net.
+	vector<size_t> rises;
+	vector<channel_stats> channels;
+
+	// rising edges per unit of time
+	double throughput(int net) const;
+	double throughput(const channel_stats &channel) const;
+
+	string to_string(const graph &g) const;
+};
+
+// Run a single random timed simulation of g. Unlike the elaborator, this
+// doesn't choose which transition to fire next. Every enabled transition is
+// scheduled to fire some random delay after it becomes enabled and the
+// earliest one fires first. A transition that is disabled before it fires
+// loses its place in the schedule. The same seed always gives the same run.
+// If any delay model is invalid, see delay_model::check(), this reports
+// an error and returns without simulating.
+timing_stats simulate_timed(graph &g, const timing_config &config = timing_config());
+
+}
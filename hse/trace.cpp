@@ -0,0 +1,254 @@
+#include "trace.h"
+#include "state_store.h"
+
+#include <common/text.h>
+
+#include <climits>
+
+namespace hse
+{
+
+// Identifies a trace file and the version of its format.
+const string trace_magic = "hse simulation trace";
+const uint64_t trace_version = 1;
+
+void write_arcs(byte_writer &writer, vector<int> arcs)
+{
+	sort(arcs.begin(), arcs.end());
+	writer.write_uint(arcs.size());
+	for (auto i = arcs.begin(); i != arcs.end(); i++) {
+		writer.write_uint(*i);
+	}
+}
+
+uint64_t hash_graph(const graph &g)
+{
+	byte_writer writer;
+	writer.write_uint(g.netCount());
+
+	writer.write_uint(g.places.size());
+	for (int i = 0; i < (int)g.places.size(); i++) {
+		writer.write_bool(g.places.is_valid(i));
+		if (g.places.is_valid(i)) {
+			writer.write_bool(g.places[i].arbiter);
+		}
+	}
+
+	writer.write_uint(g.transitions.size());
+	for (int i = 0; i < (int)g.transitions.size(); i++) {
+		writer.write_bool(g.transitions.is_valid(i));
+		if (g.transitions.is_valid(i)) {
+			write_arcs(writer, g.prev(petri::transition::type, i));
+			write_arcs(writer, g.next(petri::transition::type, i));
+			writer.write(g.transitions[i].guard);
+			writer.write(g.transitions[i].assume);
+			writer.write(g.transitions[i].local_action);
+			writer.write(g.transitions[i].remote_action);
+		}
+	}
+
+	return hash_bytes(writer.data.data(), writer.data.size());
+}
+
+trace_writer::trace_writer()
+{
+	fptr = nullptr;
+	keyframe_interval = 1024;
+	steps = 0;
+	block_steps = 0;
+}
+
+trace_writer::~trace_writer()
+{
+	close();
+}
+
+bool trace_writer::open(string path, const graph &g, const simulator &sim, uint64_t keyframe_interval)
+{
+	close();
+
+	fptr = fopen(path.c_str(), "wb");
+	if (fptr == nullptr) {
+		error("", "unable to open '" + path + "' to write a trace", __FILE__, __LINE__);
+		return false;
+	}
+
+	this->keyframe_interval = max(keyframe_interval, (uint64_t)1);
+	steps = 0;
+
+	write_record(fptr, trace_magic);
+	byte_writer header;
+	header.write_uint(trace_version);
+	header.write_uint(hash_graph(g));
+	header.write_uint(this->keyframe_interval);
+	write_record(fptr, string((const char*)header.data.data(), header.data.size()));
+
+	// The first keyframe was taken before enabled() was called, so the
+	// replay needs to call it before the first firing.
+	block.clear();
+	block_steps = 0;
+	block.write_bool(false);
+	block.write(sim);
+	return true;
+}
+
+void trace_writer::record(const simulator &sim, int index)
+{
+	if (fptr == nullptr) {
+		return;
+	}
+
+	if (block_steps >= keyframe_interval) {
+		write_block();
+		block.clear();
+		block.write_bool(true);
+		block.write(sim);
+	}
+
+	const pair<int, int> &r = sim.ready[index];
+	block.write_uint(r.first);
+	block.write_uint(r.second);
+	block.write_int((int64_t)sim.loaded[r.first].fire_at - (int64_t)sim.now);
+	block_steps++;
+	steps++;
+}
+
+void trace_writer::write_block()
+{
+	byte_writer header;
+	header.write_uint(steps - block_steps);
+	header.write_uint(block_steps);
+
+	string record((const char*)header.data.data(), header.data.size());
+	record.append((const char*)block.data.data(), block.data.size());
+	write_record(fptr, record);
+	block_steps = 0;
+}
+
+void trace_writer::close()
+{
+	if (fptr != nullptr) {
+		write_block();
+		if (ferror(fptr)) {
+			error("", "unable to write the trace", __FILE__, __LINE__);
+		}
+		fclose(fptr);
+		fptr = nullptr;
+	}
+	block.clear();
+}
+
+trace_reader::trace_reader()
+{
+	fptr = nullptr;
+	base = nullptr;
+	keyframe_interval = 0;
+	steps = 0;
+}
+
+trace_reader::~trace_reader()
+{
+	close();
+}
+
+bool trace_reader::open(string path, graph *base)
+{
+	close();
+	this->base = base;
+
+	fptr = fopen(path.c_str(), "rb");
+	if (fptr == nullptr) {
+		error("", "unable to open trace '" + path + "'", __FILE__, __LINE__);
+		return false;
+	}
+
+	string record;
+	bool ok = read_record(fptr, record) and record == trace_magic
+		and read_record(fptr, record);
+	if (ok) {
+		byte_reader header((const uint8_t*)record.data(), record.size());
+		ok = header.read_uint() == trace_version
+			and header.read_uint() == hash_graph(*base);
+		keyframe_interval = header.read_uint();
+	}
+
+	// Index the blocks. Each one starts with its first step and the number of
+	// firings it holds, so this doesn't need to decode the keyframes.
+	long offset = ftell(fptr);
+	while (ok and read_record(fptr, record)) {
+		byte_reader reader((const uint8_t*)record.data(), record.size());
+		size_t start = reader.read_uint();
+		size_t count = reader.read_uint();
+		blocks.push_back(pair<size_t, long>(start, offset));
+		steps = start + count;
+		offset = ftell(fptr);
+	}
+
+	if (not ok or blocks.empty()) {
+		error("", "trace '" + path + "' is damaged or doesn't match this graph", __FILE__, __LINE__);
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool trace_reader::seek(size_t step, simulator &sim)
+{
+	if (fptr == nullptr or step > steps) {
+		return false;
+	}
+
+	// Find the last block that starts at or before step.
+	auto b = upper_bound(blocks.begin(), blocks.end(), pair<size_t, long>(step, LONG_MAX));
+	b--;
+
+	string record;
+	if (fseek(fptr, b->second, SEEK_SET) != 0 or not read_record(fptr, record)) {
+		error("", "unable to read the trace", __FILE__, __LINE__);
+		return false;
+	}
+
+	byte_reader reader((const uint8_t*)record.data(), record.size());
+	size_t start = reader.read_uint();
+	reader.read_uint();
+	bool primed = reader.read_bool();
+	reader.read(sim, base);
+
+	for (size_t i = start; i < step; i++) {
+		if (i > start or not primed) {
+			sim.enabled();
+		}
+
+		int loaded = (int)reader.read_uint();
+		int term = (int)reader.read_uint();
+		int64_t delay = reader.read_int();
+
+		int index = -1;
+		for (int j = 0; j < (int)sim.ready.size() and index < 0; j++) {
+			if (sim.ready[j].first == loaded and sim.ready[j].second == term) {
+				index = j;
+			}
+		}
+
+		if (index < 0) {
+			error("", "firing " + ::to_string(i) + " of the trace isn't enabled in the replay", __FILE__, __LINE__);
+			return false;
+		}
+
+		sim.loaded[loaded].fire_at = (uint64_t)((int64_t)sim.now + delay);
+		sim.fire(index);
+	}
+	return true;
+}
+
+void trace_reader::close()
+{
+	if (fptr != nullptr) {
+		fclose(fptr);
+		fptr = nullptr;
+	}
+	blocks.clear();
+	steps = 0;
+}
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <common/standard.h>
+#include <cstdio>
+#include "graph.h"
+#include "simulator.h"
+#include "serialize.h"
+
+namespace hse
+{
+
+// A hash of everything about a graph that affects how it simulates: the
+// arcs, the guards, assumptions, and actions of the transitions, and the
+// number of nets. A trace is only replayed on a graph with the same hash.
+uint64_t hash_graph(const graph &g);
+
+// A trace file is a sequence of length prefixed records, see write_record().
+// The first holds a magic string and the second holds the format version,
+// the hash of the graph, and the keyframe interval. Every record after that
+// is a block that starts with a keyframe, the step number and the full
+// serialized simulator, followed by at most keyframe_interval firings. Each
+// firing is its index in simulator::loaded, its term, and the difference between its
+// fire_at and simulator::now, all as varints. Seeking loads the nearest
+// keyframe and replays the firings after it.
+
+// Records the firings of a single simulation. Call record() just before each
+// call to simulator::fire() with the same index.
+struct trace_writer
+{
+	trace_writer();
+	~trace_writer();
+
+	FILE *fptr;
+	uint64_t keyframe_interval;
+
+	// The number of firings recorded so far and in the current block.
+	size_t steps;
+	size_t block_steps;
+
+	// The current block, written out by write_block() once it holds
+	// keyframe_interval firings or when the trace is closed.
+	byte_writer block;
+
+	// sim is the state the trace starts from.
+	bool open(string path, const graph &g, const simulator &sim, uint64_t keyframe_interval = 1024);
+	void record(const simulator &sim, int index);
+	void write_block();
+	void close();
+};
+
+struct trace_reader
+{
+	trace_reader();
+	~trace_reader();
+
+	FILE *fptr;
+	graph *base;
+	uint64_t keyframe_interval;
+
+	// The total number of firings in the trace.
+	size_t steps;
+
+	// The first step and the file offset of every block.
+	vector<pair<size_t, long> > blocks;
+
+	// Returns false if the trace can't be read or was recorded on a graph
+	// with a different hash.
+	bool open(string path, graph *base);
+
+	// Rebuild the simulator as it was after the first step firings. Returns
+	// false if step is past the end of the trace or the trace doesn't replay
+	// on this graph.
+	bool seek(size_t step, simulator &sim);
+	void close();
+};
+
+}
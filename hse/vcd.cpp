@@ -0,0 +1,140 @@
+#include "vcd.h"
+
+#include <common/text.h>
+
+namespace hse
+{
+
+// The value of net in encoding as a VCD value character.
+char vcd_value(const boolean::cover &encoding, int net)
+{
+	char result = 0;
+	for (auto c = encoding.cubes.begin(); c != encoding.cubes.end(); c++) {
+		int value = c->get(net);
+		char curr = value == 0 ? '0' : (value == 1 ? '1' : (value < 0 ? 'x' : 'z'));
+		if (result == 0) {
+			result = curr;
+		} else if (result != curr) {
+			result = (result == 'x' or curr == 'x') ? 'x' : 'z';
+		}
+	}
+
+	// An empty encoding is a contradiction.
+	return result == 0 ? 'x' : result;
+}
+
+vcd_writer::vcd_writer()
+{
+	fptr = nullptr;
+	time = 0;
+	started = false;
+	buffer_limit = 1 << 16;
+}
+
+vcd_writer::~vcd_writer()
+{
+	close();
+}
+
+bool vcd_writer::open(string path, const graph &g, string timescale)
+{
+	close();
+
+	fptr = fopen(path.c_str(), "w");
+	if (fptr == nullptr) {
+		error("", "unable to open '" + path + "' to write a waveform", __FILE__, __LINE__);
+		return false;
+	}
+
+	// Identifier codes are written in base 94 using the printable characters.
+	int nets = g.netCount();
+	codes.resize(nets);
+	for (int i = 0; i < nets; i++) {
+		codes[i].clear();
+		int value = i;
+		do {
+			codes[i].push_back((char)('!' + value%94));
+			value /= 94;
+		} while (value > 0);
+	}
+	values.assign(nets, 0);
+	time = 0;
+	started = false;
+
+	buffer = "$version hse simulator $end\n";
+	buffer += "$timescale " + timescale + " $end\n";
+	buffer += "$scope module top $end\n";
+	for (int i = 0; i < nets; i++) {
+		buffer += "$var wire 1 " + codes[i] + " " + g.netAt(i) + " $end\n";
+	}
+	buffer += "$upscope $end\n";
+	buffer += "$enddefinitions $end\n";
+	return true;
+}
+
+void vcd_writer::sample(const simulator &sim)
+{
+	sample(sim.now, sim.encoding);
+}
+
+void vcd_writer::sample(uint64_t now, const boolean::cover &encoding)
+{
+	if (fptr == nullptr) {
+		return;
+	}
+
+	size_t mark = buffer.size();
+	if (not started) {
+		buffer += "#" + ::to_string(now) + "\n$dumpvars\n";
+	} else if (now != time) {
+		buffer += "#" + ::to_string(now) + "\n";
+	}
+	size_t header = buffer.size();
+
+	for (int i = 0; i < (int)codes.size(); i++) {
+		char value = vcd_value(encoding, i);
+		if (value != values[i]) {
+			values[i] = value;
+			buffer.push_back(value);
+			buffer += codes[i];
+			buffer.push_back('\n');
+		}
+	}
+
+	if (not started) {
+		buffer += "$end\n";
+		started = true;
+	} else if (buffer.size() == header) {
+		// Nothing changed, so leave out the timestamp.
+		buffer.resize(mark);
+		return;
+	}
+	time = now;
+
+	if (buffer.size() >= buffer_limit) {
+		flush();
+	}
+}
+
+void vcd_writer::flush()
+{
+	if (fptr != nullptr and not buffer.empty()) {
+		fwrite(buffer.data(), 1, buffer.size(), fptr);
+		buffer.clear();
+	}
+}
+
+void vcd_writer::close()
+{
+	if (fptr != nullptr) {
+		flush();
+		if (ferror(fptr)) {
+			error("", "unable to write the waveform", __FILE__, __LINE__);
+		}
+		fclose(fptr);
+		fptr = nullptr;
+	}
+	buffer.clear();
+}
+
+}
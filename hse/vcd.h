@@ -0,0 +1,55 @@
+#pragma once
+
+#include <common/standard.h>
+#include <boolean/cover.h>
+#include <cstdio>
+#include "graph.h"
+#include "simulator.h"
+
+namespace hse
+{
+
+// Writes the values of the nets of a simulation to a Value Change Dump file
+// as they change, with one timestamp per value of simulator::now. The
+// changes are buffered and written out in large chunks so that long
+// simulations don't have to hold their waveform in memory.
+//
+// Each net is shown as 0 or 1 when it is known, x when it is unstable or
+// interfering, and z when the simulator doesn't know its value. If the
+// encoding has more than one term, a net is only known if every term
+// agrees on its value.
+//
+// To record a simulation, open the writer, point simulator::waveform at it,
+// and optionally call sample() once to record the initial values. Every call
+// to simulator::fire() samples the simulator after that.
+struct vcd_writer
+{
+	vcd_writer();
+	~vcd_writer();
+
+	FILE *fptr;
+
+	// The identifier code of each net in the file.
+	vector<string> codes;
+
+	// The last value written for each net, or 0 if it hasn't been written.
+	vector<char> values;
+
+	// The timestamp of the last change written, and whether anything has
+	// been written since the header.
+	uint64_t time;
+	bool started;
+
+	// Changes waiting to be written to the file.
+	string buffer;
+	size_t buffer_limit;
+
+	// timescale is the length of a unit of simulator::now, for example "1ps".
+	bool open(string path, const graph &g, string timescale = "1ps");
+	void sample(const simulator &sim);
+	void sample(uint64_t now, const boolean::cover &encoding);
+	void flush();
+	void close();
+};
+
+}
@@ -0,0 +1,309 @@
+#include "walker.h"
+#include "diagnostic.h"
+#include "vcd.h"
+#include "compiled.h"
+
+#include <common/text.h>
+
+#include <atomic>
+#include <filesystem>
+#include <thread>
+#include <unordered_set>
+
+namespace hse
+{
+
+uint64_t counter_random(uint64_t seed, uint64_t walk, uint64_t step)
+{
+	uint64_t result = seed;
+	uint64_t words[2] = {walk, step};
+	for (int i = 0; i < 2; i++) {
+		result += 0x9e3779b97f4a7c15ull + words[i];
+		result = (result ^ (result >> 30)) * 0xbf58476d1ce4e5b9ull;
+		result = (result ^ (result >> 27)) * 0x94d049bb133111ebull;
+		result = result ^ (result >> 31);
+	}
+	return result;
+}
+
+walk_config::walk_config()
+{
+	walks = 1000;
+	steps = 1000;
+	seed = 0;
+	threads = 0;
+	reset = 0;
+	waveform_walks = 1;
+	diagnostics = nullptr;
+}
+
+walk_config::~walk_config()
+{
+}
+
+walk_stats::walk_stats()
+{
+	walks = 0;
+	steps = 0;
+	deadlocks = 0;
+}
+
+walk_stats::~walk_stats()
+{
+}
+
+double walk_stats::place_coverage(const graph &g) const
+{
+	size_t total = 0, covered = 0;
+	for (int i = 0; i < (int)places.size(); i++) {
+		if (g.places.is_valid(i)) {
+			total++;
+			covered += places[i];
+		}
+	}
+	return total == 0 ? 1.0 : (double)covered/(double)total;
+}
+
+double walk_stats::transition_coverage(const graph &g) const
+{
+	size_t total = 0, covered = 0;
+	for (int i = 0; i < (int)transitions.size(); i++) {
+		if (g.transitions.is_valid(i)) {
+			total++;
+			covered += transitions[i];
+		}
+	}
+	return total == 0 ? 1.0 : (double)covered/(double)total;
+}
+
+double walk_stats::term_coverage(const graph &g) const
+{
+	size_t total = 0, covered = 0;
+	for (int i = 0; i < (int)terms.size(); i++) {
+		if (g.transitions.is_valid(i)) {
+			total += terms[i].size();
+			for (int j = 0; j < (int)terms[i].size(); j++) {
+				covered += terms[i][j];
+			}
+		}
+	}
+	return total == 0 ? 1.0 : (double)covered/(double)total;
+}
+
+string walk_stats::to_string(const graph &g) const
+{
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "%zu walks, %zu firings, %zu deadlocked\n", walks, steps, deadlocks);
+	string result = buffer;
+	snprintf(buffer, sizeof(buffer), "coverage: places %.1f%%, transitions %.1f%%, terms %.1f%%\n", 100.0*place_coverage(g), 100.0*transition_coverage(g), 100.0*term_coverage(g));
+	result += buffer;
+
+	string missed;
+	for (int i = 0; i < (int)transitions.size(); i++) {
+		if (g.transitions.is_valid(i) and not transitions[i]) {
+			missed += " T" + ::to_string(i);
+		}
+	}
+	if (not missed.empty()) {
+		result += "never fired:" + missed + "\n";
+	}
+
+	if (errors != nullptr) {
+		result += ::to_string(errors->size()) + " distinct errors\n";
+	}
+	return result;
+}
+
+// The results of the walks run by one thread, merged into walk_stats at the
+// end. The counters are bumped on every step, so each worker gets its own
+// cache line.
+struct alignas(64) walk_worker
+{
+	walk_worker();
+	~walk_worker();
+
+	size_t walks;
+	size_t steps;
+	size_t deadlocks;
+
+	vector<bool> places;
+	vector<bool> transitions;
+	vector<vector<bool> > terms;
+
+	std::shared_ptr<error_registry> errors;
+	std::unordered_set<state> deadlocked;
+};
+
+walk_worker::walk_worker()
+{
+	walks = 0;
+	steps = 0;
+	deadlocks = 0;
+	errors = std::make_shared<error_registry>();
+}
+
+walk_worker::~walk_worker()
+{
+}
+
+void walk_thread(graph &g, const walk_config &config, std::atomic<size_t> &next, walk_worker &worker, std::shared_ptr<history_arena> arena)
+{
+	history_scope histories(arena);
+
+	worker.places.assign(g.places.size(), false);
+	worker.transitions.assign(g.transitions.size(), false);
+	worker.terms.resize(g.transitions.size());
+	for (int i = 0; i < (int)g.transitions.size(); i++) {
+		if (g.transitions.is_valid(i)) {
+			worker.terms[i].assign(g.transitions[i].local_action.cubes.size(), false);
+		}
+	}
+
+	// The errors are reported once they have been merged across all of the
+	// threads, otherwise every thread would report its own copy.
+	diagnostic_sink silent(diagnostic_sink::SILENT);
+	simulator initial(&g, g.reset[config.reset]);
+	initial.memoize_guards = true;
+	initial.errors = worker.errors;
+	initial.diagnostics = &silent;
+
+	for (size_t walk = next++; walk < config.walks; walk = next++) {
+		simulator sim = initial;
+		worker.walks++;
+
+		vcd_writer waveform;
+		if (not config.waveform_directory.empty() and walk < config.waveform_walks) {
+			string path = (std::filesystem::path(config.waveform_directory) / ("walk_" + ::to_string(walk) + ".vcd")).string();
+			if (waveform.open(path, g)) {
+				sim.waveform = &waveform;
+				waveform.sample(sim);
+			}
+		}
+
+		for (auto t = sim.tokens.begin(); t != sim.tokens.end(); t++) {
+			worker.places[t->index] = true;
+		}
+
+		for (size_t step = 0; step < config.steps; step++) {
+			int count = sim.enabled();
+			if (count == 0) {
+				worker.deadlocks++;
+				worker.deadlocked.insert(sim.get_state());
+				break;
+			}
+
+			int index = (int)(counter_random(config.seed, walk, step)%(uint64_t)count);
+			int transition = sim.loaded[sim.ready[index].first].index;
+			int term = sim.ready[index].second;
+			sim.fire(index);
+			worker.steps++;
+
+			worker.transitions[transition] = true;
+			worker.terms[transition][term] = true;
+			for (auto t = sim.tokens.begin(); t != sim.tokens.end(); t++) {
+				worker.places[t->index] = true;
+			}
+		}
+	}
+}
+
+walk_stats random_walks(graph &g, const walk_config &config)
+{
+	// Every history made by the walks lives in this arena and is released
+	// in bulk when they are done.
+	history_scope histories;
+
+	walk_stats result;
+	result.errors = std::make_shared<error_registry>();
+	if (config.reset < 0 or config.reset >= (int)g.reset.size()) {
+		error("", "reset state " + ::to_string(config.reset) + " doesn't exist", __FILE__, __LINE__);
+		return result;
+	}
+
+	// Build the snapshot the simulators share before the threads start, see
+	// compile().
+	compile(g);
+
+	int threads = config.threads;
+	if (threads <= 0) {
+		threads = max(1, (int)std::thread::hardware_concurrency());
+	}
+	threads = (int)min((size_t)threads, max(config.walks, (size_t)1));
+
+	std::atomic<size_t> next(0);
+	vector<walk_worker> workers(threads);
+	vector<std::thread> pool;
+	for (int i = 0; i < threads; i++) {
+		pool.push_back(std::thread(walk_thread, std::ref(g), std::cref(config), std::ref(next), std::ref(workers[i]), history_scope::current()));
+	}
+	for (int i = 0; i < threads; i++) {
+		pool[i].join();
+	}
+
+	result.places.assign(g.places.size(), false);
+	result.transitions.assign(g.transitions.size(), false);
+	result.terms.resize(g.transitions.size());
+	std::unordered_set<state> deadlocked;
+	for (auto w = workers.begin(); w != workers.end(); w++) {
+		result.walks += w->walks;
+		result.steps += w->steps;
+		result.deadlocks += w->deadlocks;
+		for (int i = 0; i < (int)w->places.size(); i++) {
+			result.places[i] = result.places[i] or w->places[i];
+		}
+		for (int i = 0; i < (int)w->transitions.size(); i++) {
+			result.transitions[i] = result.transitions[i] or w->transitions[i];
+			result.terms[i].resize(w->terms[i].size(), false);
+			for (int j = 0; j < (int)w->terms[i].size(); j++) {
+				result.terms[i][j] = result.terms[i][j] or w->terms[i][j];
+			}
+		}
+		result.errors->merge(*w->errors);
+		deadlocked.insert(w->deadlocked.begin(), w->deadlocked.end());
+	}
+
+	diagnostic_sink deferred;
+	diagnostic_sink &sink = config.diagnostics != nullptr ? *config.diagnostics : deferred;
+	for (auto e = result.errors->instabilities.begin(); e != result.errors->instabilities.end(); e++) {
+		sink.report(g, diagnostic(*e));
+	}
+	for (auto e = result.errors->interferences.begin(); e != result.errors->interferences.end(); e++) {
+		sink.report(g, diagnostic(*e));
+	}
+	for (auto e = result.errors->mutexes.begin(); e != result.errors->mutexes.end(); e++) {
+		// The registry doesn't keep the tokens the two transitions fought
+		// over, but they must be among the input places they share.
+		vector<int> first = g.prev(petri::transition::type, e->first.index);
+		vector<int> second = g.prev(petri::transition::type, e->second.index);
+		sort(first.begin(), first.end());
+		sort(second.begin(), second.end());
+		sink.report(g, diagnostic(*e, vector_intersection(first, second)));
+	}
+	for (auto s = deadlocked.begin(); s != deadlocked.end(); s++) {
+		sink.report(g, diagnostic(deadlock(*s)));
+	}
+	deferred.flush(g);
+
+	// The histories of the instabilities would outlive the arena, so the
+	// caller gets copies that live in the process wide arena instead.
+	vector<pair<instability, vector<term_index> > > unstable;
+	for (auto e = result.errors->instabilities.begin(); e != result.errors->instabilities.end(); e++) {
+		unstable.push_back(pair<instability, vector<term_index> >(*e, e->history.to_vector()));
+	}
+	result.errors->instabilities.clear();
+
+	{
+		history_scope outside(nullptr);
+		for (auto e = unstable.begin(); e != unstable.end(); e++) {
+			e->first.history.clear();
+			for (auto t = e->second.begin(); t != e->second.end(); t++) {
+				e->first.history.push_back(*t);
+			}
+			result.errors->insert(e->first);
+		}
+	}
+
+	return result;
+}
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <common/standard.h>
+#include "graph.h"
+#include "state.h"
+#include "simulator.h"
+
+#include <memory>
+
+namespace hse
+{
+
+// A counter based random number generator. The result only depends on its
+// arguments, so walk number walk makes the same choices no matter which
+// thread runs it or what ran before it. This is the splitmix64 finalizer
+// applied to each argument in turn.
+uint64_t counter_random(uint64_t seed, uint64_t walk, uint64_t step);
+
+struct walk_config
+{
+	walk_config();
+	~walk_config();
+
+	// The number of walks and the maximum number of firings in each one. A
+	// walk ends early when it deadlocks.
+	size_t walks;
+	size_t steps;
+
+	uint64_t seed;
+
+	// The number of worker threads, 0 uses one thread per hardware core.
+	int threads;
+
+	// Which reset state every walk starts from.
+	int reset;
+
+	// If waveform_directory isn't empty, the first waveform_walks walks each
+	// write their waveform to walk_<n>.vcd in that directory, see vcd.h.
+	string waveform_directory;
+	size_t waveform_walks;
+
+	// Where to send the errors found by the walks once they are merged. If
+	// this is null, they are held and printed when the walks finish, see
+	// diagnostic.h.
+	diagnostic_sink *diagnostics;
+};
+
+struct walk_stats
+{
+	walk_stats();
+	~walk_stats();
+
+	size_t walks;
+	size_t steps;
+
+	// The number of walks that ended in a deadlock.
+	size_t deadlocks;
+
+	// Whether any walk marked each place, fired each transition, or fired
+	// each term of the local action of each transition.
+	vector<bool> places;
+	vector<bool> transitions;
+	vector<vector<bool> > terms;
+
+	// The distinct errors found by all of the walks.
+	std::shared_ptr<error_registry> errors;
+
+	// The covered fraction of the valid places, transitions, and terms.
+	double place_coverage(const graph &g) const;
+	double transition_coverage(const graph &g) const;
+	double term_coverage(const graph &g) const;
+
+	string to_string(const graph &g) const;
+};
+
+// Run config.walks independent random walks of g spread over a pool of
+// threads. Each thread owns its simulators and its own error registry, and
+// the registries and coverage are merged once all of the walks are done.
+// The graph is only read while the walks run. The same seed always gives
+// the same result regardless of the number of threads.
+walk_stats random_walks(graph &g, const walk_config &config = walk_config());
+
+}
@@ -0,0 +1,597 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <vector>
+
+#include <hse/graph.h>
+#include <hse/elaborator.h>
+#include <hse/diagnostic.h>
+
+#include "helpers.h"
+
+using namespace std;
+using namespace hse;
+
+// Elaborate the same graph twice and check that the recorded predicates match
+// place by place.
+void expect_same_predicates(const graph &g0, const graph &g1) {
+	ASSERT_EQ(g0.places.size(), g1.places.size());
+	for (int i = 0; i < (int)g0.places.size(); i++) {
+		if (not g0.places.is_valid(i)) continue;
+
+		EXPECT_EQ(g0.places[i].predicate, g1.places[i].predicate) << "place " << i;
+		EXPECT_EQ(g0.places[i].effective, g1.places[i].effective) << "place " << i;
+	}
+}
+
+// Espresso doesn't always pick the same cover for the same set of states, so
+// this only checks that the recorded predicates cover the same states.
+void expect_equivalent_predicates(const graph &g0, const graph &g1) {
+	ASSERT_EQ(g0.places.size(), g1.places.size());
+	for (int i = 0; i < (int)g0.places.size(); i++) {
+		if (not g0.places.is_valid(i)) continue;
+
+		EXPECT_TRUE(are_mutex(g0.places[i].predicate, ~g1.places[i].predicate)) << "place " << i;
+		EXPECT_TRUE(are_mutex(g1.places[i].predicate, ~g0.places[i].predicate)) << "place " << i;
+		EXPECT_TRUE(are_mutex(g0.places[i].effective, ~g1.places[i].effective)) << "place " << i;
+		EXPECT_TRUE(are_mutex(g1.places[i].effective, ~g0.places[i].effective)) << "place " << i;
+	}
+}
+
+// The deadlocks reported to a sink, formatted and sorted so that sinks
+// filled in a different order can be compared.
+vector<string> deadlocks_in(const diagnostic_sink &sink, const graph &g) {
+	vector<string> result;
+	for (auto d = sink.records.begin(); d != sink.records.end(); d++) {
+		if (d->kind == diagnostic::DEADLOCK) {
+			result.push_back(d->to_string(g));
+		}
+	}
+	sort(result.begin(), result.end());
+	return result;
+}
+
+TEST(Elaborator, ParallelMatchesSerial) {
+	// The first loops forever, the second stops after one pass and
+	// deadlocks with z either set or not.
+	vector<string> designs = {
+		"x-,y-,z-; *[x+,y+; [1->z+:1->skip]; x-,y-,z-]",
+		"x-,y-,z-; x+,y+; [1->z+:1->skip]; x-,y-"
+	};
+
+	for (auto design = designs.begin(); design != designs.end(); design++) {
+		graph serial = parse_hse_string(*design);
+		graph parallel = serial;
+
+		diagnostic_sink serial_sink, parallel_sink;
+		elaborate_config config;
+		config.diagnostics = &serial_sink;
+		elaborate(serial, config);
+
+		config.threads = 4;
+		config.diagnostics = &parallel_sink;
+		elaborate(parallel, config);
+
+		expect_same_predicates(serial, parallel);
+		EXPECT_EQ(parallel_sink.found[diagnostic::DEADLOCK], serial_sink.found[diagnostic::DEADLOCK]) << *design;
+		EXPECT_EQ(deadlocks_in(parallel_sink, parallel), deadlocks_in(serial_sink, serial)) << *design;
+	}
+}
+
+// The places that follow the transition that assigns action.
+vector<int> places_after(const graph &g, boolean::cover action) {
+	vector<int> result;
+	for (int i = 0; i < (int)g.transitions.size(); i++) {
+		if (g.transitions.is_valid(i) and g.transitions[i].local_action == action) {
+			vector<int> next = g.next(transition::type, i);
+			result.insert(result.end(), next.begin(), next.end());
+		}
+	}
+	return result;
+}
+
+TEST(Elaborator, SavedPredicatesMatchBaseline) {
+	graph g = parse_hse_string("x-,y-; *[x+,y+; x-,y-]");
+	int x = g.netIndex("x");
+	int y = g.netIndex("y");
+	elaborate(g);
+
+	// The covers recorded before save_predicates() sorted the cubes, by the
+	// assignment that leads into the place. Every net is in the mask of every place since
+	// the whole design is one loop.
+	vector<pair<boolean::cover, boolean::cover> > baseline = {
+		{boolean::cover(x, 1), boolean::cover(x, 1)},
+		{boolean::cover(y, 1), boolean::cover(y, 1)},
+		{boolean::cover(x, 0), boolean::cover(x, 0)},
+		{boolean::cover(y, 0), boolean::cover(y, 0)}
+	};
+	for (auto b = baseline.begin(); b != baseline.end(); b++) {
+		vector<int> after = places_after(g, b->first);
+		ASSERT_FALSE(after.empty());
+		for (auto p = after.begin(); p != after.end(); p++) {
+			EXPECT_EQ(g.places[*p].predicate, b->second) << "place " << *p;
+		}
+	}
+
+	// The same covers come out however the states were visited.
+	graph parallel = parse_hse_string("x-,y-; *[x+,y+; x-,y-]");
+	elaborate_config config;
+	config.threads = 4;
+	elaborate(parallel, config);
+	expect_same_predicates(g, parallel);
+}
+
+TEST(Elaborator, UnsupportedParallelOptionsFallBack) {
+	graph memory = parse_hse_string("x-,y-,z-; *[x+,y+; [1->z+:1->skip]; x-,y-,z-]");
+	graph spilled = memory;
+	elaborate(memory);
+
+	// Only the serial explorer spills its frontier, so this runs serially
+	// and says why.
+	diagnostic_sink sink;
+	elaborate_config config;
+	config.threads = 4;
+	config.frontier_budget = 1024;
+	config.diagnostics = &sink;
+	elaborate(spilled, config);
+
+	EXPECT_EQ(sink.found[diagnostic::UNSUPPORTED], 1u);
+	expect_same_predicates(memory, spilled);
+}
+
+TEST(Elaborator, PredicatesDontDependOnVisitOrder) {
+	graph forward = parse_hse_string("x-,y-,z-; *[x+,y+; [1->z+:1->skip]; x-,y-,z-]");
+
+	// Add a second reset state that the first one reaches anyway. Listing
+	// them in the opposite order changes the order of the depth first search
+	// but not the states it visits.
+	simulator sim(&forward, forward.reset[0]);
+	ASSERT_GT(sim.enabled(), 0);
+	sim.fire(0);
+	forward.reset.push_back(sim.get_state());
+
+	graph backward = forward;
+	std::reverse(backward.reset.begin(), backward.reset.end());
+
+	elaborate(forward);
+	elaborate(backward);
+
+	expect_same_predicates(forward, backward);
+}
+
+TEST(Elaborator, SpilledMatchesInMemory) {
+	graph memory = parse_hse_string("x-,y-,z-; *[x+,y+; [1->z+:1->skip]; x-,y-,z-]");
+	graph spilled = memory;
+
+	elaborate(memory);
+
+	// Budgets this small force nearly every state and pending simulation out
+	// to disk.
+	elaborate_config config;
+	config.visited_budget = 256;
+	config.frontier_budget = 1024;
+	elaborate(spilled, config);
+
+	expect_same_predicates(memory, spilled);
+
+	// The parallel explorer splits the visited budget over 64 shards, so
+	// each shard gets less than a byte. That must still spill rather than
+	// turn into no budget at all. It has no frontier budget.
+	graph parallel = memory;
+	config.threads = 4;
+	config.visited_budget = 16;
+	config.frontier_budget = 0;
+	elaborate(parallel, config);
+
+	expect_same_predicates(memory, parallel);
+}
+
+TEST(Elaborator, ReducedMatchesFull) {
+	// Three independent processes whose variables aren't visible to each
+	// other, so most interleavings can be skipped. They don't loop, see
+	// elaborate_config::reduce. The full run visits all eight combinations of
+	// x, y, and z while the reduced run only needs one path to the end.
+	graph full = parse_hse_string("x-; x+ || y-; y+ || z-; z+");
+	graph reduced = full;
+
+	// The sinks hold on to the deadlocks without printing them.
+	diagnostic_sink full_sink, reduced_sink;
+	diagnostic_sink *sinks[2] = {&full_sink, &reduced_sink};
+	graph *graphs[2] = {&full, &reduced};
+	size_t states[2] = {0, 0};
+	for (int i = 0; i < 2; i++) {
+		elaborate_config config;
+		config.reduce = i == 1;
+		config.diagnostics = sinks[i];
+		config.monitor = [&states, i](const elaborate_stats &stats) {
+			states[i] = stats.states;
+		};
+		elaborate(*graphs[i], config);
+	}
+
+	expect_same_predicates(full, reduced);
+	EXPECT_EQ(states[0], 8u);
+	EXPECT_LT(states[1], states[0]);
+
+	// Both runs end in the same deadlock.
+	EXPECT_EQ(full_sink.found[diagnostic::DEADLOCK], 1u);
+	EXPECT_EQ(reduced_sink.found[diagnostic::DEADLOCK], 1u);
+}
+
+TEST(Elaborator, SubsumedStatesArePruned) {
+	graph full = parse_hse_string("x-,y-; *[x+,y+; x-,y-]");
+	ASSERT_EQ(full.reset.size(), 1u);
+
+	// A second reset state with the same marking that leaves y unknown. Its
+	// encodings are a strict superset of the first, so once it has been
+	// visited, the first reset state is dominated.
+	state wide = full.reset[0];
+	wide.encodings = boolean::cover(full.netIndex("x"), 0);
+	ASSERT_TRUE(full.reset[0].is_subset_of(wide));
+	ASSERT_FALSE(wide.is_subset_of(full.reset[0]));
+	full.reset.insert(full.reset.begin(), wide);
+	graph pruned = full;
+
+	diagnostic_sink full_sink, pruned_sink;
+	elaborate_config config;
+	config.diagnostics = &full_sink;
+	elaborate(full, config);
+
+	elaborate_stats stats;
+	config.subsume = true;
+	config.diagnostics = &pruned_sink;
+	config.monitor = [&](const elaborate_stats &s) {
+		stats = s;
+	};
+	elaborate(pruned, config);
+
+	EXPECT_TRUE(stats.done);
+	EXPECT_GT(stats.pruned, 0u);
+	EXPECT_GE(stats.checked, stats.pruned);
+	EXPECT_NE(stats.to_json().find("\"checked\":"), string::npos);
+	expect_equivalent_predicates(full, pruned);
+}
+
+TEST(Elaborator, SubsumeWithThreadsIsReported) {
+	graph g = parse_hse_string("x-,y-; *[x+,y+; x-,y-]");
+	state wide = g.reset[0];
+	wide.encodings = boolean::cover(g.netIndex("x"), 0);
+	g.reset.insert(g.reset.begin(), wide);
+
+	// The parallel explorer has no subsumption index, so this falls back to
+	// the serial explorer and says so.
+	diagnostic_sink sink;
+	elaborate_stats stats;
+	elaborate_config config;
+	config.threads = 2;
+	config.subsume = true;
+	config.diagnostics = &sink;
+	config.monitor = [&](const elaborate_stats &s) {
+		stats = s;
+	};
+	elaborate(g, config);
+
+	EXPECT_EQ(sink.found[diagnostic::UNSUPPORTED], 1u);
+	EXPECT_GT(stats.pruned, 0u);
+
+	diagnostic_sink symbolic_sink;
+	config.engine = elaborate_config::SYMBOLIC;
+	config.diagnostics = &symbolic_sink;
+	elaborate(g, config);
+	EXPECT_EQ(symbolic_sink.found[diagnostic::UNSUPPORTED], 1u);
+}
+
+TEST(Elaborator, SymbolicMatchesExplicit) {
+	graph explicit_graph = parse_hse_string("x-; *[x+; x-] || y-; *[y+; y-] || z-; *[z+; z-]");
+	graph symbolic_graph = explicit_graph;
+
+	elaborate(explicit_graph);
+
+	elaborate_config config;
+	config.engine = elaborate_config::SYMBOLIC;
+	elaborate(symbolic_graph, config);
+
+	expect_equivalent_predicates(explicit_graph, symbolic_graph);
+}
+
+TEST(Elaborator, SymbolicMatchesExplicitOnSelection) {
+	// One branch of the selection forks into two parallel assignments and
+	// joins them again, so the engines must agree on both the choice and the
+	// interleavings inside it.
+	graph explicit_graph = parse_hse_string("a-,b-,x-,y-; *[[1->a+; x+,y+; a-; x-,y- : 1->b+; b-]]");
+	graph symbolic_graph = explicit_graph;
+
+	elaborate(explicit_graph);
+
+	elaborate_config config;
+	config.engine = elaborate_config::SYMBOLIC;
+	elaborate(symbolic_graph, config);
+
+	expect_equivalent_predicates(explicit_graph, symbolic_graph);
+}
+
+TEST(Elaborator, SymbolicFallsBackOnVacuousTransition) {
+	// The second x+ is vacuous, which the symbolic engine doesn't model, so
+	// it says so and hands the design to the explicit engine.
+	graph explicit_graph = parse_hse_string("x-; *[x+; x+; x-]");
+	graph symbolic_graph = explicit_graph;
+
+	elaborate(explicit_graph);
+
+	diagnostic_sink sink;
+	elaborate_config config;
+	config.engine = elaborate_config::SYMBOLIC;
+	config.diagnostics = &sink;
+	elaborate(symbolic_graph, config);
+
+	EXPECT_EQ(sink.found[diagnostic::UNSUPPORTED], 1u);
+	expect_equivalent_predicates(explicit_graph, symbolic_graph);
+}
+
+TEST(Elaborator, SymbolicDeadlocksGoToTheSink) {
+	graph g = parse_hse_string("x-; x+");
+
+	diagnostic_sink sink;
+	elaborate_config config;
+	config.engine = elaborate_config::SYMBOLIC;
+	config.diagnostics = &sink;
+	elaborate(g, config);
+
+	EXPECT_EQ(sink.found[diagnostic::DEADLOCK], 1u);
+	EXPECT_EQ(deadlocks_in(sink, g).size(), 1u);
+}
+
+TEST(Elaborator, IncrementalMatchesFull) {
+	graph incremental = parse_hse_string("x-,y-,z-; *[x+,y+; [1->z+:1->skip]; x-,y-,z-]");
+
+	elaborate_cache cache;
+	elaborate(incremental, elaborate_config(), cache);
+
+	// Add a net that nothing touches, so every state is reused with its
+	// value tacked on.
+	int v = incremental.create(net("v", 0));
+	for (auto s = incremental.reset.begin(); s != incremental.reset.end(); s++) {
+		s->encodings &= boolean::cube(v, 0);
+	}
+
+	graph full = incremental;
+	elaborate(full);
+	elaborate(incremental, elaborate_config(), cache);
+
+	expect_same_predicates(full, incremental);
+}
+
+TEST(Elaborator, IncrementalAfterInsertingStateVariable) {
+	graph incremental = parse_hse_string("w-,x-,y-,z-; w+; x+; y+; z+");
+
+	diagnostic_sink sink;
+	elaborate_config config;
+	config.diagnostics = &sink;
+	elaborate_cache cache;
+	elaborate(incremental, config, cache);
+
+	// Insert v+ right after w+, the way the encoder inserts a state variable.
+	// The states before the insertion can reach it and have to be simulated
+	// again, the states once y+ has fired can't and are reused.
+	int w = incremental.netIndex("w");
+	int v = incremental.create(net("v", 0));
+	for (auto s = incremental.reset.begin(); s != incremental.reset.end(); s++) {
+		s->encodings &= boolean::cube(v, 0);
+	}
+	int rising = -1;
+	for (int i = 0; i < (int)incremental.transitions.size(); i++) {
+		if (incremental.transitions.is_valid(i) and incremental.transitions[i].local_action == boolean::cover(w, 1)) {
+			rising = i;
+		}
+	}
+	ASSERT_GE(rising, 0);
+	vector<int> after = incremental.next(transition::type, rising);
+	ASSERT_EQ(after.size(), 1u);
+	incremental.insert_at(petri::region({petri::iterator(place::type, after[0])}), transition(1, 1, boolean::cover(v, 1)));
+	incremental.update_masks();
+	incremental.update_arc_index();
+
+	vector<bool> reusable = cache.reusable(incremental);
+	EXPECT_NE(std::count(reusable.begin(), reusable.end(), true), 0);
+	EXPECT_NE(std::count(reusable.begin(), reusable.end(), false), 0);
+
+	graph full = incremental;
+	diagnostic_sink full_sink;
+	config.diagnostics = &full_sink;
+	elaborate(full, config);
+
+	diagnostic_sink incremental_sink;
+	config.diagnostics = &incremental_sink;
+	elaborate(incremental, config, cache);
+
+	expect_same_predicates(full, incremental);
+	EXPECT_EQ(deadlocks_in(incremental_sink, incremental), deadlocks_in(full_sink, full));
+}
+
+TEST(Elaborator, IncrementalReportsIgnoredOptions) {
+	graph full = parse_hse_string("x-,y-,z-; *[x+,y+; [1->z+:1->skip]; x-,y-,z-]");
+	graph incremental = full;
+	elaborate(full);
+
+	vector<elaborate_stats> reports;
+	diagnostic_sink sink;
+	elaborate_config config;
+	config.threads = 4;
+	config.reduce = true;
+	config.diagnostics = &sink;
+	config.monitor = [&](const elaborate_stats &stats) {
+		reports.push_back(stats);
+	};
+
+	elaborate_cache cache;
+	elaborate(incremental, config, cache);
+
+	EXPECT_EQ(sink.found[diagnostic::UNSUPPORTED], 1u);
+	ASSERT_FALSE(reports.empty());
+	EXPECT_TRUE(reports.back().done);
+	EXPECT_GT(reports.back().states, 0u);
+	expect_same_predicates(full, incremental);
+}
+
+TEST(Elaborator, MonitorReportsFinalStats) {
+	graph g = parse_hse_string("x-,y-,z-; *[x+,y+; [1->z+:1->skip]; x-,y-,z-]");
+
+	vector<elaborate_stats> reports;
+	elaborate_config config;
+	config.monitor = [&](const elaborate_stats &stats) {
+		reports.push_back(stats);
+	};
+	elaborate(g, config);
+
+	ASSERT_FALSE(reports.empty());
+	EXPECT_TRUE(reports.back().done);
+	EXPECT_GT(reports.back().states, 0u);
+	EXPECT_EQ(reports.back().frontier, 0u);
+	EXPECT_NE(reports.back().to_json().find("\"states\":"), string::npos);
+}
+
+TEST(Elaborator, ResumeFromCheckpoint) {
+	graph original = parse_hse_string("x-,y-,z-; *[x+,y+; [1->z+:1->skip]; x-,y-,z-]");
+	graph resumed = original;
+
+	string path = (std::filesystem::temp_directory_path() / "hse_elaborator_tests_checkpoint.bin").string();
+
+	elaborate_config config;
+	config.checkpoint_path = path;
+	elaborate(original, config);
+
+	EXPECT_TRUE(resume_elaborate(resumed, path));
+	expect_same_predicates(original, resumed);
+
+	// A checkpoint for a different graph is rejected.
+	graph other = parse_hse_string("x-; *[x+; x-]");
+	EXPECT_FALSE(resume_elaborate(other, path));
+
+	std::remove(path.c_str());
+}
+
+TEST(Elaborator, ResumeFromMidRunCheckpoint) {
+	// Nine independent assignments give 512 states, enough for the explorer
+	// to write a checkpoint part of the way through. It ends in one deadlock
+	// once everything has fired.
+	graph original = parse_hse_string("a-; a+ || b-; b+ || c-; c+ || d-; d+ || e-; e+ || f-; f+ || g-; g+ || h-; h+ || i-; i+");
+	graph resumed = original;
+
+	string path = (std::filesystem::temp_directory_path() / "hse_elaborator_tests_midrun.bin").string();
+	string snapshot = path + ".mid";
+
+	// Checkpoint as often as the explorer checks, and grab a copy of the
+	// first checkpoint written while there is still work left to do.
+	diagnostic_sink original_sink;
+	elaborate_config config;
+	config.checkpoint_path = path;
+	config.checkpoint_interval = 0.0;
+	config.progress_interval = 0.0;
+	config.diagnostics = &original_sink;
+	bool copied = false;
+	config.monitor = [&](const elaborate_stats &stats) {
+		if (not copied and not stats.done and stats.frontier > 0 and std::filesystem::exists(path)) {
+			copied = std::filesystem::copy_file(path, snapshot, std::filesystem::copy_options::overwrite_existing);
+		}
+	};
+	elaborate(original, config);
+	ASSERT_TRUE(copied);
+
+	diagnostic_sink resumed_sink;
+	elaborate_config resume_config;
+	resume_config.diagnostics = &resumed_sink;
+	EXPECT_TRUE(resume_elaborate(resumed, snapshot, resume_config));
+
+	expect_same_predicates(original, resumed);
+	EXPECT_EQ(original_sink.found[diagnostic::DEADLOCK], 1u);
+	EXPECT_EQ(resumed_sink.found[diagnostic::DEADLOCK], original_sink.found[diagnostic::DEADLOCK]);
+	ASSERT_EQ(resumed_sink.records.size(), original_sink.records.size());
+	for (int i = 0; i < (int)original_sink.records.size(); i++) {
+		EXPECT_EQ(resumed_sink.records[i].to_string(resumed), original_sink.records[i].to_string(original));
+	}
+
+	std::remove(path.c_str());
+	std::remove(snapshot.c_str());
+}
+
+// Run f and return everything it printed to stdout and stderr.
+string output_of(std::function<void()> f) {
+	testing::internal::CaptureStdout();
+	testing::internal::CaptureStderr();
+	f();
+	string out = testing::internal::GetCapturedStdout();
+	return out + testing::internal::GetCapturedStderr();
+}
+
+TEST(Elaborator, DiagnosticsAreDeferred) {
+	// This process stops after one assignment, so it deadlocks.
+	graph g = parse_hse_string("x-; x+");
+
+	// Nothing is printed until the sink is flushed.
+	diagnostic_sink sink(diagnostic_sink::DEFERRED);
+	elaborate_config config;
+	config.diagnostics = &sink;
+	EXPECT_EQ(output_of([&]() { elaborate(g, config); }), "");
+
+	EXPECT_EQ(sink.found[diagnostic::DEADLOCK], 1u);
+	ASSERT_EQ(sink.records.size(), 1u);
+	EXPECT_EQ(sink.records[0].kind, diagnostic::DEADLOCK);
+	EXPECT_NE(sink.records[0].to_string(g).find("deadlock"), string::npos);
+
+	string flushed = output_of([&]() { sink.flush(g); });
+	EXPECT_NE(flushed.find("deadlock"), string::npos);
+	EXPECT_TRUE(sink.records.empty());
+	EXPECT_EQ(sink.found[diagnostic::DEADLOCK], 0u);
+
+	// A silent sink neither prints nor keeps anything.
+	diagnostic_sink silent(diagnostic_sink::SILENT);
+	config.diagnostics = &silent;
+	EXPECT_EQ(output_of([&]() { elaborate(g, config); }), "");
+	EXPECT_TRUE(silent.records.empty());
+	EXPECT_EQ(silent.found[diagnostic::DEADLOCK], 0u);
+	EXPECT_EQ(output_of([&]() { silent.flush(g); }), "");
+}
+
+TEST(Elaborator, DiagnosticsOverLimitAreSummarized) {
+	graph g = parse_hse_string("x-; x+");
+	ASSERT_EQ(g.reset.size(), 1u);
+	int x = g.netIndex("x");
+
+	// Report one more deadlock than the sink keeps.
+	diagnostic_sink sink(diagnostic_sink::DEFERRED, 1);
+	state first = g.reset[0];
+	state second = g.reset[0];
+	second.encodings = boolean::cover(x, 1);
+	EXPECT_EQ(output_of([&]() {
+		sink.report(g, diagnostic(deadlock(first)));
+		sink.report(g, diagnostic(deadlock(second)));
+	}), "");
+
+	EXPECT_EQ(sink.found[diagnostic::DEADLOCK], 2u);
+	ASSERT_EQ(sink.records.size(), 1u);
+	string kept = sink.records[0].to_string(g);
+
+	// The kept deadlock is printed, the other one is only counted.
+	string flushed = output_of([&]() { sink.flush(g); });
+	EXPECT_NE(flushed.find(kept), string::npos);
+	EXPECT_NE(flushed.find("found 2 deadlocks, only the first 1 were reported"), string::npos);
+	EXPECT_TRUE(sink.records.empty());
+	EXPECT_EQ(sink.found[diagnostic::DEADLOCK], 0u);
+}
+
+TEST(Elaborator, RecycledSimulatorsMatch) {
+	graph recycled = parse_hse_string("x-,y-,z-; *[x+,y+; [1->z+:1->skip]; x-,y-,z-]");
+	graph fresh = recycled;
+
+	elaborate(recycled);
+
+	elaborate_config config;
+	config.recycle = false;
+	elaborate(fresh, config);
+
+	expect_same_predicates(recycled, fresh);
+	EXPECT_EQ(to_state_graph(recycled, elaborate_config()).places.size(), to_state_graph(fresh, config).places.size());
+}
@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <hse/marking.h>
+#include <hse/state.h>
+#include <hse/state_table.h>
+
+using namespace hse;
+using namespace std;
+
+vector<petri::token> make_tokens(vector<int> places) {
+	vector<petri::token> result;
+	for (auto i = places.begin(); i != places.end(); i++) {
+		result.push_back(petri::token(*i));
+	}
+	return result;
+}
+
+TEST(Marking, RoundTrip) {
+	vector<petri::token> tokens = make_tokens({0, 3, 63, 64, 130});
+	marking m(tokens, 200);
+	EXPECT_EQ(m.count(), 5);
+	EXPECT_TRUE(m.has(64));
+	EXPECT_FALSE(m.has(65));
+	EXPECT_EQ(m.tokens(), tokens);
+}
+
+TEST(Marking, IgnoresSize) {
+	marking m0(make_tokens({1, 5}), 10);
+	marking m1(make_tokens({1, 5}), 300);
+	EXPECT_EQ(m0, m1);
+	EXPECT_EQ(m0.hash(), m1.hash());
+	EXPECT_FALSE(m0 < m1 or m1 < m0);
+}
+
+TEST(Marking, SetOperations) {
+	marking m0(make_tokens({1, 70}));
+	marking m1(make_tokens({1, 2}));
+
+	EXPECT_EQ((m0 | m1).tokens(), make_tokens({1, 2, 70}));
+	EXPECT_EQ((m0 & m1).tokens(), make_tokens({1}));
+	EXPECT_TRUE((m0 & m1).is_subset_of(m0));
+	EXPECT_FALSE(m0.is_subset_of(m1));
+	EXPECT_TRUE(marking().is_subset_of(m1));
+}
+
+TEST(Marking, MergeStates) {
+	state s0(make_tokens({1, 4}), boolean::cover(0, 1));
+	state s1(make_tokens({2, 4}), boolean::cover(1, 0));
+
+	state s = state::merge(s0, s1);
+	EXPECT_EQ(s.tokens, make_tokens({1, 2, 4}));
+	EXPECT_EQ(s.encodings, s0.encodings & s1.encodings);
+}
+
+TEST(Marking, DenseStatesInTable) {
+	// Enough tokens that the visited table stores them as a bitset.
+	vector<int> places;
+	for (int i = 0; i < 40; i++) {
+		places.push_back(i*3);
+	}
+	state dense(make_tokens(places), boolean::cover(0, 1));
+	state sparse(make_tokens({7, 90}), boolean::cover(0, 0));
+
+	state_table table;
+	bool inserted = false;
+	int d = table.insert(dense, 0, &inserted);
+	EXPECT_TRUE(inserted);
+	int s = table.insert(sparse, 1, &inserted);
+	EXPECT_TRUE(inserted);
+
+	table.insert(dense, 0, &inserted);
+	EXPECT_FALSE(inserted);
+
+	EXPECT_EQ(table.key(d), dense);
+	EXPECT_EQ(table.key(s), sparse);
+}
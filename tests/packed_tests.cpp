@@ -0,0 +1,49 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <boolean/cube.h>
+#include <hse/packed.h>
+
+using namespace hse;
+using namespace std;
+
+TEST(Packed, RoundTrip) {
+	boolean::cube c;
+	c &= boolean::cube(0, 1);
+	c &= boolean::cube(17, 0);
+	c &= boolean::cube(40, 1);
+	c &= boolean::cube(100, 0);
+
+	packed_cube<4> p;
+	ASSERT_TRUE(p.pack(c));
+	EXPECT_TRUE(p.unpack() == c);
+
+	// 100 doesn't fit in 64 nets.
+	packed_cube<2> q;
+	EXPECT_FALSE(q.pack(c));
+	EXPECT_EQ(q.unpack().get(100), 2);
+	EXPECT_EQ(q.unpack().get(40), 1);
+}
+
+TEST(Packed, Changes) {
+	boolean::cube a, b;
+	a &= boolean::cube(3, 0);
+	a &= boolean::cube(33, 1);
+	a &= boolean::cube(70, 1);
+	b &= boolean::cube(3, 1);
+	b &= boolean::cube(33, 1);
+	b &= boolean::cube(90, 0);
+
+	vector<int> changed;
+	packed_cube<4>(a).for_each_change(packed_cube<4>(b), [&changed](int net) {
+		changed.push_back(net);
+	});
+	EXPECT_EQ(changed, vector<int>({3, 70, 90}));
+
+	boolean::cube c = boolean::cube(33, 1);
+	c &= boolean::cube(90, 0);
+	EXPECT_TRUE((packed_cube<4>(c) & packed_cube<4>(a)).unpack() == (c & a));
+	EXPECT_TRUE(packed_cube<4>(a).is_subset_of(packed_cube<4>(boolean::cube(33, 1))));
+	EXPECT_FALSE(packed_cube<4>(a).is_subset_of(packed_cube<4>(b)));
+}
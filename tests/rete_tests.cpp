@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <hse/graph.h>
+#include <hse/state.h>
+#include <hse/simulator.h>
+#include <hse/rete.h>
+#include <hse/diagnostic.h>
+
+#include "helpers.h"
+
+using namespace hse;
+using namespace std;
+
+// The enabled terms of each engine as (transition, term) pairs.
+vector<pair<int, int> > enabled_terms(const simulator &sim) {
+	vector<pair<int, int> > result;
+	for (auto r = sim.ready.begin(); r != sim.ready.end(); r++) {
+		result.push_back(pair<int, int>(sim.loaded[r->first].index, r->second));
+	}
+	sort(result.begin(), result.end());
+	result.erase(unique(result.begin(), result.end()), result.end());
+	return result;
+}
+
+vector<pair<int, int> > enabled_terms(const rete_simulator &sim) {
+	vector<pair<int, int> > result = sim.ready;
+	sort(result.begin(), result.end());
+	return result;
+}
+
+int find_term(const simulator &sim, pair<int, int> term) {
+	for (int i = 0; i < (int)sim.ready.size(); i++) {
+		if (sim.loaded[sim.ready[i].first].index == term.first and sim.ready[i].second == term.second) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int find_term(const rete_simulator &sim, pair<int, int> term) {
+	auto i = find(sim.ready.begin(), sim.ready.end(), term);
+	return i == sim.ready.end() ? -1 : (int)(i - sim.ready.begin());
+}
+
+// Drive both engines with the same choices and check that they agree on the
+// enabled transitions and reach the same states. None of these designs has
+// anything the production rule engine would have to report.
+void expect_same_walk(graph &g, int steps) {
+	simulator sim(&g, g.reset[0]);
+	rete_simulator rete(&g, g.reset[0]);
+	diagnostic_sink sink;
+	rete.diagnostics = &sink;
+
+	for (int step = 0; step < steps; step++) {
+		sim.enabled();
+		rete.enabled();
+
+		vector<pair<int, int> > expect = enabled_terms(sim);
+		ASSERT_EQ(enabled_terms(rete), expect);
+		if (expect.empty()) {
+			break;
+		}
+
+		pair<int, int> choice = expect[step%expect.size()];
+		sim.fire(find_term(sim, choice));
+		rete.fire(find_term(rete, choice));
+
+		state a = sim.get_state();
+		state b = rete.get_state();
+		EXPECT_EQ(a.tokens, b.tokens);
+		EXPECT_TRUE(a.encodings.is_subset_of(b.encodings));
+		EXPECT_TRUE(b.encodings.is_subset_of(a.encodings));
+	}
+
+	EXPECT_TRUE(sink.records.empty());
+}
+
+TEST(Rete, SequenceMatchesSimulator) {
+	graph g = parse_hse_string("x-,y-; *[x+; y+; x-; y-]");
+	expect_same_walk(g, 50);
+}
+
+TEST(Rete, ParallelMatchesSimulator) {
+	graph g = parse_hse_string("x-,y-,z-; *[x+,y+; z+; x-,y-; z-]");
+	expect_same_walk(g, 100);
+}
+
+TEST(Rete, HandshakeMatchesSimulator) {
+	// Every transition here is guarded, so any guard literal that is
+	// registered under the wrong net or value shows up as a mismatch.
+	graph g = parse_hse_string("x-; *[x+; [y]; x-; [~y]] || y-; *[[x]; y+; [~x]; y-]");
+	expect_same_walk(g, 100);
+}
+
+TEST(Rete, SelectionMatchesSimulator) {
+	graph g = parse_hse_string("a+,b-,x-,y-; [a->x+:b->y+]");
+	expect_same_walk(g, 10);
+
+	graph h = parse_hse_string("a-,b+,x-,y-; [a->x+:b->y+]");
+	expect_same_walk(h, 10);
+}
+
+TEST(Rete, VacuousFiringIsReported) {
+	// The second x+ doesn't change anything, which hse::simulator folds
+	// into the tokens it passes along and this engine can't.
+	graph g = parse_hse_string("x-; *[x+; x+; x-]");
+	rete_simulator rete(&g, g.reset[0]);
+	diagnostic_sink sink;
+	rete.diagnostics = &sink;
+	for (int step = 0; step < 10 and rete.enabled() > 0; step++) {
+		rete.fire(0);
+	}
+
+	EXPECT_GT(sink.found[diagnostic::UNSUPPORTED], 0u);
+}
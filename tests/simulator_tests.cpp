@@ -2,10 +2,12 @@
 
 #include <algorithm>
 #include <vector>
+#include <thread>
 
 #include <hse/graph.h>
 #include <hse/state.h>
 #include <hse/simulator.h>
+#include <hse/compiled.h>
 
 #include "helpers.h"
 
@@ -173,3 +175,350 @@ TEST(Simulator, Choice) {
 	EXPECT_EQ(g.transitions[sim.loaded[sim.ready[0].first].index].local_action.cubes[sim.ready[0].second] | g.transitions[sim.loaded[sim.ready[1].first].index].local_action.cubes[sim.ready[1].second], boolean::cover(x, 1) | boolean::cover(y, 1));
 }
 
+
+TEST(Simulator, Rollback) {
+	graph g = parse_hse_string("x-,y-; *[[1->x+:1->y+]; x-,y-]");
+
+	simulator sim(&g, g.reset[0]);
+	sim.enabled();
+
+	// Walk a few steps in so that the history is non-trivial
+	sim.fire(0);
+	sim.enabled();
+
+	simulator original = sim;
+	undo_log log;
+	for (int i = 0; i < (int)original.ready.size(); i++) {
+		simulator copy = original;
+		copy.fire(i);
+		copy.enabled();
+
+		// Firing in place should land in the same state as firing a copy
+		sim.fire(i, &log);
+		sim.enabled(false, &log);
+		EXPECT_EQ(sim.get_state(), copy.get_state());
+		EXPECT_EQ(sim.ready, copy.ready);
+		EXPECT_EQ(sim.loaded.size(), copy.loaded.size());
+
+		// And rolling back should take us back to where we started
+		sim.rollback(log);
+		EXPECT_EQ(sim.get_state(), original.get_state());
+		EXPECT_EQ(sim.ready, original.ready);
+		EXPECT_EQ(sim.loaded, original.loaded);
+		EXPECT_EQ(sim.tokens.size(), original.tokens.size());
+		EXPECT_EQ(sim.history.size(), original.history.size());
+		EXPECT_EQ(sim.global, original.global);
+	}
+}
+
+TEST(Simulator, ArcIndex) {
+	graph g = parse_hse_string("x-,y-; *[x+,y+; [x->x-:y->y-]; x-,y-]");
+	ASSERT_TRUE(g.arc_index_ready());
+
+	// The index should list exactly the arcs that leave each place and enter
+	// each transition.
+	const vector<petri::arc> &arcs = g.arcs[petri::place::type];
+	for (int i = 0; i < (int)g.places.size(); i++) {
+		vector<int> expect;
+		for (int a = 0; a < (int)arcs.size(); a++) {
+			if (arcs[a].from.index == i) {
+				expect.push_back(a);
+			}
+		}
+		vector<int> found(g.place_arcs.begin() + g.place_offset[i], g.place_arcs.begin() + g.place_offset[i+1]);
+		EXPECT_EQ(found, expect);
+	}
+
+	for (int i = 0; i < (int)g.transitions.size(); i++) {
+		vector<int> expect;
+		for (int a = 0; a < (int)arcs.size(); a++) {
+			if (arcs[a].to.index == i) {
+				expect.push_back(a);
+			}
+		}
+		vector<int> found(g.transition_arcs.begin() + g.transition_offset[i], g.transition_arcs.begin() + g.transition_offset[i+1]);
+		EXPECT_EQ(found, expect);
+	}
+}
+
+TEST(Simulator, HandBuiltGraph) {
+	// Build *[x+; x-] by hand and never call update_arc_index(), the
+	// snapshot indexes the arcs itself.
+	graph g;
+	int x = g.create(net("x", 0));
+	petri::iterator p0 = g.create(place());
+	petri::iterator t0 = g.create(transition(1, 1, boolean::cover(x, 1)));
+	petri::iterator p1 = g.create(place());
+	petri::iterator t1 = g.create(transition(1, 1, boolean::cover(x, 0)));
+	g.connect(p0, t0);
+	g.connect(t0, p1);
+	g.connect(p1, t1);
+	g.connect(t1, p0);
+	g.reset.push_back(state(vector<petri::token>(1, petri::token(p0.index)), boolean::cover(x, 0)));
+	ASSERT_FALSE(g.arc_index_ready());
+
+	simulator sim(&g, g.reset[0]);
+	ASSERT_EQ(sim.enabled(), 1);
+	EXPECT_EQ(sim.loaded[sim.ready[0].first].index, t0.index);
+	sim.fire(0);
+	ASSERT_EQ(sim.enabled(), 1);
+	EXPECT_EQ(sim.loaded[sim.ready[0].first].index, t1.index);
+
+	// The snapshot's index lists the same arcs as the graph's would.
+	const compiled_graph &cg = *sim.compiled;
+	g.update_arc_index();
+	EXPECT_EQ(cg.place_offset, g.place_offset);
+	EXPECT_EQ(cg.place_arcs, g.place_arcs);
+	EXPECT_EQ(cg.transition_offset, g.transition_offset);
+	EXPECT_EQ(cg.transition_arcs, g.transition_arcs);
+}
+
+TEST(Simulator, CompiledSnapshot) {
+	graph g = parse_hse_string("x-,y-; *[x+,y+; [x->x-:y->y-]; x-,y-]");
+
+	// Every simulator on the same graph shares one snapshot.
+	simulator a(&g, g.reset[0]);
+	simulator b(&g, g.reset[0]);
+	a.enabled();
+	b.enabled();
+	ASSERT_NE(a.compiled, nullptr);
+	EXPECT_EQ(a.compiled, b.compiled);
+	EXPECT_EQ(a.compiled, g.compiled);
+
+	// The output places match the graph.
+	const compiled_graph &cg = *a.compiled;
+	for (int i = 0; i < (int)g.transitions.size(); i++) {
+		if (not g.transitions.is_valid(i)) continue;
+		vector<int> found(cg.output_places.begin() + cg.output_offset[i], cg.output_places.begin() + cg.output_offset[i+1]);
+		EXPECT_EQ(found, g.next(petri::transition::type, i));
+	}
+
+	// Rebuilding the index drops the snapshot, and the next simulator builds
+	// a new one.
+	g.update_arc_index();
+	EXPECT_EQ(g.compiled, nullptr);
+	simulator c(&g, g.reset[0]);
+	c.enabled();
+	EXPECT_NE(c.compiled, a.compiled);
+	EXPECT_EQ(c.ready, a.ready);
+}
+
+TEST(Simulator, RewiredInPlace) {
+	// p0 -> x+ -> p1 -> y+ -> p0
+	graph g;
+	int x = g.create(net("x", 0));
+	int y = g.create(net("y", 0));
+	petri::iterator p0 = g.create(place());
+	petri::iterator t0 = g.create(transition(1, 1, boolean::cover(x, 1)));
+	petri::iterator p1 = g.create(place());
+	petri::iterator t1 = g.create(transition(1, 1, boolean::cover(y, 1)));
+	g.connect(p0, t0);
+	g.connect(t0, p1);
+	g.connect(p1, t1);
+	g.connect(t1, p0);
+	g.reset.push_back(state(vector<petri::token>(1, petri::token(p0.index)), boolean::cover(x, 0) & boolean::cover(y, 0)));
+	g.update_arc_index();
+	ASSERT_TRUE(g.arc_index_ready());
+
+	simulator sim(&g, g.reset[0]);
+	ASSERT_EQ(sim.enabled(), 1);
+	std::shared_ptr<const compiled_graph> before = sim.compiled;
+
+	// Move the arc out of p0 over to y+, which then waits on both places.
+	// The graph keeps the same number of nodes and arcs.
+	size_t arcs = g.arcs[place::type].size();
+	for (int a = 0; a < (int)g.arcs[place::type].size(); a++) {
+		if (g.arcs[place::type][a].from.index == p0.index) {
+			g.erase_arc(petri::iterator(place::type, a));
+			break;
+		}
+	}
+	g.connect(p0, t1);
+	ASSERT_EQ(g.arcs[place::type].size(), arcs);
+	EXPECT_FALSE(g.arc_index_ready());
+
+	EXPECT_EQ(sim.enabled(), 0);
+	EXPECT_NE(sim.compiled, before);
+}
+
+TEST(Simulator, GuardEditedInPlace) {
+	graph g = parse_hse_string("x-; *[x+; x-]");
+	int x = g.netIndex("x");
+
+	simulator sim(&g, g.reset[0]);
+	ASSERT_EQ(sim.enabled(), 1);
+	std::shared_ptr<const compiled_graph> before = sim.compiled;
+
+	// Guard x+ on x itself so that it can never fire. This doesn't change
+	// the number of nodes, arcs, or nets, so only the revision tells the
+	// snapshot that it is stale.
+	int rising = -1;
+	for (int i = 0; i < (int)g.transitions.size(); i++) {
+		if (g.transitions.is_valid(i) and g.transitions[i].local_action == boolean::cover(x, 1)) {
+			rising = i;
+		}
+	}
+	ASSERT_GE(rising, 0);
+	g.transitions[rising].guard = boolean::cover(x, 1);
+	g.modified();
+
+	EXPECT_EQ(sim.enabled(), 0);
+	EXPECT_NE(sim.compiled, before);
+
+	simulator fresh(&g, g.reset[0]);
+	EXPECT_EQ(fresh.enabled(), 0);
+}
+
+TEST(Simulator, GuardMemoMatchesFull) {
+	graph g = parse_hse_string("x-,y-,z-; *[x+,y+; [1->z+:1->skip]; x-,y-,z-]");
+
+	simulator full(&g, g.reset[0]);
+	simulator memoized(&g, g.reset[0]);
+	memoized.memoize_guards = true;
+
+	// Walk both simulators through the same choices and make sure that they
+	// agree at every step.
+	for (int step = 0; step < 200; step++) {
+		int count = full.enabled();
+		ASSERT_EQ(memoized.enabled(), count);
+		ASSERT_EQ(memoized.ready, full.ready);
+		for (int i = 0; i < (int)full.loaded.size(); i++) {
+			EXPECT_EQ(memoized.loaded[i].index, full.loaded[i].index);
+			EXPECT_EQ(memoized.loaded[i].vacuous, full.loaded[i].vacuous);
+			EXPECT_EQ(memoized.loaded[i].stable, full.loaded[i].stable);
+		}
+		if (count == 0) {
+			break;
+		}
+
+		full.fire(step%count);
+		memoized.fire(step%count);
+		ASSERT_EQ(memoized.encoding, full.encoding);
+	}
+}
+
+TEST(Simulator, GuardMemoSurvivesCopies) {
+	graph g = parse_hse_string("x-,y-,z-; *[x+,y+; [1->z+:1->skip]; x-,y-,z-]");
+
+	simulator full(&g, g.reset[0]);
+	simulator memoized(&g, g.reset[0]);
+	memoized.memoize_guards = true;
+	for (int step = 0; step < 20 and full.enabled() > 0; step++) {
+		memoized.enabled();
+		full.fire(step%(int)full.ready.size());
+		memoized.fire(step%(int)memoized.ready.size());
+	}
+
+	// The copy keeps the remembered checks and goes on agreeing with a
+	// simulator that checks every guard.
+	simulator copy = memoized;
+	EXPECT_FALSE(copy.memo.entries.empty());
+	EXPECT_EQ(copy.memo.stamp, memoized.memo.stamp);
+	for (int step = 0; step < 100; step++) {
+		int count = full.enabled();
+		ASSERT_EQ(copy.enabled(), count);
+		ASSERT_EQ(copy.ready, full.ready);
+		if (count == 0) {
+			break;
+		}
+
+		full.fire(step%count);
+		copy.fire(step%count);
+		ASSERT_EQ(copy.encoding, full.encoding);
+	}
+}
+
+TEST(Simulator, InternedCovers) {
+	boolean::cover a = boolean::cover(0, 1) & boolean::cover(1, 0);
+	boolean::cover b = boolean::cover(0, 1) & boolean::cover(1, 0);
+
+	// Structurally equal covers share one id, and the constants have fixed ids.
+	EXPECT_EQ(interned_cover(a), interned_cover(b));
+	EXPECT_EQ(interned_cover(boolean::cover()).id, 0);
+	EXPECT_EQ(interned_cover(boolean::cover(1)).id, 1);
+
+	interned_cover x(boolean::cover(0, 1));
+	interned_cover y(boolean::cover(1, 0));
+	EXPECT_EQ(x & y, interned_cover(a));
+	EXPECT_EQ(y & x, x & y);
+	EXPECT_EQ((x & interned_cover(1)), x);
+	EXPECT_EQ((x & interned_cover(0)).id, 0);
+	EXPECT_EQ((x & y).get(), a);
+}
+
+TEST(Simulator, InternedCoversAcrossThreads) {
+	// Every thread interns and combines the same covers, so they all have to
+	// agree on the ids no matter which shard or cache answered.
+	const int threads = 4;
+	vector<vector<int> > ids(threads);
+	vector<std::thread> workers;
+	for (int t = 0; t < threads; t++) {
+		workers.push_back(std::thread([&ids, t]() {
+			for (int i = 0; i < 64; i++) {
+				interned_cover x(boolean::cover(i, 1));
+				interned_cover y(boolean::cover(i+1, 0));
+				ids[t].push_back(x.id);
+				ids[t].push_back((x & y).id);
+			}
+		}));
+	}
+	for (auto w = workers.begin(); w != workers.end(); w++) {
+		w->join();
+	}
+
+	for (int t = 1; t < threads; t++) {
+		EXPECT_EQ(ids[t], ids[0]);
+	}
+}
+
+TEST(Simulator, HistoryScopes) {
+	term_history outer;
+	outer.push_back(term_index(1, 0));
+
+	{
+		history_scope histories;
+		term_history inner;
+		inner.push_back(term_index(1, 0));
+		inner.push_back(term_index(2, 0));
+		EXPECT_EQ(inner.size(), 2);
+		EXPECT_EQ(inner.to_vector(), vector<term_index>({term_index(1, 0), term_index(2, 0)}));
+
+		// Worker threads join the arena of the scope that started them.
+		term_history shared;
+		std::thread worker([&shared](std::shared_ptr<history_arena> arena) {
+			history_scope joined(arena);
+			shared.push_back(term_index(1, 0));
+			shared.push_back(term_index(2, 0));
+		}, history_scope::current());
+		worker.join();
+		EXPECT_EQ(shared, inner);
+	}
+
+	// Histories made outside of the scope are untouched by its release.
+	EXPECT_EQ(outer.size(), 1);
+	EXPECT_EQ(outer.back(), term_index(1, 0));
+}
+
+TEST(Simulator, ScratchScopes) {
+	EXPECT_EQ(scratch_scope::current(), std::pmr::new_delete_resource());
+
+	graph g = parse_hse_string("x-,y-; *[x+,y+; x-,y-]");
+	simulator plain(&g, g.reset[0]);
+	int expect = plain.enabled();
+	{
+		scratch_scope scratch;
+		EXPECT_EQ(scratch_scope::current(), &scratch.pool);
+		{
+			// A disabled scope leaves the enclosing one in place.
+			scratch_scope off(false);
+			EXPECT_EQ(scratch_scope::current(), &scratch.pool);
+		}
+
+		simulator pooled(&g, g.reset[0]);
+		EXPECT_EQ(pooled.enabled(), expect);
+		pooled.fire(0);
+		EXPECT_GT(pooled.enabled(), 0);
+	}
+
+	EXPECT_EQ(scratch_scope::current(), std::pmr::new_delete_resource());
+}
@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+
+#include <hse/graph.h>
+#include <hse/timing.h>
+
+#include "helpers.h"
+
+using namespace hse;
+using namespace std;
+
+TEST(Timing, FixedDelayCycleTime) {
+	graph g = parse_hse_string("x-,y-; *[x+; y+; x-; y-]");
+	int x = g.netIndex("x");
+	int y = g.netIndex("y");
+
+	timing_config config;
+	config.steps = 400;
+	config.default_delay = delay_model(delay_model::FIXED, 10.0);
+	config.channels.push_back(pair<int, int>(x, y));
+
+	timing_stats result = simulate_timed(g, config);
+	EXPECT_FALSE(result.deadlocked);
+	EXPECT_EQ(result.steps, 400u);
+	EXPECT_NEAR((double)result.elapsed, 4000.0, 10.0);
+	EXPECT_DOUBLE_EQ(result.cycle_time.mean(), 40.0);
+	EXPECT_DOUBLE_EQ(result.cycle_time.stddev(), 0.0);
+	EXPECT_NEAR((double)result.rises[x], 100.0, 1.0);
+	ASSERT_EQ(result.channels.size(), 1u);
+	EXPECT_NEAR((double)result.channels[0].handshakes, 100.0, 1.0);
+	EXPECT_DOUBLE_EQ(result.channels[0].latency.mean(), 10.0);
+}
+
+TEST(Timing, SameSeedSameRun) {
+	graph g = parse_hse_string("x-,y-; *[x+ || y+; x-, y-]");
+
+	timing_config config;
+	config.steps = 1000;
+	config.seed = 7;
+
+	timing_stats a = simulate_timed(g, config);
+	timing_stats b = simulate_timed(g, config);
+	EXPECT_EQ(a.elapsed, b.elapsed);
+	EXPECT_EQ(a.rises, b.rises);
+	EXPECT_EQ(a.cycle_time.counts, b.cycle_time.counts);
+}
+
+TEST(Timing, InvalidDelaysAreRejected) {
+	graph g = parse_hse_string("x-,y-; *[x+; y+; x-; y-]");
+	int x = g.netIndex("x");
+
+	EXPECT_EQ(delay_model(delay_model::FIXED, 10.0).check(), "");
+	EXPECT_EQ(delay_model(delay_model::UNIFORM, 5.0, 5.0).check(), "");
+	EXPECT_NE(delay_model(delay_model::UNIFORM, 10.0, 5.0).check(), "");
+	EXPECT_NE(delay_model(delay_model::EXPONENTIAL, 0.0).check(), "");
+	EXPECT_NE(delay_model(delay_model::EXPONENTIAL, -1.0).check(), "");
+	EXPECT_NE(delay_model(delay_model::PARETO, 10.0, 0.0).check(), "");
+
+	timing_config config;
+	config.steps = 100;
+	config.default_delay = delay_model(delay_model::EXPONENTIAL, 0.0);
+	testing::internal::CaptureStdout();
+	testing::internal::CaptureStderr();
+	timing_stats result = simulate_timed(g, config);
+	string out = testing::internal::GetCapturedStdout();
+	out += testing::internal::GetCapturedStderr();
+	EXPECT_EQ(result.steps, 0u);
+	EXPECT_NE(out.find("default delay"), string::npos);
+
+	config.default_delay = delay_model(delay_model::FIXED, 10.0);
+	config.net_delay[x] = delay_model(delay_model::UNIFORM, 10.0, 5.0);
+	testing::internal::CaptureStdout();
+	testing::internal::CaptureStderr();
+	result = simulate_timed(g, config);
+	out = testing::internal::GetCapturedStdout();
+	out += testing::internal::GetCapturedStderr();
+	EXPECT_EQ(result.steps, 0u);
+	EXPECT_NE(out.find("delay of net x"), string::npos);
+}
@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+
+#include <hse/graph.h>
+#include <hse/state.h>
+#include <hse/simulator.h>
+#include <hse/trace.h>
+
+#include "helpers.h"
+
+using namespace hse;
+using namespace std;
+
+TEST(Trace, SeekReplaysRecordedStates) {
+	graph g = parse_hse_string("x-,y-; *[x+ || y+; x-, y-]");
+	string path = (std::filesystem::temp_directory_path() / "hse_trace_tests.bin").string();
+
+	// Record a walk, keeping the state after every firing to compare against.
+	simulator sim(&g, g.reset[0]);
+	vector<state> states(1, sim.get_state());
+	vector<uint64_t> times(1, sim.now);
+
+	trace_writer writer;
+	ASSERT_TRUE(writer.open(path, g, sim, 4));
+	for (int step = 0; step < 30; step++) {
+		int count = sim.enabled();
+		ASSERT_GT(count, 0);
+		int index = (step*7)%count;
+		writer.record(sim, index);
+		sim.fire(index);
+		states.push_back(sim.get_state());
+		times.push_back(sim.now);
+	}
+	writer.close();
+
+	trace_reader reader;
+	ASSERT_TRUE(reader.open(path, &g));
+	EXPECT_EQ(reader.steps, 30u);
+	EXPECT_EQ(reader.blocks.size(), 8u);
+
+	// Seek out of order so that every seek starts from a keyframe.
+	for (int step = 30; step >= 0; step -= 3) {
+		simulator replay;
+		ASSERT_TRUE(reader.seek(step, replay));
+		EXPECT_EQ(replay.get_state(), states[step]);
+		EXPECT_EQ(replay.now, times[step]);
+	}
+
+	simulator past;
+	EXPECT_FALSE(reader.seek(31, past));
+	reader.close();
+
+	std::remove(path.c_str());
+}
+
+TEST(Trace, RejectsOtherGraph) {
+	graph g = parse_hse_string("x-,y-; *[x+; y+; x-; y-]");
+	graph h = parse_hse_string("x-,y-; *[y+; x+; y-; x-]");
+	string path = (std::filesystem::temp_directory_path() / "hse_trace_tests_other.bin").string();
+
+	simulator sim(&g, g.reset[0]);
+	trace_writer writer;
+	ASSERT_TRUE(writer.open(path, g, sim));
+	writer.close();
+
+	trace_reader reader;
+	EXPECT_TRUE(reader.open(path, &g));
+	reader.close();
+	EXPECT_FALSE(reader.open(path, &h));
+
+	std::remove(path.c_str());
+}
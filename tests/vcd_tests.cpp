@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include <hse/graph.h>
+#include <hse/simulator.h>
+#include <hse/vcd.h>
+
+#include "helpers.h"
+
+using namespace hse;
+using namespace std;
+
+TEST(Waveform, RecordsValueChanges) {
+	graph g = parse_hse_string("x-,y-; *[x+; y+; x-; y-]");
+	int x = g.netIndex("x");
+	int y = g.netIndex("y");
+	string path = (std::filesystem::temp_directory_path() / "hse_vcd_tests.vcd").string();
+
+	vcd_writer waveform;
+	ASSERT_TRUE(waveform.open(path, g));
+
+	simulator sim(&g, g.reset[0]);
+	sim.waveform = &waveform;
+	waveform.sample(sim);
+	for (int step = 0; step < 8; step++) {
+		ASSERT_GT(sim.enabled(), 0);
+		sim.fire(0);
+	}
+	waveform.close();
+
+	ifstream fin(path);
+	stringstream contents;
+	contents << fin.rdbuf();
+	string vcd = contents.str();
+
+	EXPECT_NE(vcd.find("$var wire 1 " + waveform.codes[x] + " x $end"), string::npos);
+	EXPECT_NE(vcd.find("$var wire 1 " + waveform.codes[y] + " y $end"), string::npos);
+	EXPECT_NE(vcd.find("$dumpvars\n"), string::npos);
+
+	// Two cycles of the handshake, each net rises and falls twice.
+	size_t rises = 0, falls = 0;
+	for (size_t i = vcd.find("$end\n", vcd.find("$dumpvars")); i != string::npos; i = vcd.find('\n', i+1)) {
+		if (vcd.compare(i+1, 1 + waveform.codes[x].size() + 1, "1" + waveform.codes[x] + "\n") == 0) {
+			rises++;
+		} else if (vcd.compare(i+1, 1 + waveform.codes[x].size() + 1, "0" + waveform.codes[x] + "\n") == 0) {
+			falls++;
+		}
+	}
+	EXPECT_EQ(rises, 2u);
+	EXPECT_EQ(falls, 2u);
+
+	std::remove(path.c_str());
+}
@@ -0,0 +1,47 @@
+#include <gtest/gtest.h>
+
+#include <hse/graph.h>
+#include <hse/walker.h>
+
+#include "helpers.h"
+
+using namespace hse;
+using namespace std;
+
+TEST(Walker, CoversHandshake) {
+	graph g = parse_hse_string("x-,y-; *[x+; y+; x-; y-]");
+
+	walk_config config;
+	config.walks = 8;
+	config.steps = 20;
+	config.threads = 2;
+
+	walk_stats result = random_walks(g, config);
+	EXPECT_EQ(result.walks, 8u);
+	EXPECT_EQ(result.steps, 160u);
+	EXPECT_EQ(result.deadlocks, 0u);
+	EXPECT_DOUBLE_EQ(result.place_coverage(g), 1.0);
+	EXPECT_DOUBLE_EQ(result.transition_coverage(g), 1.0);
+	EXPECT_DOUBLE_EQ(result.term_coverage(g), 1.0);
+	EXPECT_EQ(result.errors->size(), 0u);
+}
+
+TEST(Walker, ThreadsDontChangeResult) {
+	graph g = parse_hse_string("x-,y-; *[x+ || y+; x-, y-]");
+
+	walk_config config;
+	config.walks = 64;
+	config.steps = 50;
+	config.seed = 3;
+
+	config.threads = 1;
+	walk_stats serial = random_walks(g, config);
+	config.threads = 4;
+	walk_stats parallel = random_walks(g, config);
+
+	EXPECT_EQ(serial.steps, parallel.steps);
+	EXPECT_EQ(serial.deadlocks, parallel.deadlocks);
+	EXPECT_EQ(serial.places, parallel.places);
+	EXPECT_EQ(serial.terms, parallel.terms);
+	EXPECT_EQ(serial.errors->size(), parallel.errors->size());
+}